@@ -0,0 +1,147 @@
+/*
+ * Viewer for albums with the viewer option enabled, which have no page for
+ * each image. The list of images comes from the images.json file given in the
+ * data-images attribute of the script, and the image shown is the one in the
+ * fragment of the URL, i.e. album/#name.
+ */
+(function () {
+	"use strict";
+
+	var script = document.currentScript;
+	var images = [];
+	var byName = {};
+	var current = -1;
+	var overlay, img, caption, prev, next;
+
+	function build() {
+		overlay = document.createElement("div");
+		overlay.className = "viewer-overlay";
+		overlay.hidden = true;
+
+		img = document.createElement("img");
+		caption = document.createElement("p");
+		caption.className = "viewer-caption";
+
+		prev = document.createElement("a");
+		prev.className = "control-btn viewer-prev";
+		prev.textContent = "⮜ Previous";
+		next = document.createElement("a");
+		next.className = "control-btn viewer-next";
+		next.textContent = "Next ⮞";
+
+		var close = document.createElement("a");
+		close.className = "control-btn viewer-close";
+		close.href = "#";
+		close.textContent = "✕";
+
+		var controls = document.createElement("div");
+		controls.className = "controls-container";
+		controls.append(prev, caption, next);
+		overlay.append(close, img, controls);
+		document.body.append(overlay);
+
+		overlay.addEventListener("click", function (e) {
+			if (e.target === overlay) hide();
+		});
+		close.addEventListener("click", function (e) {
+			e.preventDefault();
+			hide();
+		});
+	}
+
+	function describe(image) {
+		var parts = [];
+		var exif = image.exif || {};
+		if (image.date) parts.push(image.date);
+		if (exif.camera) parts.push(exif.camera);
+		if (exif.lens) parts.push(exif.lens);
+		if (exif.focal_length) parts.push(exif.focal_length + " mm");
+		if (exif.fnumber) parts.push("f/" + exif.fnumber);
+		if (exif.exposure) parts.push(exif.exposure + " s");
+		if (exif.iso) parts.push("ISO " + exif.iso);
+		return parts.join(" · ");
+	}
+
+	function link(a, i) {
+		if (i < 0 || i >= images.length) {
+			a.classList.add("hidden");
+			a.removeAttribute("href");
+		} else {
+			a.classList.remove("hidden");
+			a.href = "#" + encodeURIComponent(images[i].name);
+		}
+	}
+
+	function show(i) {
+		var image = images[i];
+		current = i;
+		img.src = image.source;
+		img.alt = image.name;
+		img.style.backgroundColor = image.placeholder || "";
+		if (image.width && image.height) {
+			img.width = image.width;
+			img.height = image.height;
+		} else {
+			img.removeAttribute("width");
+			img.removeAttribute("height");
+		}
+		caption.textContent = describe(image);
+		link(prev, i - 1);
+		link(next, i + 1);
+		overlay.hidden = false;
+		/* Have the next image ready before it's asked for */
+		if (i + 1 < images.length) new Image().src = images[i + 1].source;
+	}
+
+	function hide() {
+		overlay.hidden = true;
+		current = -1;
+		if (location.hash) {
+			history.pushState(null, "", location.pathname + location.search);
+		}
+	}
+
+	function route() {
+		var name = decodeURIComponent(location.hash.slice(1));
+		if (name in byName) {
+			show(byName[name]);
+		} else if (current >= 0) {
+			overlay.hidden = true;
+			current = -1;
+		}
+	}
+
+	document.addEventListener("keydown", function (e) {
+		if (current < 0) return;
+		if (e.key === "Escape") {
+			hide();
+		} else if (e.key === "ArrowLeft" && current > 0) {
+			location.hash = encodeURIComponent(images[current - 1].name);
+		} else if (e.key === "ArrowRight" && current + 1 < images.length) {
+			location.hash = encodeURIComponent(images[current + 1].name);
+		}
+	});
+
+	fetch(script.dataset.images)
+		.then(function (res) {
+			return res.json();
+		})
+		.then(function (data) {
+			images = data.images;
+			images.forEach(function (image, i) {
+				byName[image.name] = i;
+			});
+			build();
+			/* Keep to this page, which may not be the first of the album */
+			document.addEventListener("click", function (e) {
+				var a = e.target.closest(".album-container a");
+				if (!a || !a.hash) return;
+				var name = decodeURIComponent(a.hash.slice(1));
+				if (!(name in byName)) return;
+				e.preventDefault();
+				location.hash = a.hash;
+			});
+			window.addEventListener("hashchange", route);
+			route();
+		});
+})();
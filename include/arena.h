@@ -0,0 +1,62 @@
+#ifndef REVELA_ARENA_H
+#define REVELA_ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+/*
+ * A bump allocator. Memory is handed out sequentially from big blocks and is
+ * only given back all at once when the arena is freed, which makes it a good
+ * fit for the many small strings and structs that live as long as the site.
+ */
+struct arena {
+	/* The block from which memory is currently being handed out */
+	struct arena_block *head;
+	/* Size of each new block */
+	size_t block_size;
+	/* Number of allocations that were served by the arena */
+	size_t nallocs;
+	/* Number of blocks, i.e. actual calls to malloc */
+	size_t nblocks;
+	/* Bytes handed out and bytes reserved in blocks */
+	size_t used;
+	size_t reserved;
+};
+
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+void arena_init(struct arena *, size_t block_size);
+
+/*
+ * Returns size bytes of memory suitably aligned for any type, or NULL if
+ * there's no memory left.
+ */
+void *arena_alloc(struct arena *, size_t size);
+
+/*
+ * Same as arena_alloc() but the memory is zeroed.
+ */
+void *arena_calloc(struct arena *, size_t nmemb, size_t size);
+
+char *arena_strdup(struct arena *, const char *);
+
+/*
+ * Joins two paths into one, e.g. /hello, word -> /hello/world
+ * The new string is allocated in the arena.
+ */
+char *arena_joinpath(struct arena *, const char *restrict a,
+                     const char *restrict b);
+
+/*
+ * Gives back all of the memory allocated by the arena so that it can be used
+ * again, while keeping the current block around to avoid allocating it anew.
+ */
+void arena_reset(struct arena *);
+
+/*
+ * Frees all of the memory allocated by the arena at once.
+ */
+void arena_free(struct arena *);
+
+#endif
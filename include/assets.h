@@ -0,0 +1,82 @@
+#ifndef REVELA_ASSETS_H
+#define REVELA_ASSETS_H
+
+#include "hmap.h"
+#include "vector.h"
+
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Tag with the content hash in hashed file names, e.g. gallery.rv-1a2b3c4d.css.
+ * The prefix tells them apart from names that happen to end in hex digits,
+ * e.g. IMG.20230101.jpg, which mustn't be cached for good.
+ */
+#define ASSETS_TAG_PREFIX "rv-"
+#define ASSETS_HASH_LEN 8
+#define ASSETS_TAG_LEN (sizeof ASSETS_TAG_PREFIX - 1 + ASSETS_HASH_LEN)
+
+/*
+ * File in the output dir with an nginx snippet that marks the files with hashed
+ * names as immutable, to be included in the server block of the gallery. See
+ * output_config.
+ */
+#define ASSETS_CONF ".revela-immutable.conf"
+
+/* A file in the static dir */
+struct asset {
+	/* Path relative to the static dir, e.g. css/gallery.css */
+	char *path;
+	/* The same path with the content hash in its name if enabled */
+	char *name;
+	/* The url of the file in the gallery */
+	char *url;
+};
+
+/* The files of the static dir, for templates to look up by their path */
+struct assets {
+	/* The assets in the order they were found */
+	struct vector *list;
+	/* The same assets with their path as the key */
+	struct hmap *paths;
+	/* Newest modtime of the files */
+	struct timespec modtime;
+	/* Whether the names have the content hash of the files */
+	bool hashed;
+};
+
+/* Formats ASSETS_TAG_PREFIX and the first ASSETS_HASH_LEN hex digits of hash
+ * into tag */
+void assets_tag(uint64_t hash, char *tag);
+
+/*
+ * Copies path into buf with tag inserted before the extension of its basename,
+ * or at the end if it has none. Returns false if buf isn't big enough.
+ */
+bool assets_tagged_name(const char *path, const char *tag, char *buf,
+                        size_t size);
+
+/*
+ * Loads the files in dir recursively, hashing them if hashed is set. Their
+ * urls are made out of base_url.
+ */
+bool assets_load(struct assets *, const char *dir, const char *base_url,
+                 bool hashed);
+
+/*
+ * Copies the files of the static dir src into the working dir, both under their
+ * own name and under their hashed one if different, and removes what doesn't
+ * belong to them except for the entries in preserved. The hashed copies also
+ * get their compressed siblings, see compress.h.
+ */
+bool assets_sync(const struct assets *, const char *src,
+                 struct hmap *preserved, bool dry);
+
+/* Writes ASSETS_CONF into dir unless it is already up to date */
+bool assets_conf_write(const char *dir, bool dry);
+
+void assets_free(struct assets *);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef REVELA_CACHE_H
+#define REVELA_CACHE_H
+
+#include "config.h"
+#include "components.h"
+
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Content addressed cache of optimized images that can be shared between
+ * builds of different sites or output dirs. Entries are keyed by the contents
+ * of the source, the settings used to convert it and the version of the
+ * encoder, so that the same image is never converted twice with the same
+ * settings.
+ */
+struct cache {
+	/* The root dir of the cache; NULL if the cache is disabled */
+	const char *dir;
+	/* Maximum size of all the entries in bytes */
+	size_t max_size;
+	/* Seed for all the keys; depends on the encoder version */
+	uint64_t seed;
+	/* Stats for the current build */
+	size_t hits;
+	size_t misses;
+	size_t stored;
+};
+
+bool cache_init(struct cache *, const struct cache_config *);
+
+/*
+ * Key of the optimized main image. The image's source needs to be
+ * fingerprinted already.
+ */
+uint64_t cache_image_key(const struct cache *, const struct image *,
+                         const struct image_config *);
+
+/*
+ * Key of a derivative made out of another derivative, e.g. a thumbnail, which
+ * is made out of the optimized main image.
+ */
+uint64_t cache_derivative_key(uint64_t parent, const struct image_config *,
+                              const char *ext);
+
+/*
+ * Materializes the entry with the key at dst, if it exists, setting its
+ * modtime to mtim. Returns true on a cache hit.
+ */
+bool cache_fetch(struct cache *, uint64_t key, const char *ext,
+                 const char *dst, const struct timespec *mtim);
+
+/*
+ * Adds the file at src to the cache with the key.
+ */
+void cache_store(struct cache *, uint64_t key, const char *ext,
+                 const char *src);
+
+/*
+ * Evicts the least recently used entries until the cache fits in its maximum
+ * size. Does nothing if nothing was added during this build.
+ */
+void cache_trim(struct cache *);
+
+#endif
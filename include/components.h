@@ -1,15 +1,19 @@
 #ifndef REVELA_COMPONENTS_H
 #define REVELA_COMPONENTS_H
 
+#include "arena.h"
+#include "exif.h"
 #include "config.h"
+#include "meta.h"
+#include "sprite.h"
 
 #include "hmap.h"
 #include "vector.h"
 #include "object.h"
 
 #include <time.h>
+#include <limits.h>
 #include <sys/stat.h>
-#include <libexif/exif-data.h>
 
 #define THUMB_SUFFIX "_thumb"
 
@@ -23,8 +27,23 @@ struct image {
 	const char *basename;
 	/* Points to the extension in source */
 	const char *ext;
-	/* The "url" to the dir where index.html for this image will be located */
+	/*
+	 * The extension of the optimized image and the thumbnail, which is ext
+	 * unless another format was chosen for them, and the name of that format;
+	 * format is only set if it was chosen, see POLICY_AUTO.
+	 */
+	const char *out_ext;
+	const char *format;
+	/*
+	 * The "url" to the dir where the files of this image will be located, which
+	 * is only its own with LAYOUT_NESTED.
+	 */
 	char *url;
+	/*
+	 * The "url" to the page of the image, i.e. url with LAYOUT_NESTED, or an
+	 * anchor in the album page if the album has a viewer instead of image pages.
+	 */
+	char *link;
 	/* The "url" to the image file */
 	char *url_image;
 	/* The "url" to the thumbnail image file */
@@ -33,18 +52,49 @@ struct image {
 	const char *dst;
 	const char *dst_image;
 	const char *dst_thumb;
-	/* The "raw" exif data extracted from the original file */
-	ExifData *exif_data;
+	/* The relative path to the html file of the page of this image */
+	const char *dst_page;
+	/*
+	 * The "url" to the descriptor of the tile pyramid of the image, and the
+	 * relative paths to it and to its tiles; only set if the image is big
+	 * enough for one, see zoom.h.
+	 */
+	char       *url_zoom;
+	const char *dst_zoom;
+	const char *dst_tiles;
+	/* The exif tags extracted from the original file */
+	struct image_exif exif;
+	/*
+	 * The placeholder, i.e. the color to show until the thumbnail loads, and
+	 * the size of the thumbnail; see meta.h
+	 */
+	struct meta_thumb thumb;
+	/*
+	 * The qualities chosen for the derivatives with ssim and what the pixels
+	 * of the source look like; see meta.h
+	 */
+	struct meta_encoding encoding;
+	/*
+	 * The url of the atlas with the thumbnail and where it is in it, if albums
+	 * have sprites; see albums_config.
+	 */
+	const char        *sprite;
+	struct sprite_cell cell;
+	/* Index of the record of the source in the site's meta */
+	size_t meta_index;
 	/* Last modified time of source file */
 	struct timespec modtime;
+	/* Size in bytes of the source file */
+	off_t size;
+	/* Hash of the contents of the source file; valid only if hashed is set */
+	uint64_t hash;
+	bool hashed;
 	/* The datetime this image was taken in human friendly form */
 	char datestr[24];
 	/* Same as date but in seconds for easier comparison. See image_set_date() */
 	time_t tstamp;
-	/* Reference counted hashmap with values to be passed to the template */
-	struct roscha_object *map;
-	/* hashmap with values to be passed to the thumbs vector */
-	struct roscha_object *thumb;
+	/* Position of the image in its album once sorted */
+	size_t index;
 	/*
 	 * Whether this image was modified since the last time the gallery was
 	 * generated.
@@ -52,6 +102,16 @@ struct image {
 	bool modified;
 };
 
+/* What's left of an image in its album after the images are released */
+struct album_preview {
+	/* The "url" to the dir where index.html for the image is located */
+	const char *link;
+	/* The "url" to the thumbnail image file */
+	const char *source;
+	/* See image.thumb */
+	const char *placeholder;
+};
+
 /* All data related to an album's images, templates, and pages */
 struct album {
 	struct site *site;
@@ -81,23 +141,60 @@ struct album {
 	struct vector *images;
 	/* Files/dirs that belong to images and which shouldn't be deleted */
 	struct hmap *preserved;
-	/* Reference counted hashmap with values to be passed to the template */
-	struct roscha_object *map;
-	/* Reference counted vector with refcounted hashmaps of image thumbnails to
-	 * be passed to the template.
-	 */
-	struct roscha_object *thumbs;
 	/* Count of images that were actually updated */
 	size_t images_updated;
+	/* The manifest left by the previous build in this album's dir, if any */
+	struct manifest *manifest;
+	/* The arena where the images of this album are allocated */
+	struct arena *arena;
+	/* The first thumbnails of the album; only set once the images of the
+	 * album were released, see album_release_images().
+	 */
+	struct album_preview *previews;
+	size_t npreviews;
 };
 
-struct image *image_new(char *src, const struct stat *, struct album *);
-
-struct image *image_old(struct stat *istat);
+struct image *image_new(const char *src, const struct stat *, struct album *);
 
 int image_cmp(const void *a, const void *b);
 
-void image_destroy(struct image *);
+/* Where the outputs of an image go, see image_paths() */
+struct image_paths {
+	/* The dir with the optimized image and the thumbnail */
+	char dir[PATH_MAX];
+	char image[PATH_MAX];
+	char thumb[PATH_MAX];
+	/* The html file of the page of the image */
+	char page[PATH_MAX];
+	/* The descriptor of the tile pyramid and the dir of its tiles */
+	char zoom[PATH_MAX];
+	char tiles[PATH_MAX];
+};
+
+/*
+ * Sets the paths of the outputs of the image file named basename in the album
+ * dir base according to layout, with tag in the names of the optimized image
+ * and the thumbnail unless it is NULL, and ext as their extension, or that of
+ * basename if it is NULL. Returns false if the paths are too long.
+ */
+bool image_paths(struct image_paths *, enum image_layout, const char *base,
+                 const char *basename, const char *tag, const char *ext);
+
+/*
+ * Sets tag to a hash of what the optimized image and the thumbnail of a source
+ * with the given size, modtime and extension are made out of, i.e. the source
+ * and the settings in conf, for their names to change along with them. The tag
+ * is ASSETS_TAG_LEN + 1 bytes long; see output_config.
+ */
+void image_tag(const struct site_config *conf, off_t size,
+               const struct timespec *mtim, const char *ext, char *tag);
+
+/*
+ * Computes the dimensions that an image of x by y pixels will have once
+ * optimized according to conf.
+ */
+void image_fit(const struct image_config *conf, unsigned long *x,
+               unsigned long *y);
 
 struct album *album_new(struct album_config *, struct site *,
                         const char *src, const char *rsrc, const struct stat *);
@@ -108,6 +205,13 @@ void album_add_image(struct album *, struct image *);
 
 void album_set_year(struct album *);
 
+/*
+ * Destroys the images of the album, keeping only what is needed to show the
+ * album in the index, i.e. its date and its first npreviews thumbnails, which
+ * are copied into the site's arena.
+ */
+void album_release_images(struct album *, size_t npreviews);
+
 void album_destroy(struct album *);
 
 #endif
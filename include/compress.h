@@ -0,0 +1,67 @@
+#ifndef REVELA_COMPRESS_H
+#define REVELA_COMPRESS_H
+
+#include "config.h"
+
+#include <time.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+/*
+ * Pre-compressed siblings of the text files in the output, e.g. index.html.gz
+ * next to index.html, for web servers to send as they are instead of
+ * compressing the files for each request. Brotli and zstd are only available
+ * if revela was built with them, see the Makefile.
+ */
+enum compress_format {
+	COMPRESS_GZIP   = 1 << 0,
+	COMPRESS_BROTLI = 1 << 1,
+	COMPRESS_ZSTD   = 1 << 2,
+};
+
+/*
+ * Sets the formats of the siblings that are written from now on according to
+ * conf. Should be called before any other thread is started. Returns false if
+ * any of them isn't available.
+ */
+bool compress_init(const struct compress_config *conf);
+
+bool compress_enabled(void);
+
+/*
+ * Whether name is the sibling of an enabled format of some file, in which case
+ * the name of that file is copied to stem.
+ */
+bool compress_stem(const char *name, char *stem, size_t size);
+
+/*
+ * Writes the siblings of path for the enabled formats out of the iovcnt pieces
+ * in iov, setting their modtime to mtim.
+ */
+bool compress_iov(const char *path, const struct iovec *iov, size_t iovcnt,
+                  const struct timespec *mtim);
+
+/*
+ * 1 if the siblings of path for the enabled formats exist and, unless mtim is
+ * NULL, have mtim as their modtime; 0 otherwise, and -1 on error.
+ */
+int compress_uptodate(const char *path, const struct timespec *mtim);
+
+/* Whether name has the extension of a text file worth compressing */
+bool compress_is_text(const char *name);
+
+/*
+ * Writes the siblings of dst for the enabled formats out of the contents of the
+ * file src, setting their modtime to the one of src.
+ */
+bool compress_file(const char *src, const char *dst);
+
+/*
+ * Brings the siblings of the compressible files in the dst dir up to date with
+ * their copies in the src dir, using up to nthreads threads.
+ */
+bool compress_tree(const char *src, const char *dst, size_t nthreads,
+                   bool dry);
+
+#endif
@@ -14,6 +14,106 @@ struct image_config {
 	size_t  max_height;
 	bool    smart_resize;
 	double  blur;
+	/*
+	 * SSIM from 0 to 1 that lossy images should keep, searching for the
+	 * lowest quality up to quality that does; 0 to always use quality
+	 */
+	double  ssim;
+};
+
+struct cache_config {
+	/* Directory of the shared derivative cache; disabled if NULL */
+	char  *dir;
+	/* Maximum size of the cache in MiB */
+	size_t max_size;
+};
+
+struct index_config {
+	/* Number of thumbnails of each album kept for the index in streaming
+	 * builds */
+	size_t previews;
+	/* Number of albums in each index page; 0 for a single page */
+	size_t per_page;
+	/* Whether there's also an index of the albums of each year */
+	bool years;
+};
+
+/* Where the files and the page of each image go in the album dir */
+enum image_layout {
+	/* A dir for each image with its files and index.html, i.e. album/image/ */
+	LAYOUT_NESTED,
+	/* The files of every image in the album dir, pages as album/image.html */
+	LAYOUT_FLAT,
+	/* The files in up to 256 dirs in the album dir, pages as in flat */
+	LAYOUT_SHARDED,
+};
+
+struct albums_config {
+	/* Number of thumbnails in each album page; 0 for a single page */
+	size_t per_page;
+	/*
+	 * Whether albums have a viewer in the album page instead of a page for
+	 * each image; see VIEWER_FILE.
+	 */
+	bool viewer;
+	enum image_layout layout;
+	/*
+	 * Number of thumbnails in each atlas of the thumbnails of an album page;
+	 * 0 for none. See sprite.h.
+	 */
+	size_t sprite;
+};
+
+/* Formats of the pre-compressed siblings of text outputs, see compress.h */
+struct compress_config {
+	bool gzip;
+	bool brotli;
+	bool zstd;
+};
+
+/* Which formats the optimized images and the thumbnails are written in */
+enum format_policy {
+	/* The format of the source */
+	POLICY_SOURCE,
+	/* The one that suits the pixels of the source best, see format.h */
+	POLICY_AUTO,
+};
+
+struct output_config {
+	/* Whether pages are minified before being written */
+	bool minify;
+	/*
+	 * Whether the optimized images and the static files get a hash of their
+	 * contents in their names, see assets.h
+	 */
+	bool hash_names;
+	enum format_policy format;
+	/* Whether POLICY_AUTO may choose WebP */
+	bool webp;
+};
+
+/* Tile pyramids of big pictures for zooming into them, see zoom.h */
+struct zoom_config {
+	/* Pictures bigger than this many megapixels get one; 0 for none */
+	size_t  min_megapixels;
+	size_t  tile_size;
+	/* Pixels that each tile shares with those next to it on each side */
+	size_t  overlap;
+	uint8_t quality;
+};
+
+/* How the sources are read, see image_decode_hint() */
+struct decode_config {
+	/*
+	 * Whether JPEGs are decoded straight at a fraction of their size when
+	 * they're only needed smaller than that
+	 */
+	bool   scaled;
+	/*
+	 * Memory in MiB for the pixels of the image being read, beyond which they
+	 * are kept in a file in the temporary dir; 0 for no limit
+	 */
+	size_t max_memory;
 };
 
 struct site_config {
@@ -21,6 +121,13 @@ struct site_config {
 	char               *base_url;
 	struct image_config images;
 	struct image_config thumbnails;
+	struct cache_config cache;
+	struct index_config  index;
+	struct albums_config albums;
+	struct compress_config compress;
+	struct output_config   output;
+	struct zoom_config     zoom;
+	struct decode_config   decode;
 };
 
 struct album_config {
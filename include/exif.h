@@ -0,0 +1,56 @@
+#ifndef REVELA_EXIF_H
+#define REVELA_EXIF_H
+
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Length of a date formatted as "YYYY-MM-DD HH:MM:SS" */
+#define EXIF_DATELEN 19
+
+/*
+ * The EXIF tags of an image that revela cares about, extracted once when the
+ * image is loaded so that the full EXIF tree doesn't need to be kept around.
+ * Strings are empty if the tag wasn't present.
+ */
+struct image_exif {
+	/* Whether the file had any EXIF data at all */
+	bool present;
+	/* When the picture was taken, only valid if datetime isn't empty */
+	char   datetime[EXIF_DATELEN + 1];
+	time_t tstamp;
+	/* Make and model of the camera */
+	char camera[64];
+	char lens[64];
+	/* Exposure time in seconds, e.g. "1/250" */
+	char exposure[16];
+	/* F-number, e.g. "2.8" */
+	char fnumber[12];
+	/* Focal length in millimeters */
+	char focal_length[8];
+	/* Coordinates in decimal degrees */
+	char latitude[16];
+	char longitude[16];
+	/* Dimensions of the picture in pixels; 0 if unknown */
+	uint32_t width;
+	uint32_t height;
+	/* ISO speed; 0 if unknown */
+	uint32_t iso;
+	/* EXIF orientation from 1 to 8; 0 if unknown */
+	uint8_t orientation;
+};
+
+/*
+ * Reads the EXIF data of the file at path into exif. Returns false if the file
+ * has no EXIF data, in which case exif is zeroed.
+ */
+bool exif_read(const char *path, struct image_exif *exif);
+
+/*
+ * Parses an EXIF date, i.e. "YYYY:MM:DD HH:MM:SS", in local time. The date is
+ * written to datestr as "YYYY-MM-DD HH:MM:SS". Returns false if the date isn't
+ * valid.
+ */
+bool exif_parse_datetime(const char *str, time_t *tstamp, char *datestr);
+
+#endif
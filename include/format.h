@@ -0,0 +1,65 @@
+#ifndef REVELA_FORMAT_H
+#define REVELA_FORMAT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Width and height that the pixels of an image are sampled down to */
+#define FORMAT_SAMPLE 512
+/* Images with at most this many colors fit in a palette */
+#define FORMAT_PALETTE_COLORS 256
+
+/*
+ * What the pixels of an image look like, as far as choosing the format of its
+ * outputs goes. Kept in the metadata, so don't reorder.
+ */
+enum image_kind {
+	KIND_UNKNOWN,
+	/* Continuous tones, e.g. a photo */
+	KIND_PHOTO,
+	/* Some pixels are transparent */
+	KIND_ALPHA,
+	/* Flat areas and hard edges, e.g. a screenshot or a diagram */
+	KIND_GRAPHIC,
+	/* A graphic with few enough colors for a palette */
+	KIND_PALETTE,
+};
+
+enum image_format {
+	FORMAT_JPEG,
+	FORMAT_PNG,
+	FORMAT_WEBP,
+};
+
+struct format_stats {
+	/* Distinct colors, only counted up to FORMAT_PALETTE_COLORS + 1 */
+	size_t colors;
+	bool   alpha;
+	/* Fraction of pairs of neighbouring pixels of the very same color */
+	double flat;
+	/* Fraction of pairs of neighbouring pixels with a big jump in lightness */
+	double edges;
+};
+
+/*
+ * Measures the width by height pixels in rgba, 4 bytes each, which should
+ * have been sampled rather than resized so that no colors are blended.
+ */
+void format_analyze(const unsigned char *rgba, size_t width, size_t height,
+                    struct format_stats *);
+
+enum image_kind format_kind(const struct format_stats *);
+
+/*
+ * The format that images of the kind are written in: lossless PNG for
+ * graphics, and JPEG or PNG for the rest unless WebP is allowed.
+ */
+enum image_format format_choose(enum image_kind, bool webp);
+
+/* The extension of the files of the format, with the dot */
+const char *format_ext(enum image_format);
+
+/* The name of the format, as known to GraphicsMagick and to templates */
+const char *format_name(enum image_format);
+
+#endif
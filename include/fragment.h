@@ -0,0 +1,51 @@
+#ifndef REVELA_FRAGMENT_H
+#define REVELA_FRAGMENT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Fragments are runs of a template that don't refer to some var, e.g. the
+ * parts of the image template that don't use "image" and are thus the same for
+ * every image page of an album. Each fragment is made its own template, so that
+ * it can be rendered once, and replaced in the original template by a
+ * reference to its output.
+ *
+ * Only top level text, {{ }} expressions and whole if and for statements are
+ * considered, so each fragment is a valid template by itself. Any other
+ * statement, e.g. block or include, ends a fragment, which is why templates
+ * that extend others are better flattened first; see fragments_flatten().
+ */
+struct fragments {
+	/* The template with each fragment replaced by "{{ <var>.fN }}" */
+	char *tmpl;
+	/* The sources of the fragments and the names of their outputs, "fN" */
+	char **srcs;
+	char **keys;
+	size_t len;
+};
+
+/*
+ * Splits the template src into fragments that don't refer to dep, whose outputs
+ * are to be found in the hashmap var. Returns false if there's no memory left;
+ * a template without fragments is not an error, in which case len is 0.
+ */
+bool fragments_split(struct fragments *, const char *src, const char *dep,
+                     const char *var);
+
+void fragments_free(struct fragments *);
+
+/* The source of the template name, or NULL if there's no such template */
+typedef const char *(*template_lookup_fn)(const char *name, void *data);
+
+/*
+ * Inlines the templates that the one in src extends, with their blocks filled
+ * in by the ones of src, so that the parts of the templates it extends can be
+ * made fragments too, e.g. the head of base.html. Returns a new template
+ * without extends or block statements, or NULL if src doesn't extend another
+ * template or can't be inlined, e.g. if it uses super().
+ */
+char *fragments_flatten(const char *src, template_lookup_fn lookup,
+                        void *data);
+
+#endif
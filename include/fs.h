@@ -75,4 +75,11 @@ ssize_t rmextra(const char *path, struct hmap *preserved, preremove_fn,
 bool filesync(const char *restrict srcpath, const char *restrict dstpath,
               struct hmap *preserved, bool dry);
 
+/*
+ * Makes dst a file with the same contents as src, which shouldn't exist yet.
+ * Uses a reflink if the filesystem supports it, otherwise copies the file.
+ * Returns true on success.
+ */
+bool fileclone(const char *restrict src, const char *restrict dst);
+
 #endif
@@ -0,0 +1,47 @@
+#ifndef REVELA_HASH_H
+#define REVELA_HASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Length of a hash formatted as a hex string, without the null terminator */
+#define HASH_HEXLEN 16
+
+/*
+ * State for incrementally hashing data. This is a fast non-cryptographic
+ * 64-bit hash; it's meant for content fingerprints and cache keys, not for
+ * anything security related.
+ */
+struct hash_state {
+	uint64_t      h;
+	uint64_t      len;
+	unsigned char buf[8];
+	size_t        nbuf;
+};
+
+void hash_init(struct hash_state *, uint64_t seed);
+
+void hash_update(struct hash_state *, const void *data, size_t len);
+
+uint64_t hash_final(struct hash_state *);
+
+/*
+ * Hashes len bytes of data in one go. Gives the same result as calling
+ * hash_init(), hash_update() and hash_final() on the same data.
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
+/*
+ * Hashes the whole contents of the file at path. Returns false if the file
+ * couldn't be read.
+ */
+bool hash_file(const char *path, uint64_t *hash);
+
+/*
+ * Formats hash as a lowercase hex string into buf, which should be at least
+ * HASH_HEXLEN + 1 bytes long.
+ */
+void hash_hex(uint64_t hash, char *buf);
+
+#endif
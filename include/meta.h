@@ -0,0 +1,113 @@
+#ifndef REVELA_META_H
+#define REVELA_META_H
+
+#include "exif.h"
+#include "placeholder.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/*
+ * File in the root of the output dir with the metadata of every source image
+ * as extracted by the previous build, so that unchanged sources don't need to
+ * be opened at all when loading the site.
+ */
+#define META_FILE ".revela-meta"
+
+/* What is known of the thumbnail of a source once it was made */
+struct meta_thumb {
+	/* Empty if the thumbnail wasn't made yet */
+	char     placeholder[PLACEHOLDER_SIZE];
+	uint32_t width;
+	uint32_t height;
+};
+
+/*
+ * How the derivatives of a source were encoded when that had to be worked out
+ * from its pixels, and what the pixels look like. The qualities are only valid
+ * for the settings they were worked out with.
+ */
+struct meta_encoding {
+	/* Hash of the settings; see image_encoding_key() */
+	uint64_t key;
+	/* Perceptual hash of the pixels, see phash.h; only set if phashed is */
+	uint64_t phash;
+	/* Quality chosen for the image and the thumbnail; 0 if not chosen yet */
+	uint8_t image_quality;
+	uint8_t thumb_quality;
+	/* An enum image_kind, see format.h; KIND_UNKNOWN if not analyzed yet */
+	uint8_t kind;
+	uint8_t phashed;
+};
+
+/* The metadata of a single source image, as stored in META_FILE */
+struct meta_record {
+	/* Hash of the path of the source relative to the root dir */
+	uint64_t key;
+	/* Size and modification time of the source when it was read */
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	struct image_exif exif;
+	struct meta_thumb thumb;
+	struct meta_encoding encoding;
+};
+
+/*
+ * The records of the previous build, mapped read-only and sorted by key, and
+ * the records of the current build, which will replace them.
+ */
+struct meta {
+	const struct meta_record *old;
+	size_t                    nold;
+	void                     *map;
+	size_t                    maplen;
+	struct meta_record       *records;
+	size_t                    len;
+	size_t                    cap;
+	/* Number of sources whose metadata was taken from the old records */
+	size_t hits;
+	/* Whether any record was changed after it was added */
+	bool changed;
+};
+
+/*
+ * Maps the records at path. A missing, outdated or corrupt file is not an
+ * error; all lookups will just miss.
+ */
+void meta_open(struct meta *, const char *path);
+
+/*
+ * Looks up the metadata of the source at relpath, i.e. its exif tags and what
+ * is known of its thumbnail and its encoding. It's only found if the size and
+ * the modification time of the source didn't change.
+ */
+bool meta_lookup(struct meta *, const char *relpath, const struct stat *,
+                 struct image_exif *, struct meta_thumb *,
+                 struct meta_encoding *);
+
+/*
+ * Adds the metadata of the source at relpath to the records of the current
+ * build. Returns the index of the record, or SIZE_MAX if it couldn't be added.
+ */
+size_t meta_add(struct meta *, const char *relpath, const struct stat *,
+                const struct image_exif *, const struct meta_thumb *,
+                const struct meta_encoding *);
+
+/* Sets the thumbnail of the record at index, as returned by meta_add() */
+void meta_set_thumb(struct meta *, size_t index, const struct meta_thumb *);
+
+/* Sets the encoding of the record at index, as returned by meta_add() */
+void meta_set_encoding(struct meta *, size_t index,
+                       const struct meta_encoding *);
+
+/*
+ * Writes the records of the current build to path, if they differ from the
+ * old ones.
+ */
+bool meta_write(struct meta *, const char *path);
+
+void meta_close(struct meta *);
+
+#endif
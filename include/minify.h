@@ -0,0 +1,22 @@
+#ifndef REVELA_MINIFY_H
+#define REVELA_MINIFY_H
+
+#include <stddef.h>
+
+/* Number of pages minified, and their total size before and after */
+struct minify_stats {
+	size_t pages;
+	size_t in;
+	size_t out;
+};
+
+/*
+ * Minifies the html of len bytes in buf in place, in a single pass, and
+ * returns its new length. Runs of whitespace become a single space, or a single
+ * newline if they had any, and comments are removed, except for conditional
+ * ones. The contents of pre, textarea, script and style elements and the
+ * values of attributes are left as they are.
+ */
+size_t minify_html(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef REVELA_PAGES_H
+#define REVELA_PAGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Paginated listings, i.e. album and index pages. The first page of a listing
+ * is dir/index.html and the rest are dir/page/N/index.html.
+ */
+#define PAGES_DIR "page"
+
+/*
+ * File in the dir of each listing with the hashes of the contents of its pages
+ * as of the last build, so that only the pages that changed are rendered.
+ */
+#define PAGES_FILE ".revela-pages"
+#define PAGES_FILE_VERSION 1
+
+/* Number of pages needed for n items; there's always at least one page */
+size_t pages_count(size_t n, size_t per_page);
+
+/* The items in page number page, starting from 1, are those in [start, end) */
+void pages_range(size_t n, size_t per_page, size_t page, size_t *start,
+                 size_t *end);
+
+/* Path of the html file of page number page */
+void pages_path(char *buf, const char *dir, size_t page);
+
+/* URL of page number page of the listing at base */
+void pages_url(char *buf, size_t size, const char *base, size_t page);
+
+/* Makes the dir for page number page, which must be after the first one */
+bool pages_mkdir(const char *dir, size_t page, bool dry);
+
+/*
+ * Reads the hashes of the pages in dir. A missing or outdated file is not an
+ * error; there are just no hashes, and *hashes is NULL.
+ */
+void pages_hashes_read(const char *dir, uint64_t **hashes, size_t *n);
+
+bool pages_hashes_write(const char *dir, const uint64_t *hashes, size_t n);
+
+/*
+ * Removes the pages after count from dir, and the page dir itself if there's
+ * only one page and it's empty.
+ */
+void pages_prune(const char *dir, size_t count, bool dry);
+
+#endif
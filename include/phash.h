@@ -0,0 +1,31 @@
+#ifndef REVELA_PHASH_H
+#define REVELA_PHASH_H
+
+#include <stdint.h>
+
+/* Width and height of the grayscale pixels that a hash is made out of */
+#define PHASH_SIZE 32
+/* Pictures whose hashes are at most this many bits apart look alike */
+#define PHASH_NEAR 10
+/*
+ * Number of bands of bits that hashes are split into: two hashes that are at
+ * most PHASH_NEAR bits apart have at least one of them in common.
+ */
+#define PHASH_BANDS (PHASH_NEAR + 1)
+
+/*
+ * Makes the perceptual hash of the PHASH_SIZE by PHASH_SIZE grayscale pixels
+ * in gray, one byte each, which should be a downscaled picture: each bit tells
+ * whether one of the 64 lowest frequencies of its DCT, leaving out the very
+ * lowest ones, is above their median. Pictures that look alike, e.g. the same
+ * one saved again or resized, get hashes that are only a few bits apart.
+ */
+uint64_t phash(const unsigned char *gray);
+
+/* The number of bits that differ between the hashes a and b */
+unsigned phash_distance(uint64_t a, uint64_t b);
+
+/* The bits of hash in the band, from 0 to PHASH_BANDS - 1 */
+uint64_t phash_band(uint64_t hash, unsigned band);
+
+#endif
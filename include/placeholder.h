@@ -0,0 +1,20 @@
+#ifndef REVELA_PLACEHOLDER_H
+#define REVELA_PLACEHOLDER_H
+
+#include <stddef.h>
+
+/*
+ * Size of a placeholder, i.e. a css color like "#1a2b3c" with its null
+ * terminator, that pages can show in place of a thumbnail until it loads. An
+ * empty string means the placeholder isn't known.
+ */
+#define PLACEHOLDER_SIZE 8
+
+/*
+ * Formats the average color of the npixels pixels in rgb, 3 bytes each, into
+ * placeholder. Leaves it empty if there are no pixels.
+ */
+void placeholder_color(const unsigned char *rgb, size_t npixels,
+                       char *placeholder);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef REVELA_PLAN_H
+#define REVELA_PLAN_H
+
+#include "components.h"
+
+#include "object.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+/*
+ * A plan is an image page compiled down to runs of static text with the image
+ * vars in between, obtained by rendering the template once with sentinel
+ * values and looking for them in the output. Since the album vars and which of
+ * the image vars are set are the same for every page of the same shape in an
+ * album, those pages can then be produced with a few memcpy()s instead of
+ * interpreting the template. This only holds as long as the template doesn't
+ * depend on the values of the image vars, only on whether they are set, so
+ * templates that use the values in statements aren't compiled at all, each
+ * plan is compiled from two different sets of sentinels that must give the
+ * same plan, and plans are verified against the interpreter before they are
+ * used.
+ */
+
+/* The image vars that a plan can fill in */
+enum plan_slot {
+	PLAN_SOURCE,
+	PLAN_DATE,
+	PLAN_PREV,
+	PLAN_NEXT,
+	PLAN_ZOOM,
+	PLAN_FORMAT,
+	PLAN_EXIF_DATE,
+	PLAN_EXIF_CAMERA,
+	PLAN_EXIF_LENS,
+	PLAN_EXIF_EXPOSURE,
+	PLAN_EXIF_FNUMBER,
+	PLAN_EXIF_FOCAL_LENGTH,
+	PLAN_EXIF_LATITUDE,
+	PLAN_EXIF_LONGITUDE,
+	/* Integer vars; they are still filled in as text */
+	PLAN_EXIF_ISO,
+	PLAN_EXIF_ORIENTATION,
+	PLAN_NSLOTS,
+};
+
+#define PLAN_FIRST_INT PLAN_EXIF_ISO
+
+/* The values of the image vars of a page */
+struct plan_values {
+	/* Bitmask of the slots that are set, plus whether there's exif at all */
+	uint32_t shape;
+	const char *str[PLAN_NSLOTS];
+	int64_t     num[PLAN_NSLOTS];
+	/* Text of the integer vars */
+	char numstr[PLAN_NSLOTS][24];
+};
+
+struct plan;
+
+void plan_values_init(struct plan_values *, const struct image *);
+
+/*
+ * Same shape as the given values but with sentinels instead of the actual
+ * values. set picks one of two sets of sentinels, 0 or 1, which compare
+ * differently; see plan_equal().
+ */
+void plan_values_sentinels(struct plan_values *sentinels,
+                           const struct plan_values *, int set);
+
+/* The "image" hashmap for the template with the values */
+struct roscha_object *plan_values_map(const struct plan_values *);
+
+/*
+ * Whether the values can be put in a page as they are, i.e. none of them
+ * would need to be escaped.
+ */
+bool plan_values_safe(const struct plan_values *);
+
+/*
+ * Compiles the output of a template rendered with the sentinels, which must be
+ * null terminated. Returns NULL if there's no memory left.
+ */
+struct plan *plan_compile(const char *output, size_t len,
+                          const struct plan_values *sentinels);
+
+uint32_t plan_shape(const struct plan *);
+
+/*
+ * Whether two plans have the same static text and slots. Plans compiled from
+ * the two sets of sentinels differ if the template tested or transformed the
+ * values instead of just outputting them.
+ */
+bool plan_equal(const struct plan *, const struct plan *);
+
+/*
+ * Whether the template src only outputs the image vars as they are, and only
+ * checks whether they are set in if and elif statements, i.e. whether the
+ * pages made from it can be compiled.
+ */
+bool plan_template_safe(const char *src);
+
+/*
+ * Fills in the plan with the values into buf, which is grown as needed.
+ * Returns the length of the page, or 0 if there's no memory left.
+ */
+size_t plan_render(const struct plan *, const struct plan_values *, char **buf,
+                   size_t *cap);
+
+/*
+ * Points iov at the pieces of the page that results from filling in the plan
+ * with the values, so that it can be written with writev() without copying it.
+ * Returns the number of pieces; if it's more than cap only the first cap are
+ * set.
+ */
+size_t plan_iov(const struct plan *, const struct plan_values *,
+                struct iovec *iov, size_t cap);
+
+void plan_free(struct plan *);
+
+#endif
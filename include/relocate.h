@@ -0,0 +1,91 @@
+#ifndef REVELA_RELOCATE_H
+#define REVELA_RELOCATE_H
+
+#include "hash.h"
+#include "site.h"
+#include "components.h"
+
+#include <time.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * File in each album's output dir listing the fingerprints of the sources of
+ * the images that were generated there. Used to recognize sources that were
+ * moved or renamed between builds.
+ */
+#define MANIFEST_FILE ".revela-files"
+
+struct manifest;
+
+/* A single image as recorded in an album manifest */
+struct manifest_entry {
+	/* The manifest that this entry belongs to */
+	struct manifest *manifest;
+	/* The basename of the source image */
+	char *basename;
+	/* Size, modification time and content hash of the source */
+	off_t           size;
+	struct timespec modtime;
+	uint64_t        hash;
+	/* Whether the outputs of this entry were already moved somewhere else */
+	bool moved;
+	/* Key used to look up this entry by fingerprint */
+	char key[HASH_HEXLEN + 24];
+};
+
+/* The images of an album's output dir as recorded by the previous build */
+struct manifest {
+	/* The album dir the manifest was read from */
+	char *slug;
+	/* Entries with the basename of the source as the key */
+	struct hmap *entries;
+	/* The same entries, in the order they were read */
+	struct vector *list;
+	/* Whether the dir doesn't belong to any of the current albums */
+	bool orphan;
+	/* Whether the manifest is owned by the site instead of an album */
+	bool shared;
+};
+
+struct manifest *manifest_read(const char *slug);
+
+/*
+ * Writes the manifest of the album to its output dir, computing the
+ * fingerprints of images that weren't recorded in the old manifest. Nothing is
+ * written if the old manifest is still accurate.
+ */
+bool manifest_write(struct album *, bool dry);
+
+void manifest_destroy(struct manifest *);
+
+/*
+ * Sets the content hash of the image, reusing the one from the manifest if the
+ * size and modtime of the source didn't change.
+ */
+bool image_fingerprint(struct image *, const struct manifest *);
+
+/*
+ * Loads the manifests left in the output dir and moves the outputs of images
+ * whose sources were moved or renamed to their new destinations, so that they
+ * don't need to be converted again. Albums that were moved as a whole are
+ * renamed in one go and marked for re-rendering. Should be called from within
+ * the output dir.
+ */
+bool relocate(struct site *);
+
+/*
+ * Same as relocate() but for streaming builds, where the images of an album
+ * are only loaded right before building it. relocate_init() loads the
+ * manifests of the dirs that don't belong to any album, and relocate_album()
+ * moves outputs into a single album, taking them either from its own dir or
+ * from those orphaned dirs. relocate_album_done() releases the album's
+ * manifest once the album is built.
+ */
+bool relocate_init(struct site *);
+
+bool relocate_album(struct site *, struct album *);
+
+void relocate_album_done(struct album *);
+
+#endif
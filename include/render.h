@@ -1,13 +1,39 @@
 #ifndef REVELA_RENDER_H
 #define REVELA_RENDER_H
 
+#include "assets.h"
 #include "config.h"
+#include "fragment.h"
+#include "minify.h"
 #include "components.h"
 
 #include "roscha.h"
 
+#include <pthread.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 
+/*
+ * File in the output dir with the hash of the contents of the templates that
+ * were last parsed successfully, so that they don't need to be parsed again if
+ * there's nothing to render with them.
+ */
+#define TEMPLATES_STAMP ".revela-templates"
+#define TEMPLATES_STAMP_VERSION 1
+
+/*
+ * A template as read from the templates dir. roscha environments can't share
+ * their parsed templates, so each worker parses the ones it renders with out of
+ * these; see worker_template().
+ */
+struct template_src {
+	char *name;
+	char *src;
+};
+
+/* Dir of the index of each year, i.e. years/<year>/ */
+#define YEARS_DIR "years"
+
 /* Variables that are common to all templates */
 struct base_template {
 	/* Title of the gallery */
@@ -57,35 +83,180 @@ struct image_template {
 	struct roscha_object *next;
 };
 
-struct render {
-	/* Roscha environment */
+struct render;
+
+/*
+ * Renders pages with its own roscha environment, i.e. its own templates and
+ * vars, so that pages can be rendered in parallel without sharing any roscha
+ * objects between threads.
+ */
+/* Kinds of pages, to report what minifying saved on each */
+enum page_kind {
+	PAGE_INDEX,
+	PAGE_ALBUM,
+	PAGE_IMAGE,
+	PAGE_KINDS,
+};
+
+struct render_worker {
+	struct render *r;
+	/* Roscha environment; NULL until the worker renders its first page */
 	struct roscha_env *env;
+	/* Which of the templates were parsed into env */
+	bool *loaded;
+	/* The album whose vars are currently set; see album_materialize() */
+	struct album         *album;
+	struct roscha_object *album_map;
+	/* Whether the image template with fragments is used */
+	bool fragments;
+	/* Outputs of the fragments for the current album; see fragment.h */
+	sds *fragouts;
+	/* Whether the image template with fragments was checked for the album */
+	bool fragments_checked;
+	/* Compiled image pages of the current album; see plan.h */
+	struct vector *plans;
+	/* Buffer for checking plans against the interpreter */
+	char  *buf;
+	size_t bufcap;
+	/* Pieces of the page being written from a plan; see plan_iov() */
+	struct iovec *iov;
+	size_t        iovlen;
+	size_t        iovcap;
+	/* Number of image pages rendered from plans or by the interpreter and
+	 * the seconds spent on each */
+	size_t    nplanned, ninterpreted;
+	double    tplanned, tinterpreted;
+	/* Index pages are only counted by the first worker */
+	struct minify_stats minified[PAGE_KINDS];
+	pthread_t           thread;
+};
+
+/*
+ * The hashes of the pages of an album, which are only written once its pages
+ * were rendered; see PAGES_FILE. Pages that fail to render get a hash of 0 so
+ * that they are rendered again by the next build.
+ */
+struct listing {
+	char     *dir;
+	uint64_t *hashes;
+	size_t    count;
+	/* Whether the hashes are different from the ones in the file */
+	bool changed;
+};
+
+/* A page waiting to be rendered by a worker */
+struct render_job {
+	/* Path of the html file; owned by the job */
+	char         *path;
+	struct album *album;
+	/* The image of the page; NULL for album pages */
+	const struct image *image;
+	/* Number of the album page, starting from 1, and its album's pages */
+	size_t          page;
+	struct listing *listing;
+};
+
+/* Queue of pages that the workers take jobs from */
+struct render_queue {
+	pthread_mutex_t    lock;
+	/* Signaled when a job is added or the workers should stop */
+	pthread_cond_t     ready;
+	/* Signaled when a job is done */
+	pthread_cond_t     done;
+	struct render_job *jobs;
+	size_t             cap;
+	size_t             head;
+	size_t             len;
+	/* Number of jobs being rendered right now */
+	size_t busy;
+	bool   stop;
+	/* Whether any of the jobs failed */
+	bool failed;
+};
+
+struct render {
+	/*
+	 * Number of workers; with only one, pages are rendered right away in
+	 * the calling thread. The first worker's environment is also used for
+	 * the index.
+	 */
+	size_t                nworkers;
+	struct render_worker *workers;
+	struct render_queue   queue;
+	/* Listings whose hashes are written by render_wait() */
+	struct vector *listings;
 	struct base_template base;
 	struct index_template index;
-	/* Modification time for the templates dir */
+	/*
+	 * Modification time for the templates dir, or for the newest static file
+	 * if it is newer and the static files have hashed names
+	 */
 	struct timespec modtime;
-	/* Refcounted vector of years with album hmaps */
-	struct roscha_object *years;
-	/* Refcounted vector album hmaps */
-	struct roscha_object *albums;
-	/* Count of the albums that were updated */
-	size_t albums_updated;
+	/* The static files, for the asset var */
+	struct assets assets;
+	/* The templates dir and the templates in it, which the workers parse
+	 * lazily */
+	char                *tmplpath;
+	struct template_src *templates;
+	size_t               ntemplates;
+	struct site_config  *conf;
+	/* Fragments of the image template that don't depend on the image */
+	struct fragments fragments;
+	/* Number of thumbs of each album in the index */
+	size_t npreviews;
 	/* Whether we should simulate rendering or actually render templates */
 	bool dry_run;
+	/* Whether image pages should be rendered from compiled plans */
+	bool compile;
+	/* Whether pages are minified before being written; see minify.h */
+	bool minify;
 };
 
-bool render_make_index(struct render *, const char *path);
+/*
+ * Renders the pages of the index in dir out of the albums, which must be
+ * already sorted, and the index of each year if enabled. Albums whose images
+ * were released are shown with their previews only. Only the pages whose
+ * contents changed are rendered; see PAGES_FILE.
+ */
+bool render_make_index(struct render *, const char *dir,
+                       const struct vector *albums);
+
+/*
+ * 1 if the page at path, and its compressed siblings if any, were rendered with
+ * the current templates, 0 if not and -1 on error.
+ */
+int render_is_uptodate(const struct render *r, const char *path);
 
-bool render_make_album(struct render *r, const char *path,
-                       const struct album *album);
+/*
+ * The album and image pages are handed to the workers and might not be
+ * rendered yet when these return; see render_wait(). The album pages are
+ * rendered in the album's dir, and only if their contents changed.
+ */
+bool render_make_album(struct render *r, const char *dir,
+                       struct album *album);
 
 bool render_make_image(struct render *r, const char *path,
                        const struct image *image);
 
-bool render_set_album_vars(struct render *, struct album *);
+/*
+ * Waits until all of the pages handed to the workers are rendered, and then
+ * writes the hashes of the album pages. Returns false if any of them couldn't
+ * be rendered.
+ */
+bool render_wait(struct render *);
+
+/*
+ * Drops the album vars of all of the workers, so that the album can be
+ * released. Only to be called after render_wait().
+ */
+void render_unset_album_vars(struct render *);
 
-bool render_init(struct render *, const char *path, struct site_config *,
-                 struct vector *albums);
+/*
+ * Sets up the workers. The templates are only parsed right away if they
+ * changed since the last build in outdir; see TEMPLATES_STAMP.
+ */
+bool render_init(struct render *, const char *root, const char *outdir,
+                 struct site_config *);
 
 void render_deinit(struct render *);
 
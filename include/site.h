@@ -1,6 +1,9 @@
 #ifndef REVELA_SITE_H
 #define REVELA_SITE_H
 
+#include "arena.h"
+#include "meta.h"
+#include "cache.h"
 #include "config.h"
 #include "render.h"
 #include "components.h"
@@ -16,8 +19,26 @@
 #define TEMPLATESDIR "templates"
 #define DEFAULTALBUM "unorganized"
 
+/* What choosing the quality of lossy images with ssim saved */
+struct quality_stats {
+	/* Number of images whose quality was searched */
+	size_t images;
+	/* Bytes saved over encoding them at the quality of their settings */
+	size_t saved;
+};
+
+/* A picture and the perceptual hash of its pixels, see site.duplicates */
+struct site_phash {
+	uint64_t    phash;
+	const char *path;
+};
+
 struct site {
 	struct site_config *config;
+	/* Memory for the paths and metadata of all albums and images */
+	struct arena arena;
+	/* Memory for the images of the album being built in streaming builds */
+	struct arena scratch;
 	MagickWand *wand;
 	char *root_dir;
 	char *output_dir;
@@ -32,9 +53,38 @@ struct site {
 	struct vector *albums;
 	/* Files/dirs that belong to albums and which shouldn't be deleted */
 	struct hmap *album_dirs;
+	/* Manifests left in the output dir by the previous build */
+	struct vector *manifests;
+	/* Images of orphaned dirs by fingerprint; only used in streaming builds */
+	struct hmap *orphans;
 	struct render render;
+	/* Shared cache of optimized images */
+	struct cache cache;
+	/* Metadata of the sources as read by this build and the previous one */
+	struct meta meta;
 	bool dry_run;
+	/*
+	 * Load the images of each album right before building it and release
+	 * them right after, so that memory doesn't grow with the size of the site
+	 */
+	bool streaming;
+	/* Number of threads that render pages; 0 for one per CPU */
+	size_t jobs;
+	/* Render image pages from compiled plans where possible */
+	bool compile;
 	size_t albums_updated;
+	struct quality_stats quality;
+	/*
+	 * Outputs of the pictures built so far by the contents of their sources,
+	 * for copies of the same sources to reuse them; see twin_fetch()
+	 */
+	struct hmap *twins;
+	/*
+	 * Where to write the report of pictures that look alike, and their
+	 * hashes; NULL for no report. See phash.h
+	 */
+	char          *duplicates;
+	struct vector *phashes;
 };
 
 bool site_build(struct site *);
@@ -0,0 +1,33 @@
+#ifndef REVELA_SPRITE_H
+#define REVELA_SPRITE_H
+
+#include <stddef.h>
+
+/*
+ * Name of the atlases of thumbnails in the album dir, with the tag of their
+ * contents before the extension, e.g. sprite.rv-1a2b3c4d.jpg; see
+ * albums_config.
+ */
+#define SPRITE_NAME "sprite"
+#define SPRITE_EXT  ".jpg"
+
+/* A thumbnail in an atlas */
+struct sprite_cell {
+	/* The size of the thumbnail */
+	unsigned long w;
+	unsigned long h;
+	/* Where it goes in the atlas, as set by sprite_layout() */
+	unsigned long x;
+	unsigned long y;
+};
+
+/*
+ * Lays out the n thumbnails in cells in rows, left to right and top to bottom,
+ * each row as tall as its tallest thumbnail. Rows are as wide as the square
+ * root of n thumbnails of the widest one, so that the atlas is roughly square,
+ * which w and h are set to the size of.
+ */
+void sprite_layout(struct sprite_cell *cells, size_t n, unsigned long *w,
+                   unsigned long *h);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef REVELA_SSIM_H
+#define REVELA_SSIM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Width and height of the windows that the similarity is measured over */
+#define SSIM_WINDOW 8
+
+/*
+ * Measures the structural similarity of the width by height grayscale pixels
+ * in a and b, one byte each, as the mean SSIM of their 8x8 windows: 1 if they
+ * are the same, less the more b looks different from a. Pixels at the right
+ * and bottom edges that don't fill a window are left out, unless the image is
+ * smaller than a window. Returns false if there are no pixels or memory
+ * couldn't be allocated.
+ */
+bool ssim(const unsigned char *a, const unsigned char *b, size_t width,
+          size_t height, double *score);
+
+#endif
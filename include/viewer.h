@@ -0,0 +1,29 @@
+#ifndef REVELA_VIEWER_H
+#define REVELA_VIEWER_H
+
+#include "config.h"
+#include "components.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * File in the dir of each album with the list of its images as JSON, for the
+ * viewer in the album page to use instead of a page for each image. See
+ * albums_config.
+ */
+#define VIEWER_FILE "images.json"
+
+/*
+ * Makes the JSON list of the images of the album into a newly allocated
+ * buffer, with the dimensions the images will have once optimized according to
+ * conf. Returns NULL if there's no memory left.
+ */
+char *viewer_json(const struct album *, const struct image_config *conf,
+                  size_t *len);
+
+/* Writes VIEWER_FILE in the dir of the album if its contents changed */
+bool viewer_write(const struct album *, const struct image_config *conf,
+                  bool dry);
+
+#endif
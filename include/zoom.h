@@ -0,0 +1,77 @@
+#ifndef REVELA_ZOOM_H
+#define REVELA_ZOOM_H
+
+#include "config.h"
+
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <wand/magick_wand.h>
+
+/*
+ * The tile pyramid of a big picture, in the Deep Zoom format: name.dzi
+ * describes it, and name_files/LEVEL/COL_ROW.jpg are the tiles, where level 0
+ * is a single pixel and every level doubles the size of the previous one, up to
+ * the full size of the picture. See zoom_config.
+ */
+#define ZOOM_EXT   ".dzi"
+#define ZOOM_TILES "_files"
+#define ZOOM_FORMAT "jpg"
+
+/* A level of the pyramid */
+struct zoom_level {
+	/* Its size in pixels */
+	unsigned long w;
+	unsigned long h;
+	/* Number of columns and rows of tiles */
+	unsigned long cols;
+	unsigned long rows;
+};
+
+/* Whether a picture of w by h pixels gets a pyramid according to conf */
+bool zoom_wanted(const struct zoom_config *conf, uint32_t w, uint32_t h);
+
+/* Number of levels of the pyramid of a picture of w by h pixels */
+size_t zoom_levels(unsigned long w, unsigned long h);
+
+/* Sets the size of level n of the pyramid and its number of tiles */
+void zoom_level(const struct zoom_config *, unsigned long w, unsigned long h,
+                size_t n, struct zoom_level *);
+
+/*
+ * Sets the area of the level covered by the tile at col and row, which overlaps
+ * with those next to it by conf->overlap pixels on each side.
+ */
+void zoom_tile(const struct zoom_config *, const struct zoom_level *,
+               unsigned long col, unsigned long row, unsigned long *x,
+               unsigned long *y, unsigned long *w, unsigned long *h);
+
+/*
+ * Formats the descriptor of the pyramid of a picture of w by h pixels into
+ * buf. Returns false if buf isn't big enough.
+ */
+bool zoom_descriptor(const struct zoom_config *, unsigned long w,
+                     unsigned long h, char *buf, size_t size);
+
+/*
+ * Makes the pyramid of the picture in wand, which is left as it is, with its
+ * descriptor at path and its tiles in the dir tiles, using up to nthreads
+ * threads. Each level is made by halving the one above it, and its tiles are
+ * cut out of it a strip of a row of tiles at a time. Tiles with the modtime of
+ * the source, mtim, are kept unless the descriptor changed; the descriptor only
+ * gets it once every tile was made.
+ */
+bool zoom_make(MagickWand *wand, const struct zoom_config *, const char *path,
+               const char *tiles, const struct timespec *mtim,
+               size_t nthreads, bool dry);
+
+/*
+ * Whether the pyramid with its descriptor at path was completely made out of a
+ * source with modtime mtim with the settings in conf. Returns 1 if so, 0 if
+ * not, and -1 on errors.
+ */
+int zoom_uptodate(const struct zoom_config *, const char *path,
+                  const struct timespec *mtim);
+
+#endif
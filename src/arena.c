@@ -0,0 +1,134 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#define ALIGNMENT alignof(max_align_t)
+
+#define ALIGN_UP(n) (((n) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+struct arena_block {
+	struct arena_block *prev;
+	size_t              size;
+	size_t              used;
+	alignas(max_align_t) unsigned char data[];
+};
+
+static struct arena_block *
+block_new(struct arena *arena, size_t size)
+{
+	struct arena_block *block = malloc(sizeof *block + size);
+	if (block == NULL) return NULL;
+	block->size = size;
+	block->used = 0;
+	arena->nblocks++;
+	arena->reserved += size;
+	return block;
+}
+
+void
+arena_init(struct arena *arena, size_t block_size)
+{
+	memset(arena, 0, sizeof *arena);
+	arena->block_size = block_size;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_block *block = arena->head;
+	size                      = ALIGN_UP(size);
+
+	if (block == NULL || block->size - block->used < size) {
+		/*
+		 * Big allocations get a block of their own, which is put behind the
+		 * current one so that the free space left in it isn't wasted.
+		 */
+		if (size > arena->block_size / 4 && block != NULL) {
+			struct arena_block *big = block_new(arena, size);
+			if (big == NULL) return NULL;
+			big->used   = size;
+			big->prev   = block->prev;
+			block->prev = big;
+			arena->nallocs++;
+			arena->used += size;
+			return big->data;
+		}
+		size_t bsize = size > arena->block_size ? size : arena->block_size;
+		block        = block_new(arena, bsize);
+		if (block == NULL) return NULL;
+		block->prev = arena->head;
+		arena->head = block;
+	}
+
+	void *ptr = block->data + block->used;
+	block->used += size;
+	arena->nallocs++;
+	arena->used += size;
+	return ptr;
+}
+
+void *
+arena_calloc(struct arena *arena, size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > SIZE_MAX / size) return NULL;
+	void *ptr = arena_alloc(arena, nmemb * size);
+	if (ptr != NULL) memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+char *
+arena_strdup(struct arena *arena, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char  *dup = arena_alloc(arena, len);
+	if (dup != NULL) memcpy(dup, s, len);
+	return dup;
+}
+
+char *
+arena_joinpath(struct arena *arena, const char *restrict a,
+               const char *restrict b)
+{
+	size_t alen = strlen(a), blen = strlen(b);
+	char  *fpath = arena_alloc(arena, alen + blen + 2);
+	if (fpath == NULL) return NULL;
+	memcpy(fpath, a, alen);
+	fpath[alen] = '/';
+	memcpy(fpath + alen + 1, b, blen + 1);
+
+	return fpath;
+}
+
+void
+arena_reset(struct arena *arena)
+{
+	struct arena_block *block = arena->head;
+	if (block == NULL) return;
+
+	struct arena_block *prev = block->prev;
+	while (prev != NULL) {
+		struct arena_block *next = prev->prev;
+		arena->nblocks--;
+		arena->reserved -= prev->size;
+		free(prev);
+		prev = next;
+	}
+	block->prev = NULL;
+	block->used = 0;
+	arena->used = 0;
+}
+
+void
+arena_free(struct arena *arena)
+{
+	struct arena_block *block = arena->head;
+	while (block != NULL) {
+		struct arena_block *prev = block->prev;
+		free(block);
+		block = prev;
+	}
+	arena_init(arena, arena->block_size);
+}
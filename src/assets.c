@@ -0,0 +1,285 @@
+#include "assets.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+#include "log.h"
+#include "hash.h"
+#include "compress.h"
+
+static const char conf[] =
+	"# Written by revela. The files whose names have a hash of their contents\n"
+	"# never change, so they can be cached for good.\n"
+	"location ~ \"\\." ASSETS_TAG_PREFIX "[0-9a-f]{8}(\\.[^./]+)?$\" {\n"
+	"\tadd_header Cache-Control \"public, max-age=31536000, immutable\";\n"
+	"}\n";
+
+void
+assets_tag(uint64_t hash, char *tag)
+{
+	char hex[HASH_HEXLEN + 1];
+	hash_hex(hash, hex);
+	memcpy(tag, ASSETS_TAG_PREFIX, sizeof ASSETS_TAG_PREFIX - 1);
+	memcpy(tag + sizeof ASSETS_TAG_PREFIX - 1, hex, ASSETS_HASH_LEN);
+	tag[ASSETS_TAG_LEN] = '\0';
+}
+
+bool
+assets_tagged_name(const char *path, const char *tag, char *buf, size_t size)
+{
+	const char *base = rbasename(path);
+	const char *ext  = strrchr(base, '.');
+	int         n;
+	/* A leading dot is part of the name, not an extension */
+	if (ext == NULL || ext == base) ext = base + strlen(base);
+	n = snprintf(buf, size, "%.*s.%s%s", (int)(ext - path), path, tag, ext);
+	return n >= 0 && (size_t)n < size;
+}
+
+static bool
+asset_add(struct assets *a, const char *path, const char *rel,
+          const char *base_url, const struct stat *st)
+{
+	char          name[PATH_MAX], tag[ASSETS_TAG_LEN + 1];
+	struct asset *asset = calloc(1, sizeof *asset);
+	if (asset == NULL) goto nomem;
+
+	if (a->hashed) {
+		uint64_t hash;
+		if (!hash_file(path, &hash)) {
+			log_printl_errno(LOG_ERROR, "Couldn't read %s", path);
+			free(asset);
+			return false;
+		}
+		assets_tag(hash, tag);
+		if (!assets_tagged_name(rel, tag, name, sizeof name)) {
+			log_printl(LOG_ERROR, "Path too long: %s", path);
+			free(asset);
+			return false;
+		}
+	} else {
+		strcpy(name, rel);
+	}
+
+	asset->path = strdup(rel);
+	asset->name = strdup(name);
+	asset->url  = malloc(strlen(base_url) + strlen(name) + 2);
+	if (!asset->path || !asset->name || !asset->url) goto nomem;
+	sprintf(asset->url, "%s/%s", base_url, name);
+
+	vector_push(a->list, asset);
+	hmap_set(a->paths, asset->path, asset);
+	if (st->st_mtim.tv_sec > a->modtime.tv_sec
+	    || (st->st_mtim.tv_sec == a->modtime.tv_sec
+	        && st->st_mtim.tv_nsec > a->modtime.tv_nsec)) {
+		a->modtime = st->st_mtim;
+	}
+	return true;
+
+nomem:
+	log_printl_errno(LOG_FATAL, "Memory allocation error");
+	if (asset != NULL) {
+		free(asset->path);
+		free(asset->name);
+		free(asset);
+	}
+	return false;
+}
+
+static bool
+assets_walk(struct assets *a, const char *dir, const char *rel,
+            const char *base_url)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", dir);
+		return false;
+	}
+
+	struct dirent *ent;
+	bool           ok = true;
+	while (ok && (ent = readdir(d))) {
+		char        path[PATH_MAX], entrel[PATH_MAX];
+		struct stat st;
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+		joinpathb(path, dir, ent->d_name);
+		if (*rel) {
+			joinpathb(entrel, rel, ent->d_name);
+		} else {
+			strcpy(entrel, ent->d_name);
+		}
+		if (stat(path, &st)) continue;
+		if (S_ISDIR(st.st_mode)) {
+			ok = assets_walk(a, path, entrel, base_url);
+		} else if (S_ISREG(st.st_mode)) {
+			ok = asset_add(a, path, entrel, base_url, &st);
+		}
+	}
+
+	closedir(d);
+	return ok;
+}
+
+bool
+assets_load(struct assets *a, const char *dir, const char *base_url,
+            bool hashed)
+{
+	a->list    = vector_new_with_cap(16);
+	a->paths   = hmap_new();
+	a->hashed  = hashed;
+	a->modtime = (struct timespec){0};
+	if (access(dir, F_OK) != 0) return true;
+	return assets_walk(a, dir, "", base_url);
+}
+
+/* Keeps name in preserved, with a copy owned by own */
+static void
+keep(struct hmap *preserved, struct vector *own, const char *name)
+{
+	char *copy = strdup(name);
+	hmap_set(preserved, copy, copy);
+	vector_push(own, copy);
+}
+
+/* Copies the file src to the hashed name of the asset, and compresses it */
+static bool
+asset_copy(const struct asset *asset, const char *src, bool dry)
+{
+	if (!filesync(src, asset->name, NULL, dry)) return false;
+	if (dry || !compress_enabled() || !compress_is_text(asset->name)) {
+		return true;
+	}
+	/* The name changes with the contents, so existing siblings are good */
+	switch (compress_uptodate(asset->name, NULL)) {
+	case 1:
+		return true;
+	case 0:
+		return compress_file(src, asset->name);
+	default:
+		return false;
+	}
+}
+
+static bool
+sync_dir(const struct assets *a, const char *src, const char *rel,
+         struct hmap *preserved, bool dry)
+{
+	DIR *dir = opendir(src);
+	if (dir == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", src);
+		return false;
+	}
+
+	struct vector *own     = vector_new_with_cap(16);
+	bool           ok      = true;
+	bool           ownhmap = preserved == NULL;
+	/* Only the top dir might have entries preserved by the caller */
+	if (ownhmap) preserved = hmap_new();
+
+	struct dirent *ent;
+	while (ok && (ent = readdir(dir))) {
+		char        entsrc[PATH_MAX], entrel[PATH_MAX];
+		struct stat st;
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+		joinpathb(entsrc, src, ent->d_name);
+		if (*rel) {
+			joinpathb(entrel, rel, ent->d_name);
+		} else {
+			strcpy(entrel, ent->d_name);
+		}
+		if (stat(entsrc, &st)) continue;
+		keep(preserved, own, ent->d_name);
+
+		if (S_ISDIR(st.st_mode)) {
+			if (!dry && mkdir(entrel, 0755) && errno != EEXIST) {
+				log_printl_errno(LOG_ERROR, "Couldn't create directory %s",
+				                 entrel);
+				ok = false;
+				continue;
+			}
+			ok = sync_dir(a, entsrc, entrel, NULL, dry);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode)) continue;
+
+		ok = filesync(entsrc, entrel, NULL, dry);
+		const struct asset *asset = hmap_get(a->paths, entrel);
+		if (ok && asset != NULL && strcmp(asset->name, asset->path)) {
+			keep(preserved, own, rbasename(asset->name));
+			ok = asset_copy(asset, entsrc, dry);
+		}
+	}
+	closedir(dir);
+
+	if (ok && rmextra(*rel ? rel : ".", preserved, NULL, NULL, dry) < 0) {
+		ok = false;
+	}
+	for (size_t i = 0; i < own->len; i++) {
+		free(own->values[i]);
+	}
+	vector_free(own);
+	if (ownhmap) hmap_free(preserved);
+	return ok;
+}
+
+bool
+assets_sync(const struct assets *a, const char *src, struct hmap *preserved,
+            bool dry)
+{
+	return sync_dir(a, src, "", preserved, dry);
+}
+
+bool
+assets_conf_write(const char *dir, bool dry)
+{
+	char path[PATH_MAX], buf[sizeof conf];
+	joinpathb(path, dir, ASSETS_CONF);
+
+	FILE *f = fopen(path, "r");
+	if (f != NULL) {
+		size_t n = fread(buf, 1, sizeof buf, f);
+		fclose(f);
+		if (n == sizeof conf - 1 && !memcmp(buf, conf, n)) return true;
+	}
+	log_printl(LOG_DETAIL, "Writing %s", path);
+	if (dry) return true;
+
+	if ((f = fopen(path, "w")) == NULL) goto fail;
+	fputs(conf, f);
+	if (fclose(f)) goto fail;
+	return true;
+
+fail:
+	log_printl_errno(LOG_ERROR, "Can't write %s", path);
+	return false;
+}
+
+void
+assets_free(struct assets *a)
+{
+	size_t        i;
+	struct asset *asset;
+	if (a->list == NULL) return;
+	vector_foreach (a->list, i, asset) {
+		free(asset->path);
+		free(asset->name);
+		free(asset->url);
+		free(asset);
+	}
+	vector_free(a->list);
+	hmap_free(a->paths);
+	a->list  = NULL;
+	a->paths = NULL;
+}
@@ -0,0 +1,253 @@
+#include "cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <wand/magick_wand.h>
+
+#include "fs.h"
+#include "log.h"
+#include "hash.h"
+#include "vector.h"
+
+/* Bump whenever the way revela converts images changes */
+#define CACHE_VERSION 1
+
+struct cache_entry {
+	char           *path;
+	off_t           size;
+	struct timespec used;
+};
+
+static void
+cache_path(const struct cache *cache, uint64_t key, const char *ext,
+           char *buf)
+{
+	char hex[HASH_HEXLEN + 1];
+	hash_hex(key, hex);
+	sprintf(buf, "%s/%.2s/%s%s", cache->dir, hex, hex + 2, ext);
+}
+
+bool
+cache_init(struct cache *cache, const struct cache_config *conf)
+{
+	struct stat   dstat;
+	unsigned long version;
+	const char   *encoder = MagickGetVersion(&version);
+
+	cache->dir      = conf->dir;
+	cache->max_size = conf->max_size * 1024 * 1024;
+	cache->seed     = hash_bytes(encoder, strlen(encoder), CACHE_VERSION);
+	cache->hits     = 0;
+	cache->misses   = 0;
+	cache->stored   = 0;
+	if (cache->dir == NULL) return true;
+
+	return nmkdir(cache->dir, &dstat, false) != NMKDIR_ERROR;
+}
+
+uint64_t
+cache_image_key(const struct cache *cache, const struct image *image,
+                const struct image_config *conf)
+{
+	struct hash_state s;
+	int64_t           size = image->size;
+	hash_init(&s, cache->seed);
+	hash_update(&s, &image->hash, sizeof image->hash);
+	hash_update(&s, &size, sizeof size);
+	return cache_derivative_key(hash_final(&s), conf, image->out_ext);
+}
+
+uint64_t
+cache_derivative_key(uint64_t parent, const struct image_config *conf,
+                     const char *ext)
+{
+	struct hash_state s;
+	uint8_t           flags  = conf->strip | conf->smart_resize << 1;
+	uint64_t          width  = conf->max_width;
+	uint64_t          height = conf->max_height;
+
+	/* Field by field, so that padding doesn't end up in the key */
+	hash_init(&s, parent);
+	hash_update(&s, &flags, sizeof flags);
+	hash_update(&s, &conf->quality, sizeof conf->quality);
+	hash_update(&s, &width, sizeof width);
+	hash_update(&s, &height, sizeof height);
+	hash_update(&s, &conf->blur, sizeof conf->blur);
+	/* Only when set, so that the keys of fixed quality images stay the same */
+	if (conf->ssim > 0) hash_update(&s, &conf->ssim, sizeof conf->ssim);
+	hash_update(&s, ext, strlen(ext));
+	return hash_final(&s);
+}
+
+bool
+cache_fetch(struct cache *cache, uint64_t key, const char *ext,
+            const char *dst, const struct timespec *mtim)
+{
+	char        path[PATH_MAX];
+	struct stat est;
+	cache_path(cache, key, ext, path);
+	if (stat(path, &est)) {
+		cache->misses++;
+		return false;
+	}
+
+	if (unlink(dst) && errno != ENOENT) {
+		log_printl_errno(LOG_ERROR, "Couldn't replace %s", dst);
+		return false;
+	}
+	if (!fileclone(path, dst)) {
+		cache->misses++;
+		return false;
+	}
+	log_printl(LOG_DETAIL, "Using cached %s", dst);
+	setdatetime(dst, mtim);
+
+	/* Entries are evicted based on their ctime, which touching updates */
+	struct timespec tms[] = {
+		{.tv_sec = 0, .tv_nsec = UTIME_NOW},
+		{.tv_sec = 0, .tv_nsec = UTIME_OMIT},
+	};
+	utimensat(AT_FDCWD, path, tms, 0);
+	cache->hits++;
+
+	return true;
+}
+
+void
+cache_store(struct cache *cache, uint64_t key, const char *ext,
+            const char *src)
+{
+	char        path[PATH_MAX], tmp[PATH_MAX + 32];
+	struct stat dstat;
+
+	cache_path(cache, key, ext, path);
+	/* The subdir is the part of the path before the last slash */
+	char *delim = strrchr(path, '/');
+	*delim      = '\0';
+	if (nmkdir(path, &dstat, false) == NMKDIR_ERROR) return;
+	*delim = '/';
+
+	/* Write under a temporary name first so concurrent builds don't see
+	 * half-copied entries */
+	sprintf(tmp, "%s.%ld.tmp", path, (long)getpid());
+	if (!fileclone(src, tmp)) return;
+	if (rename(tmp, path)) {
+		log_printl_errno(LOG_ERROR, "Couldn't add %s to the cache", src);
+		unlink(tmp);
+		return;
+	}
+	cache->stored++;
+}
+
+static int
+entry_cmp(const void *va, const void *vb)
+{
+	const struct cache_entry *a = *(struct cache_entry **)va;
+	const struct cache_entry *b = *(struct cache_entry **)vb;
+	/* Compare in ascending order, least recently used first */
+	if (a->used.tv_sec != b->used.tv_sec) {
+		return (a->used.tv_sec > b->used.tv_sec)
+		     - (a->used.tv_sec < b->used.tv_sec);
+	}
+	return (a->used.tv_nsec > b->used.tv_nsec)
+	     - (a->used.tv_nsec < b->used.tv_nsec);
+}
+
+/*
+ * Adds the entries in the subdir at path. Skips the temporary files of
+ * cache_store, which another build may still be writing.
+ */
+static bool
+entries_collect(const char *path, struct vector *entries, size_t *total)
+{
+	DIR           *dir = opendir(path);
+	struct dirent *ent;
+	if (dir == NULL) return true;
+
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.') continue;
+		char *ext = strrchr(ent->d_name, '.');
+		if (ext != NULL && !strcmp(ext, ".tmp")) continue;
+
+		char        target[PATH_MAX];
+		struct stat st;
+		joinpathb(target, path, ent->d_name);
+		if (stat(target, &st) || !S_ISREG(st.st_mode)) continue;
+
+		struct cache_entry *e = malloc(sizeof *e);
+		if (e == NULL || (e->path = strdup(target)) == NULL) {
+			log_printl_errno(LOG_FATAL, "Memory allocation error");
+			free(e);
+			closedir(dir);
+			return false;
+		}
+		e->size = st.st_size;
+		e->used = st.st_ctim;
+		vector_push(entries, e);
+		*total += st.st_size;
+	}
+
+	closedir(dir);
+	return true;
+}
+
+void
+cache_trim(struct cache *cache)
+{
+	if (cache->dir == NULL) return;
+	log_printl(LOG_DETAIL, "Derivative cache: %zu hits, %zu misses, %zu added",
+	           cache->hits, cache->misses, cache->stored);
+	if (cache->stored == 0) return;
+
+	DIR           *dir = opendir(cache->dir);
+	struct dirent *ent;
+	if (dir == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", cache->dir);
+		return;
+	}
+
+	struct vector *entries = vector_new_with_cap(256);
+	size_t         total   = 0;
+	bool           ok      = true;
+	if (entries == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		closedir(dir);
+		return;
+	}
+	while (ok && (ent = readdir(dir))) {
+		if (ent->d_name[0] == '.') continue;
+		char sub[PATH_MAX];
+		joinpathb(sub, cache->dir, ent->d_name);
+		ok = entries_collect(sub, entries, &total);
+	}
+	closedir(dir);
+
+	size_t              i, evicted = 0;
+	struct cache_entry *e;
+	/* Without all the entries the least recently used ones aren't known */
+	if (ok && total > cache->max_size) {
+		qsort(entries->values, entries->len, sizeof(void *), entry_cmp);
+		vector_foreach (entries, i, e) {
+			if (total <= cache->max_size) break;
+			if (unlink(e->path)) {
+				log_printl_errno(LOG_ERROR, "Couldn't evict %s", e->path);
+				continue;
+			}
+			total -= e->size;
+			evicted++;
+		}
+		log_printl(LOG_DETAIL, "Evicted %zu entries from the cache", evicted);
+	}
+
+	vector_foreach (entries, i, e) {
+		free(e->path);
+		free(e);
+	}
+	vector_free(entries);
+}
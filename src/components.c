@@ -9,7 +9,14 @@
 
 #include "fs.h"
 #include "log.h"
+#include "hash.h"
 #include "site.h"
+#include "cache.h"
+#include "pages.h"
+#include "assets.h"
+#include "zoom.h"
+#include "format.h"
+#include "phash.h"
 
 #define MAXTIME \
 	((unsigned long long)1 << ((sizeof(time_t) * CHAR_BIT) - 1)) - 1
@@ -20,7 +27,8 @@
  * "santiago-de-compostela-spain-2019". Returns pointer to slug inside of url.
  */
 static const char *
-slugify(const char *path, const char *base_url, char **url)
+slugify(struct arena *arena, const char *path, const char *base_url,
+        char **url)
 {
 	size_t baselen = strlen(base_url),
 		   pathlen, totlen;
@@ -28,7 +36,7 @@ slugify(const char *path, const char *base_url, char **url)
 	if (!strcmp(path, CONTENTDIR)) {
 		pathlen = strlen(DEFAULTALBUM);
 		totlen = baselen + pathlen + 2;
-		*url = malloc(totlen);
+		*url = arena_alloc(arena, totlen);
 		strncpy(*url, base_url, baselen);
 		(*url)[baselen] = '/';
 		strncpy(*url + baselen + 1, DEFAULTALBUM, pathlen + 1);
@@ -41,7 +49,7 @@ slugify(const char *path, const char *base_url, char **url)
 	totlen = baselen + pathlen + 2;
 	const char *start = path;
 	const char *end = strchr(start, '/');
-	*url = malloc(totlen);
+	*url = arena_alloc(arena, totlen);
 	strncpy(*url, base_url, baselen);
 	(*url)[baselen] = '/';
 	char *slug = *url + baselen + 1;
@@ -65,76 +73,132 @@ slugify(const char *path, const char *base_url, char **url)
 	return slug;
 }
 
-static void
-image_date_from_stat(struct image *image, const struct stat *pstat,
-                     struct tm *date)
-{
-	image->tstamp = pstat->st_mtim.tv_sec;
-	localtime_r(&image->tstamp, date);
-}
-
 /*
  * If exif data is present and either the tag DateTimeOriginal or
  * CreateDate/DateTimeDigitized is present, then the date and time are taken
  * from either (DateTimeOriginal takes precedence). Otherwise it uses the file's
- * creation time (st_ctim).
+ * modification time (st_mtim).
  */
 static void
 image_set_date(struct image *image, const struct stat *pstat)
 {
-	struct tm date = {0};
+	if (image->exif.datetime[0] != '\0') {
+		image->tstamp = image->exif.tstamp;
+		strcpy(image->datestr, image->exif.datetime);
+		return;
+	}
 
-	if (image->exif_data == NULL) {
-		log_printl(LOG_DEBUG, "No exif data present in %s", image->source);
-		log_printl(LOG_DEBUG, "Using date from stat for file %s", image->source);
-		image_date_from_stat(image, pstat, &date);
-		goto out;
+	struct tm date;
+	log_printl(LOG_DEBUG, "No exif date present in %s", image->source);
+	log_printl(LOG_DEBUG, "Using date from stat for file %s", image->source);
+	image->tstamp = pstat->st_mtim.tv_sec;
+	localtime_r(&image->tstamp, &date);
+	/* TODO: honor user's locale and/or give an option to set the date format */
+	strftime(image->datestr, 24, "%Y-%m-%d %H:%M:%S", &date);
+}
+
+/*
+ * Sets the size of the image out of its header, for the sources whose exif
+ * doesn't have it, which is only needed to know whether it gets a pyramid.
+ */
+static bool
+image_ping(struct image *image)
+{
+	MagickWand *wand = image->album->site->wand;
+	if (MagickPingImage(wand, image->source) != MagickPass) {
+		log_printl(LOG_ERROR, "Couldn't read the size of %s", image->source);
+		return false;
 	}
+	image->exif.width  = MagickGetImageWidth(wand);
+	image->exif.height = MagickGetImageHeight(wand);
+	MagickRemoveImage(wand);
+	return true;
+}
 
-	ExifEntry *entry = exif_content_get_entry(
-		image->exif_data->ifd[EXIF_IFD_EXIF], EXIF_TAG_DATE_TIME_ORIGINAL);
-	if (entry == NULL) {
-		entry = exif_content_get_entry(
-			image->exif_data->ifd[EXIF_IFD_EXIF], EXIF_TAG_DATE_TIME_DIGITIZED);
-		if (entry == NULL) {
-			log_printl(LOG_DEBUG, "No date exif tags present in %s",
-			           image->source);
-			log_printl(LOG_DEBUG, "Using date from stat for file %s",
-			           image->source);
-			image_date_from_stat(image, pstat, &date);
-			goto out;
+/*
+ * Works out what kind of pixels the source has if kind is set, and their
+ * perceptual hash if hash is, out of a sample of them. That only needs to be
+ * done once for each source since both are kept in the metadata. JPEGs are
+ * decoded at a fraction of their size for it; see image_decode_hint().
+ */
+static bool
+image_analyze(struct image *image, bool kind, bool hash)
+{
+	MagickWand         *wand = image->album->site->wand;
+	struct format_stats stats;
+	unsigned char      *rgba = NULL;
+	unsigned char       gray[PHASH_SIZE * PHASH_SIZE];
+
+	MagickSetSize(wand, FORMAT_SAMPLE, FORMAT_SAMPLE);
+	MagickPassFail read = MagickReadImage(wand, image->source);
+	MagickSetSize(wand, 0, 0);
+	if (read != MagickPass) goto fail;
+
+	unsigned long x = MagickGetImageWidth(wand), y = MagickGetImageHeight(wand);
+	unsigned long nx = x, ny = y;
+	if (x > FORMAT_SAMPLE || y > FORMAT_SAMPLE) {
+		double scale = (double)FORMAT_SAMPLE / (x > y ? x : y);
+		nx = x * scale > 1 ? x * scale : 1;
+		ny = y * scale > 1 ? y * scale : 1;
+		/* Sampled, since resizing would blend the colors that are counted */
+		if (MagickSampleImage(wand, nx, ny) != MagickPass) goto fail;
+	}
+	if (kind) {
+		rgba = malloc(nx * ny * 4);
+		if (rgba == NULL) {
+			log_printl_errno(LOG_FATAL, "Memory allocation error");
+			goto fail;
+		}
+		if (MagickGetImagePixels(wand, 0, 0, nx, ny, "RGBA", CharPixel, rgba)
+		    != MagickPass) {
+			goto fail;
 		}
+		format_analyze(rgba, nx, ny, &stats);
+		image->encoding.kind = format_kind(&stats);
 	}
-
-	char buf[32];
-	exif_entry_get_value(entry, buf, 32);
-	if (strptime(buf, "%Y:%m:%d %H:%M:%S", &date) == NULL) {
-		image_date_from_stat(image, pstat, &date);
-		goto out;
+	if (hash) {
+		if (MagickResizeImage(wand, PHASH_SIZE, PHASH_SIZE, BoxFilter, 1)
+		        != MagickPass
+		    || MagickGetImagePixels(wand, 0, 0, PHASH_SIZE, PHASH_SIZE, "I",
+		                            CharPixel, gray)
+		           != MagickPass) {
+			goto fail;
+		}
+		image->encoding.phash   = phash(gray);
+		image->encoding.phashed = true;
 	}
-	image->tstamp = mktime(&date);
-
-out:
-	/* TODO: honor user's locale and/or give an option to set the date format */
-	strftime(image->datestr, 24, "%Y-%m-%d %H:%M:%S", &date);
+	free(rgba);
+	MagickRemoveImage(wand);
+	return true;
+fail:
+	log_printl(LOG_ERROR, "Couldn't analyze %s", image->source);
+	free(rgba);
+	if (read == MagickPass) MagickRemoveImage(wand);
+	return false;
 }
 
-struct image *
-image_old(struct stat *istat)
+/* Adds the hash of the image to those in the report of duplicates */
+static bool
+image_phash_add(const struct image *image, const char *relpath)
 {
-	struct image *image = calloc(1, sizeof *image);
-	if (image == NULL) {
+	struct site       *site  = image->album->site;
+	struct site_phash *entry = arena_alloc(&site->arena, sizeof *entry);
+	if (entry == NULL) {
 		log_printl_errno(LOG_FATAL, "Memory allocation error");
-		return NULL;
+		return false;
 	}
-	image->tstamp = istat->st_mtim.tv_sec;
-	return image;
+	/* The image itself might be released before the report is written */
+	entry->phash = image->encoding.phash;
+	entry->path  = arena_strdup(&site->arena, relpath);
+	vector_push(site->phashes, entry);
+	return true;
 }
 
 struct image *
-image_new(char *src, const struct stat *pstat, struct album *album)
+image_new(const char *src, const struct stat *pstat, struct album *album)
 {
-	struct image *image = calloc(1, sizeof *image);
+	struct arena *arena = album->arena;
+	struct image *image = arena_calloc(arena, 1, sizeof *image);
 	if (image == NULL) {
 		log_printl_errno(LOG_FATAL, "Memory allocation error");
 		return NULL;
@@ -142,36 +206,196 @@ image_new(char *src, const struct stat *pstat, struct album *album)
 	char noext[NAME_MAX + 1];
 
 	image->album = album;
-	image->source = src;
-	image->basename = rbasename(src);
+	image->source = arena_strdup(arena, src);
+	image->basename = rbasename(image->source);
 
 	if ((image->ext = delext(image->basename, noext, NAME_MAX + 1)) == NULL) {
 		log_printl(LOG_FATAL, "Can't read %s, file name too long",
 		           image->basename);
-		free(image);
 		return NULL;
 	}
 
-	size_t relstart = album->slug - album->url;
-	image->url = joinpath(album->url, noext);
-	image->url_image = joinpath(image->url, image->basename);
-	image->url_thumb = malloc(strlen(image->url) + strlen(THUMB_SUFFIX) + strlen(image->basename) + 2);
-	image->dst = image->url + relstart;
+	const struct site_config   *sconf = album->site->config;
+	const struct albums_config *conf  = &sconf->albums;
+	struct image_paths          paths;
+	char                        tag[ASSETS_TAG_LEN + 1];
+
+	struct site *site    = album->site;
+	struct meta *meta    = &site->meta;
+	const char  *relpath = image->source + site->rel_content_dir;
+	if (!meta_lookup(meta, relpath, pstat, &image->exif, &image->thumb,
+	                 &image->encoding)) {
+		exif_read(image->source, &image->exif);
+	}
+	/* Also for those from builds without zoom, which didn't need the size */
+	if (sconf->zoom.min_megapixels > 0 && image->exif.width == 0
+	    && image_ping(image)) {
+		meta->changed = true;
+	}
+	bool kind = sconf->output.format == POLICY_AUTO
+	         && image->encoding.kind == KIND_UNKNOWN;
+	bool hash = site->duplicates != NULL && !image->encoding.phashed;
+	if ((kind || hash) && image_analyze(image, kind, hash)) {
+		meta->changed = true;
+	}
+	image->meta_index = meta_add(meta, relpath, pstat, &image->exif,
+	                             &image->thumb, &image->encoding);
+	if (image->meta_index == SIZE_MAX) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return NULL;
+	}
+	if (site->duplicates != NULL && image->encoding.phashed
+	    && !image_phash_add(image, relpath)) {
+		return NULL;
+	}
+	image->out_ext = image->ext;
+	if (sconf->output.format == POLICY_AUTO
+	    && image->encoding.kind != KIND_UNKNOWN) {
+		enum image_format format =
+			format_choose(image->encoding.kind, sconf->output.webp);
+		image->out_ext = format_ext(format);
+		image->format  = format_name(format);
+	}
+
+	if (sconf->output.hash_names) {
+		image_tag(sconf, pstat->st_size, &pstat->st_mtim, image->ext, tag);
+	}
+	if (!image_paths(&paths, conf->layout, album->url, image->basename,
+	                 sconf->output.hash_names ? tag : NULL, image->out_ext)) {
+		log_printl(LOG_FATAL, "Can't read %s, file name too long",
+		           image->basename);
+		return NULL;
+	}
+
+	if (conf->layout != LAYOUT_NESTED && !conf->viewer
+	    && !strcmp(noext, "index")) {
+		log_printl(LOG_FATAL, "The page of %s would replace the album page",
+		           image->source);
+		return NULL;
+	}
+	if (conf->layout == LAYOUT_NESTED && !strcmp(noext, PAGES_DIR)) {
+		log_printl(LOG_FATAL, "The dir of %s would be mixed up with the "
+		           "pages of the album", image->source);
+		return NULL;
+	}
+
+	size_t relstart  = album->slug - album->url;
+	image->url       = conf->layout == LAYOUT_FLAT ? album->url
+	                                              : arena_strdup(arena, paths.dir);
+	image->url_image = arena_strdup(arena, paths.image);
+	image->url_thumb = arena_strdup(arena, paths.thumb);
+	image->dst       = image->url + relstart;
 	image->dst_image = image->url_image + relstart;
 	image->dst_thumb = image->url_thumb + relstart;
-	sprintf(image->url_thumb, "%s/%s" THUMB_SUFFIX "%s", image->url,
-	        noext, image->ext);
+	if (conf->viewer) {
+		/* There are no pages, so dst_page is only used to clean them up */
+		image->link = arena_alloc(arena, strlen(album->url) + strlen(noext) + 3);
+		sprintf(image->link, "%s/#%s", album->url, noext);
+		image->dst_page = arena_strdup(arena, paths.page + relstart);
+	} else if (conf->layout == LAYOUT_NESTED) {
+		image->link     = image->url;
+		image->dst_page = arena_strdup(arena, paths.page + relstart);
+	} else {
+		image->link     = arena_strdup(arena, paths.page);
+		image->dst_page = image->link + relstart;
+	}
 
-	image->exif_data = exif_data_new_from_file(image->source);
+	if (zoom_wanted(&sconf->zoom, image->exif.width, image->exif.height)) {
+		image->url_zoom  = arena_strdup(arena, paths.zoom);
+		image->dst_zoom  = image->url_zoom + relstart;
+		image->dst_tiles = arena_strdup(arena, paths.tiles + relstart);
+	}
 	image->modtime = pstat->st_mtim;
+	image->size = pstat->st_size;
 	image_set_date(image, pstat);
-	image->map = roscha_object_new(hmap_new_with_cap(16));
-	image->thumb = roscha_object_new(hmap_new_with_cap(8));
 	image->modified = false;
 
 	return image;
 }
 
+void
+image_tag(const struct site_config *conf, off_t size,
+          const struct timespec *mtim, const char *ext, char *tag)
+{
+	struct hash_state s;
+	int64_t           fields[] = {size, mtim->tv_sec, mtim->tv_nsec};
+	uint64_t          key;
+	hash_init(&s, 0);
+	for (size_t i = 0; i < sizeof fields / sizeof *fields; i++) {
+		hash_update(&s, &fields[i], sizeof fields[i]);
+	}
+	key = cache_derivative_key(hash_final(&s), &conf->images, ext);
+	key = cache_derivative_key(key, &conf->thumbnails, ext);
+	assets_tag(key, tag);
+}
+
+bool
+image_paths(struct image_paths *paths, enum image_layout layout,
+            const char *base, const char *basename, const char *tag,
+            const char *ext)
+{
+	char        noext[NAME_MAX + 1];
+	char        dot[ASSETS_TAG_LEN + 2] = "";
+	const char *srcext = delext(basename, noext, NAME_MAX + 1);
+	int         n      = -1;
+	if (srcext == NULL) return false;
+	if (ext == NULL) ext = srcext;
+
+	switch (layout) {
+	case LAYOUT_NESTED:
+		n = snprintf(paths->dir, PATH_MAX, "%s/%s", base, noext);
+		break;
+	case LAYOUT_FLAT:
+		n = snprintf(paths->dir, PATH_MAX, "%s", base);
+		break;
+	case LAYOUT_SHARDED:
+		/* By name so that the shard of an image doesn't change with it */
+		n = snprintf(paths->dir, PATH_MAX, "%s/%02x", base,
+		             (unsigned)(hash_bytes(noext, strlen(noext), 0) & 0xff));
+		break;
+	}
+	if (n < 0 || n >= PATH_MAX) return false;
+
+	if (layout == LAYOUT_NESTED) {
+		n = snprintf(paths->page, PATH_MAX, "%s/index.html", paths->dir);
+	} else {
+		n = snprintf(paths->page, PATH_MAX, "%s/%s.html", base, noext);
+	}
+	if (n < 0 || n >= PATH_MAX) return false;
+	/* The tag goes right before the extension, e.g. name.rv-1a2b3c4d.jpg */
+	if (tag != NULL) snprintf(dot, sizeof dot, ".%s", tag);
+	n = snprintf(paths->image, PATH_MAX, "%s/%s%s%s", paths->dir, noext, dot,
+	             ext);
+	if (n < 0 || n >= PATH_MAX) return false;
+	n = snprintf(paths->thumb, PATH_MAX, "%s/%s" THUMB_SUFFIX "%s%s",
+	             paths->dir, noext, dot, ext);
+	if (n < 0 || n >= PATH_MAX) return false;
+	n = snprintf(paths->zoom, PATH_MAX, "%s/%s" ZOOM_EXT, paths->dir, noext);
+	if (n < 0 || n >= PATH_MAX) return false;
+	n = snprintf(paths->tiles, PATH_MAX, "%s/%s" ZOOM_TILES, paths->dir,
+	             noext);
+	return n >= 0 && n < PATH_MAX;
+}
+
+void
+image_fit(const struct image_config *conf, unsigned long *x,
+          unsigned long *y)
+{
+	unsigned long nx = conf->max_width, ny = conf->max_height;
+	/* Images are only made smaller, never bigger */
+	if (*x <= nx && *y <= ny) return;
+	if (conf->smart_resize) {
+		double ratio = (double)*x / *y;
+		if (*x > *y) {
+			ny = nx / ratio;
+		} else {
+			nx = ny * ratio;
+		}
+	}
+	*x = nx;
+	*y = ny;
+}
+
 int
 image_cmp(const void *va, const void *vb)
 {
@@ -180,41 +404,24 @@ image_cmp(const void *va, const void *vb)
 	return (a->tstamp > b->tstamp) - (a->tstamp < b->tstamp);
 }
 
-void
-image_destroy(struct image *image)
-{
-	free(image->source);
-	free(image->url);
-	free(image->url_image);
-	free(image->url_thumb);
-	if (image->exif_data) {
-		exif_data_unref(image->exif_data);
-	}
-	if (image->map) {
-		roscha_object_unref(image->map);
-		roscha_object_unref(image->thumb);
-	}
-	free(image);
-}
-
 struct album *
 album_new(struct album_config *conf, struct site *site, const char *src,
           const char *rsrc, const struct stat *dstat)
 {
-	struct album *album = calloc(1, sizeof *album);
+	struct album *album = arena_calloc(&site->arena, 1, sizeof *album);
 	if (album == NULL) {
 		log_printl_errno(LOG_FATAL, "Memory allocation error");
 		return NULL;
 	}
 	album->site = site;
+	album->arena = site->streaming ? &site->scratch : &site->arena;
 	album->config = conf;
-	album->source = strdup(src);
-	album->slug = slugify(rsrc, site->config->base_url, &album->url);
+	album->source = arena_strdup(&site->arena, src);
+	album->slug = slugify(&site->arena, rsrc, site->config->base_url,
+	                      &album->url);
 	album->images = vector_new_with_cap(64);
 	album->tstamp = MAXTIME;
 	album->preserved = hmap_new();
-	album->map = roscha_object_new(hmap_new());
-	album->thumbs = roscha_object_new(vector_new());
 
 	return album;
 }
@@ -246,22 +453,41 @@ album_set_year(struct album *album)
 	album->year[n] = '\0';
 }
 
+void
+album_release_images(struct album *album, size_t npreviews)
+{
+	struct arena *keep = &album->site->arena;
+	size_t i;
+	struct image *img;
+
+	if (npreviews > album->images->len) {
+		npreviews = album->images->len;
+	}
+	album->previews = arena_calloc(keep, npreviews, sizeof *album->previews);
+	if (album->previews != NULL) {
+		album->npreviews = npreviews;
+	}
+	for (i = 0; i < album->npreviews; i++) {
+		img = album->images->values[i];
+		album->previews[i].link = arena_strdup(keep, img->link);
+		album->previews[i].source = arena_strdup(keep, img->url_thumb);
+		album->previews[i].placeholder = arena_strdup(keep, img->thumb.placeholder);
+	}
+	album->datestr = arena_strdup(keep, album->datestr);
+
+	/* The images themselves belong to the album's arena */
+	album->images->len = 0;
+	hmap_free(album->preserved);
+	album->preserved = hmap_new();
+}
+
 void
 album_destroy(struct album *album)
 {
 	if (album->config != NULL) {
 		album_config_destroy(album->config);
 	}
-	size_t i;
-	struct image *img;
-	vector_foreach (album->images, i, img) {
-		image_destroy(img);
-	}
+	/* The images themselves belong to the album's arena */
 	vector_free(album->images);
-	free(album->source);
-	free(album->url);
 	hmap_free(album->preserved);
-	roscha_object_unref(album->map);
-	roscha_object_unref(album->thumbs);
-	free(album);
 }
@@ -0,0 +1,417 @@
+#include "compress.h"
+
+#include <zlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "fs.h"
+#include "log.h"
+
+#define ZSTD_LEVEL 19
+
+typedef bool (*compress_fn)(const void *in, size_t len, void **out,
+                            size_t *outlen);
+
+static bool compress_gzip(const void *, size_t, void **, size_t *);
+#ifdef HAVE_BROTLI
+static bool compress_brotli(const void *, size_t, void **, size_t *);
+#endif
+#ifdef HAVE_ZSTD
+static bool compress_zstd(const void *, size_t, void **, size_t *);
+#endif
+
+static const struct {
+	enum compress_format format;
+	const char          *ext;
+	compress_fn          fn;
+} formats[] = {
+	{COMPRESS_GZIP, ".gz", compress_gzip},
+#ifdef HAVE_BROTLI
+	{COMPRESS_BROTLI, ".br", compress_brotli},
+#endif
+#ifdef HAVE_ZSTD
+	{COMPRESS_ZSTD, ".zst", compress_zstd},
+#endif
+};
+
+#define NFORMATS (sizeof formats / sizeof *formats)
+
+/* Text files worth compressing among the static files */
+static const char *compressible[] = {
+	".html", ".css", ".js", ".mjs", ".json", ".svg", ".txt", ".xml", ".map",
+};
+
+static unsigned enabled;
+
+static bool
+compress_gzip(const void *in, size_t len, void **out, size_t *outlen)
+{
+	z_stream zs = {0};
+	/* 16 more bits of window for a gzip header instead of a zlib one */
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16,
+	                 MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY)
+	    != Z_OK) {
+		return false;
+	}
+	size_t cap = deflateBound(&zs, len);
+	if ((*out = malloc(cap)) == NULL) {
+		deflateEnd(&zs);
+		return false;
+	}
+	zs.next_in   = (Bytef *)in;
+	zs.avail_in  = len;
+	zs.next_out  = *out;
+	zs.avail_out = cap;
+	int res      = deflate(&zs, Z_FINISH);
+	*outlen      = zs.total_out;
+	deflateEnd(&zs);
+	if (res != Z_STREAM_END) {
+		free(*out);
+		return false;
+	}
+	return true;
+}
+
+#ifdef HAVE_BROTLI
+static bool
+compress_brotli(const void *in, size_t len, void **out, size_t *outlen)
+{
+	*outlen = BrotliEncoderMaxCompressedSize(len);
+	if (*outlen == 0 || (*out = malloc(*outlen)) == NULL) return false;
+	if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+	                           BROTLI_MODE_TEXT, len, in, outlen, *out)) {
+		free(*out);
+		return false;
+	}
+	return true;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static bool
+compress_zstd(const void *in, size_t len, void **out, size_t *outlen)
+{
+	size_t cap = ZSTD_compressBound(len);
+	if ((*out = malloc(cap)) == NULL) return false;
+	*outlen = ZSTD_compress(*out, cap, in, len, ZSTD_LEVEL);
+	if (ZSTD_isError(*outlen)) {
+		free(*out);
+		return false;
+	}
+	return true;
+}
+#endif
+
+bool
+compress_init(const struct compress_config *conf)
+{
+	unsigned want = (conf->gzip ? COMPRESS_GZIP : 0)
+	              | (conf->brotli ? COMPRESS_BROTLI : 0)
+	              | (conf->zstd ? COMPRESS_ZSTD : 0);
+	enabled = 0;
+	for (size_t i = 0; i < NFORMATS; i++) {
+		enabled |= want & formats[i].format;
+	}
+	if (enabled != want) {
+		log_printl(LOG_FATAL, "revela was built without %s support",
+		           (want & ~enabled) & COMPRESS_BROTLI ? "brotli" : "zstd");
+		return false;
+	}
+	return true;
+}
+
+bool
+compress_enabled(void)
+{
+	return enabled != 0;
+}
+
+bool
+compress_stem(const char *name, char *stem, size_t size)
+{
+	size_t len = strlen(name);
+	for (size_t i = 0; i < NFORMATS; i++) {
+		size_t extlen = strlen(formats[i].ext);
+		if (!(enabled & formats[i].format) || len <= extlen
+		    || strcmp(name + len - extlen, formats[i].ext)) {
+			continue;
+		}
+		if (len - extlen >= size) return false;
+		memcpy(stem, name, len - extlen);
+		stem[len - extlen] = '\0';
+		return true;
+	}
+	return false;
+}
+
+static bool
+sibling_write(const char *path, const char *ext, const void *data,
+              size_t len, const struct timespec *mtim)
+{
+	char sibling[PATH_MAX];
+	if (snprintf(sibling, PATH_MAX, "%s%s", path, ext) >= PATH_MAX) {
+		log_printl(LOG_ERROR, "Path too long: %s%s", path, ext);
+		return false;
+	}
+	int fd = open(sibling, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) goto fail;
+	for (size_t off = 0; off < len;) {
+		ssize_t n = write(fd, (const char *)data + off, len - off);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			close(fd);
+			goto fail;
+		}
+		off += n;
+	}
+	if (close(fd)) goto fail;
+	if (mtim != NULL) setdatetime(sibling, mtim);
+
+	return true;
+fail:
+	log_printl_errno(LOG_ERROR, "Can't write %s", sibling);
+	return false;
+}
+
+static bool
+compress_buf(const char *path, const void *data, size_t len,
+             const struct timespec *mtim)
+{
+	for (size_t i = 0; i < NFORMATS; i++) {
+		void  *out;
+		size_t outlen;
+		if (!(enabled & formats[i].format)) continue;
+		if (!formats[i].fn(data, len, &out, &outlen)) {
+			log_printl(LOG_ERROR, "Couldn't compress %s", path);
+			return false;
+		}
+		bool ok = sibling_write(path, formats[i].ext, out, outlen, mtim);
+		free(out);
+		if (!ok) return false;
+	}
+	return true;
+}
+
+bool
+compress_iov(const char *path, const struct iovec *iov, size_t iovcnt,
+             const struct timespec *mtim)
+{
+	if (!enabled) return true;
+	if (iovcnt == 1) {
+		return compress_buf(path, iov->iov_base, iov->iov_len, mtim);
+	}
+
+	size_t len = 0, off = 0;
+	for (size_t i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+	char *buf = malloc(len);
+	if (buf == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return false;
+	}
+	for (size_t i = 0; i < iovcnt; i++) {
+		memcpy(buf + off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+	bool ok = compress_buf(path, buf, len, mtim);
+	free(buf);
+	return ok;
+}
+
+int
+compress_uptodate(const char *path, const struct timespec *mtim)
+{
+	for (size_t i = 0; i < NFORMATS; i++) {
+		char        sibling[PATH_MAX];
+		struct stat st;
+		if (!(enabled & formats[i].format)) continue;
+		snprintf(sibling, PATH_MAX, "%s%s", path, formats[i].ext);
+		if (mtim != NULL) {
+			int res = file_is_uptodate(sibling, mtim);
+			if (res != 1) return res;
+		} else if (stat(sibling, &st)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+bool
+compress_is_text(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	if (ext == NULL) return false;
+	for (size_t i = 0; i < sizeof compressible / sizeof *compressible; i++) {
+		if (!strcmp(ext, compressible[i])) return true;
+	}
+	return false;
+}
+
+/* The static files whose siblings are outdated */
+struct compress_jobs {
+	pthread_mutex_t lock;
+	char          **srcs;
+	char          **dsts;
+	size_t          len;
+	size_t          cap;
+	size_t          next;
+	bool            failed;
+};
+
+static bool
+jobs_add(struct compress_jobs *jobs, const char *src, const char *dst)
+{
+	if (jobs->len == jobs->cap) {
+		size_t cap  = jobs->cap ? jobs->cap * 2 : 16;
+		char **srcs = realloc(jobs->srcs, cap * sizeof *srcs);
+		if (srcs == NULL) return false;
+		jobs->srcs = srcs;
+		char **dsts = realloc(jobs->dsts, cap * sizeof *dsts);
+		if (dsts == NULL) return false;
+		jobs->dsts = dsts;
+		jobs->cap  = cap;
+	}
+	jobs->srcs[jobs->len] = strdup(src);
+	jobs->dsts[jobs->len] = strdup(dst);
+	jobs->len++;
+	return true;
+}
+
+static bool
+jobs_find(struct compress_jobs *jobs, const char *src, const char *dst,
+          bool dry)
+{
+	DIR *dir = opendir(src);
+	if (dir == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", src);
+		return false;
+	}
+
+	struct dirent *ent;
+	bool           ok = true;
+	while (ok && (ent = readdir(dir))) {
+		char        entsrc[PATH_MAX], entdst[PATH_MAX];
+		struct stat st;
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+		joinpathb(entsrc, src, ent->d_name);
+		joinpathb(entdst, dst, ent->d_name);
+		if (stat(entsrc, &st)) continue;
+		if (S_ISDIR(st.st_mode)) {
+			ok = jobs_find(jobs, entsrc, entdst, dry);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode) || !compress_is_text(ent->d_name)) continue;
+		int res = compress_uptodate(entdst, &st.st_mtim);
+		if (res == 1) continue;
+		if (res == -1) {
+			ok = false;
+			continue;
+		}
+		log_printl(LOG_DETAIL, "Compressing %s", entdst);
+		if (!dry && !jobs_add(jobs, entsrc, entdst)) {
+			log_printl_errno(LOG_FATAL, "Memory allocation error");
+			ok = false;
+		}
+	}
+
+	closedir(dir);
+	return ok;
+}
+
+bool
+compress_file(const char *src, const char *dst)
+{
+	struct stat st;
+	bool        ok  = false;
+	char       *buf = NULL;
+	int         fd  = open(src, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) goto out;
+	if ((buf = malloc(st.st_size + 1)) == NULL) goto out;
+	for (off_t off = 0; off < st.st_size;) {
+		ssize_t n = read(fd, buf + off, st.st_size - off);
+		if (n <= 0) goto out;
+		off += n;
+	}
+	ok = compress_buf(dst, buf, st.st_size, &st.st_mtim);
+
+out:
+	if (!ok) log_printl_errno(LOG_ERROR, "Couldn't compress %s", src);
+	if (fd != -1) close(fd);
+	free(buf);
+	return ok;
+}
+
+static void *
+compress_worker(void *data)
+{
+	struct compress_jobs *jobs = data;
+	for (;;) {
+		pthread_mutex_lock(&jobs->lock);
+		size_t i = jobs->next++;
+		pthread_mutex_unlock(&jobs->lock);
+		if (i >= jobs->len) break;
+		if (!compress_file(jobs->srcs[i], jobs->dsts[i])) {
+			pthread_mutex_lock(&jobs->lock);
+			jobs->failed = true;
+			pthread_mutex_unlock(&jobs->lock);
+		}
+	}
+	return NULL;
+}
+
+bool
+compress_tree(const char *src, const char *dst, size_t nthreads, bool dry)
+{
+	struct compress_jobs jobs = {.lock = PTHREAD_MUTEX_INITIALIZER};
+	pthread_t           *threads;
+	size_t               i, n = 0;
+
+	if (!enabled) return true;
+	if (!jobs_find(&jobs, src, dst, dry)) jobs.failed = true;
+	if (jobs.len == 0) goto out;
+
+	if (nthreads > jobs.len) nthreads = jobs.len;
+	if (nthreads > 1 && (threads = calloc(nthreads, sizeof *threads))) {
+		for (; n < nthreads; n++) {
+			if (pthread_create(&threads[n], NULL, compress_worker, &jobs)) {
+				break;
+			}
+		}
+		/* Whatever the threads didn't get to is done by this one */
+		compress_worker(&jobs);
+		for (i = 0; i < n; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		free(threads);
+	} else {
+		compress_worker(&jobs);
+	}
+
+out:
+	for (i = 0; i < jobs.len; i++) {
+		free(jobs.srcs[i]);
+		free(jobs.dsts[i]);
+	}
+	free(jobs.srcs);
+	free(jobs.dsts);
+	pthread_mutex_destroy(&jobs.lock);
+	return !jobs.failed;
+}
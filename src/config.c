@@ -99,6 +99,309 @@ site_config_images_keyvalue_handler(struct parcini_line *parsed,
 			}
 		}
 	}
+	if (!strcmp(parsed->key, "ssim")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0 || temp > 1000) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				iconfig->ssim = (double)temp / 1000;
+			}
+		}
+	}
+
+	return res;
+}
+
+static int
+site_config_cache_keyvalue_handler(struct parcini_line *parsed,
+                                   struct cache_config *cconfig)
+{
+	int res = CONFIG_KEY_BADKEY;
+	if (!strcmp(parsed->key, "dir")) {
+		free(cconfig->dir);
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_STRING,
+		                           &cconfig->dir)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+	}
+	if (!strcmp(parsed->key, "max_size")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 1) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				cconfig->max_size = (size_t)temp;
+			}
+		}
+	}
+
+	return res;
+}
+
+static int
+site_config_index_keyvalue_handler(struct parcini_line *parsed,
+                                   struct index_config *iconfig)
+{
+	int res = CONFIG_KEY_BADKEY;
+	if (!strcmp(parsed->key, "previews")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				iconfig->previews = (size_t)temp;
+			}
+		}
+	}
+	if (!strcmp(parsed->key, "per_page")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				iconfig->per_page = (size_t)temp;
+			}
+		}
+	}
+	if (!strcmp(parsed->key, "years")) {
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_BOOLEAN,
+		                           &iconfig->years)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+	}
+
+	return res;
+}
+
+static int
+site_config_albums_keyvalue_handler(struct parcini_line *parsed,
+                                    struct albums_config *aconfig)
+{
+	int res = CONFIG_KEY_BADKEY;
+	if (!strcmp(parsed->key, "per_page")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				aconfig->per_page = (size_t)temp;
+			}
+		}
+	}
+	if (!strcmp(parsed->key, "viewer")) {
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_BOOLEAN,
+		                           &aconfig->viewer)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+	}
+	if (!strcmp(parsed->key, "layout")) {
+		char *layout = NULL;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_STRING,
+		                           &layout)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (!strcmp(layout, "nested")) {
+				aconfig->layout = LAYOUT_NESTED;
+			} else if (!strcmp(layout, "flat")) {
+				aconfig->layout = LAYOUT_FLAT;
+			} else if (!strcmp(layout, "sharded")) {
+				aconfig->layout = LAYOUT_SHARDED;
+			} else {
+				res = CONFIG_KEY_BADVALUE;
+			}
+		}
+		free(layout);
+	}
+	if (!strcmp(parsed->key, "sprite")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				aconfig->sprite = (size_t)temp;
+			}
+		}
+	}
+
+	return res;
+}
+
+static int
+site_config_compress_keyvalue_handler(struct parcini_line *parsed,
+                                      struct compress_config *cconfig)
+{
+	bool *format = NULL;
+	if (!strcmp(parsed->key, "gzip")) {
+		format = &cconfig->gzip;
+	} else if (!strcmp(parsed->key, "brotli")) {
+		format = &cconfig->brotli;
+	} else if (!strcmp(parsed->key, "zstd")) {
+		format = &cconfig->zstd;
+	} else {
+		return CONFIG_KEY_BADKEY;
+	}
+
+	return parcini_value_handle(&parsed->value, PARCINI_VALUE_BOOLEAN, format)
+	         ? CONFIG_KEY_OK
+	         : CONFIG_KEY_BADVALUE;
+}
+
+static int
+site_config_output_keyvalue_handler(struct parcini_line *parsed,
+                                    struct output_config *oconfig)
+{
+	int res = CONFIG_KEY_BADKEY;
+	if (!strcmp(parsed->key, "minify")) {
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_BOOLEAN,
+		                           &oconfig->minify)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+	} else if (!strcmp(parsed->key, "hash_names")) {
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_BOOLEAN,
+		                           &oconfig->hash_names)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+	} else if (!strcmp(parsed->key, "format")) {
+		char *format = NULL;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_STRING,
+		                           &format)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (!strcmp(format, "source")) {
+				oconfig->format = POLICY_SOURCE;
+			} else if (!strcmp(format, "auto")) {
+				oconfig->format = POLICY_AUTO;
+			} else {
+				res = CONFIG_KEY_BADVALUE;
+			}
+		}
+		free(format);
+	} else if (!strcmp(parsed->key, "webp")) {
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_BOOLEAN,
+		                           &oconfig->webp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+	}
+
+	return res;
+}
+
+static int
+site_config_zoom_keyvalue_handler(struct parcini_line *parsed,
+                                  struct zoom_config *zconfig)
+{
+	int res = CONFIG_KEY_BADKEY;
+	if (!strcmp(parsed->key, "min_megapixels")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				zconfig->min_megapixels = (size_t)temp;
+			}
+		}
+	}
+	if (!strcmp(parsed->key, "tile_size")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 1 || temp > 4096) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				zconfig->tile_size = (size_t)temp;
+			}
+		}
+	}
+	if (!strcmp(parsed->key, "overlap")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0 || temp > 64) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				zconfig->overlap = (size_t)temp;
+			}
+		}
+	}
+	if (!strcmp(parsed->key, "quality")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp > 100 || temp < 0) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				zconfig->quality = (uint8_t)temp;
+			}
+		}
+	}
+
+	return res;
+}
+
+static int
+site_config_decode_keyvalue_handler(struct parcini_line *parsed,
+                                    struct decode_config *dconfig)
+{
+	int res = CONFIG_KEY_BADKEY;
+	if (!strcmp(parsed->key, "scaled")) {
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_BOOLEAN,
+		                           &dconfig->scaled)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+	} else if (!strcmp(parsed->key, "max_memory")) {
+		long int temp;
+		res = parcini_value_handle(&parsed->value, PARCINI_VALUE_INTEGER,
+		                           &temp)
+		        ? CONFIG_KEY_OK
+		        : CONFIG_KEY_BADVALUE;
+		if (res == CONFIG_KEY_OK) {
+			if (temp < 0) {
+				res = CONFIG_KEY_BADVALUE;
+			} else {
+				dconfig->max_memory = (size_t)temp;
+			}
+		}
+	}
 
 	return res;
 }
@@ -115,6 +418,21 @@ site_config_keyvalue_handler(struct parcini_line *parsed, void *dst)
 	} else if (!strcmp(parsed->section, "thumbnails")) {
 		subconf = site_config_images_keyvalue_handler(parsed,
 		                                              &config->thumbnails);
+	} else if (!strcmp(parsed->section, "cache")) {
+		subconf = site_config_cache_keyvalue_handler(parsed, &config->cache);
+	} else if (!strcmp(parsed->section, "index")) {
+		subconf = site_config_index_keyvalue_handler(parsed, &config->index);
+	} else if (!strcmp(parsed->section, "albums")) {
+		subconf = site_config_albums_keyvalue_handler(parsed, &config->albums);
+	} else if (!strcmp(parsed->section, "compress")) {
+		subconf = site_config_compress_keyvalue_handler(parsed,
+		                                                &config->compress);
+	} else if (!strcmp(parsed->section, "output")) {
+		subconf = site_config_output_keyvalue_handler(parsed, &config->output);
+	} else if (!strcmp(parsed->section, "zoom")) {
+		subconf = site_config_zoom_keyvalue_handler(parsed, &config->zoom);
+	} else if (!strcmp(parsed->section, "decode")) {
+		subconf = site_config_decode_keyvalue_handler(parsed, &config->decode);
 	}
 	switch (subconf) {
 	case CONFIG_KEY_OK:
@@ -251,6 +569,7 @@ site_config_init(void)
 			.max_height = 2000,
 			.smart_resize = true,
 			.blur = 0,
+			.ssim = 0,
 		};
 		config->thumbnails = (struct image_config){
 			.strip = true,
@@ -259,6 +578,43 @@ site_config_init(void)
 			.max_height = 270,
 			.smart_resize = true,
 			.blur = 0.25,
+			.ssim = 0,
+		};
+		config->cache = (struct cache_config){
+			.dir = NULL,
+			.max_size = 1024,
+		};
+		config->index = (struct index_config){
+			.previews = 4,
+			.per_page = 0,
+			.years = false,
+		};
+		config->albums = (struct albums_config){
+			.per_page = 0,
+			.viewer = false,
+			.layout = LAYOUT_NESTED,
+			.sprite = 0,
+		};
+		config->compress = (struct compress_config){
+			.gzip = false,
+			.brotli = false,
+			.zstd = false,
+		};
+		config->output = (struct output_config){
+			.minify = false,
+			.hash_names = false,
+			.format = POLICY_SOURCE,
+			.webp = false,
+		};
+		config->zoom = (struct zoom_config){
+			.min_megapixels = 0,
+			.tile_size = 254,
+			.overlap = 1,
+			.quality = 85,
+		};
+		config->decode = (struct decode_config){
+			.scaled = true,
+			.max_memory = 0,
 		};
 	}
 
@@ -277,6 +633,7 @@ site_config_destroy(struct site_config *config)
 {
 	free(config->title);
 	free(config->base_url);
+	free(config->cache.dir);
 	free(config);
 }
 
@@ -0,0 +1,255 @@
+#include "exif.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <libexif/exif-data.h>
+
+#include "log.h"
+
+/*
+ * Copies the value of an ASCII entry into buf, without the trailing spaces
+ * that some cameras use as padding. Returns false if there's no such entry or
+ * if it's empty.
+ */
+static bool
+entry_ascii(ExifEntry *e, char *buf, size_t size)
+{
+	if (e == NULL || e->format != EXIF_FORMAT_ASCII || e->data == NULL) {
+		return false;
+	}
+	size_t len = e->size < size - 1 ? e->size : size - 1;
+	memcpy(buf, e->data, len);
+	buf[len] = '\0';
+	len      = strlen(buf);
+	while (len > 0 && buf[len - 1] == ' ') {
+		buf[--len] = '\0';
+	}
+	return len > 0;
+}
+
+static bool
+entry_rational(ExifEntry *e, ExifByteOrder order, unsigned long i, double *val)
+{
+	if (e == NULL || e->format != EXIF_FORMAT_RATIONAL || e->components <= i) {
+		return false;
+	}
+	ExifRational r = exif_get_rational(
+		e->data + i * exif_format_get_size(EXIF_FORMAT_RATIONAL), order);
+	if (r.denominator == 0) return false;
+	*val = (double)r.numerator / r.denominator;
+	return true;
+}
+
+static bool
+entry_uint(ExifEntry *e, ExifByteOrder order, uint32_t *val)
+{
+	if (e == NULL || e->components < 1) return false;
+	switch (e->format) {
+	case EXIF_FORMAT_SHORT:
+		*val = exif_get_short(e->data, order);
+		return true;
+	case EXIF_FORMAT_LONG:
+		*val = exif_get_long(e->data, order);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Converts a GPS coordinate, stored as degrees, minutes and seconds, and its
+ * reference (N, S, E or W) to decimal degrees.
+ */
+static void
+exif_read_coordinate(ExifContent *gps, ExifByteOrder order, ExifTag tag,
+                     ExifTag reftag, char *buf, size_t size)
+{
+	double     deg, min, sec;
+	char       ref[4];
+	ExifEntry *e = exif_content_get_entry(gps, tag);
+	if (!entry_rational(e, order, 0, &deg) || !entry_rational(e, order, 1, &min)
+	    || !entry_rational(e, order, 2, &sec)) {
+		return;
+	}
+	deg += min / 60 + sec / 3600;
+	if (entry_ascii(exif_content_get_entry(gps, reftag), ref, sizeof ref)
+	    && (ref[0] == 'S' || ref[0] == 'W')) {
+		deg = -deg;
+	}
+	snprintf(buf, size, "%.6f", deg);
+}
+
+static void
+exif_read_camera(ExifContent *ifd0, struct image_exif *exif)
+{
+	char make[32];
+	bool hasmake  = entry_ascii(exif_content_get_entry(ifd0, EXIF_TAG_MAKE),
+	                            make, sizeof make);
+	bool hasmodel = entry_ascii(exif_content_get_entry(ifd0, EXIF_TAG_MODEL),
+	                            exif->camera, sizeof exif->camera);
+	if (!hasmake) return;
+	if (!hasmodel) {
+		strcpy(exif->camera, make);
+		return;
+	}
+	/*
+	 * Most models already start with the brand, e.g. "Canon" and "Canon EOS
+	 * 5D", or "NIKON CORPORATION" and "NIKON D750".
+	 */
+	size_t brandlen = strcspn(make, " ");
+	if (strncasecmp(exif->camera, make, brandlen)) {
+		size_t makelen  = strlen(make);
+		size_t modellen = strlen(exif->camera);
+		if (makelen + modellen + 2 > sizeof exif->camera) {
+			modellen = sizeof exif->camera - makelen - 2;
+		}
+		memmove(exif->camera + makelen + 1, exif->camera, modellen);
+		memcpy(exif->camera, make, makelen);
+		exif->camera[makelen]                = ' ';
+		exif->camera[makelen + modellen + 1] = '\0';
+	}
+}
+
+bool
+exif_read(const char *path, struct image_exif *exif)
+{
+	memset(exif, 0, sizeof *exif);
+	ExifData *data = exif_data_new_from_file(path);
+	if (data == NULL) return false;
+
+	ExifByteOrder order = exif_data_get_byte_order(data);
+	ExifContent  *ifd0  = data->ifd[EXIF_IFD_0];
+	ExifContent  *sub   = data->ifd[EXIF_IFD_EXIF];
+	ExifContent  *gps   = data->ifd[EXIF_IFD_GPS];
+	ExifEntry    *e;
+	char          buf[32];
+	double        val;
+	uint32_t      uval;
+
+	exif->present = true;
+
+	e = exif_content_get_entry(sub, EXIF_TAG_DATE_TIME_ORIGINAL);
+	if (e == NULL) {
+		e = exif_content_get_entry(sub, EXIF_TAG_DATE_TIME_DIGITIZED);
+	}
+	if (entry_ascii(e, buf, sizeof buf)
+	    && !exif_parse_datetime(buf, &exif->tstamp, exif->datetime)) {
+		log_printl(LOG_DEBUG, "Bad exif date \"%s\" in %s", buf, path);
+	}
+
+	exif_read_camera(ifd0, exif);
+	entry_ascii(exif_content_get_entry(sub, EXIF_TAG_LENS_MODEL), exif->lens,
+	            sizeof exif->lens);
+
+	e = exif_content_get_entry(sub, EXIF_TAG_EXPOSURE_TIME);
+	if (entry_rational(e, order, 0, &val) && val > 0) {
+		if (val < 1) {
+			snprintf(exif->exposure, sizeof exif->exposure, "1/%.0f", 1 / val);
+		} else {
+			snprintf(exif->exposure, sizeof exif->exposure, "%g", val);
+		}
+	}
+	e = exif_content_get_entry(sub, EXIF_TAG_FNUMBER);
+	if (entry_rational(e, order, 0, &val) && val > 0 && val < 1000) {
+		snprintf(exif->fnumber, sizeof exif->fnumber, "%.2g", val);
+	}
+	e = exif_content_get_entry(sub, EXIF_TAG_FOCAL_LENGTH);
+	if (entry_rational(e, order, 0, &val) && val > 0 && val < 100000) {
+		snprintf(exif->focal_length, sizeof exif->focal_length, "%.0f", val);
+	}
+	e = exif_content_get_entry(sub, EXIF_TAG_ISO_SPEED_RATINGS);
+	if (entry_uint(e, order, &uval)) {
+		exif->iso = uval;
+	}
+	e = exif_content_get_entry(sub, EXIF_TAG_PIXEL_X_DIMENSION);
+	if (entry_uint(e, order, &uval)) {
+		exif->width = uval;
+	}
+	e = exif_content_get_entry(sub, EXIF_TAG_PIXEL_Y_DIMENSION);
+	if (entry_uint(e, order, &uval)) {
+		exif->height = uval;
+	}
+	e = exif_content_get_entry(ifd0, EXIF_TAG_ORIENTATION);
+	if (entry_uint(e, order, &uval) && uval >= 1 && uval <= 8) {
+		exif->orientation = uval;
+	}
+
+	if (gps != NULL) {
+		exif_read_coordinate(gps, order, EXIF_TAG_GPS_LATITUDE,
+		                     EXIF_TAG_GPS_LATITUDE_REF, exif->latitude,
+		                     sizeof exif->latitude);
+		exif_read_coordinate(gps, order, EXIF_TAG_GPS_LONGITUDE,
+		                     EXIF_TAG_GPS_LONGITUDE_REF, exif->longitude,
+		                     sizeof exif->longitude);
+		if (exif->latitude[0] == '\0' || exif->longitude[0] == '\0') {
+			exif->latitude[0]  = '\0';
+			exif->longitude[0] = '\0';
+		}
+	}
+
+	exif_data_unref(data);
+	return true;
+}
+
+/* Parses n digits at str; returns -1 if any of them isn't a digit */
+static int
+parse_digits(const char *str, int n)
+{
+	int val = 0;
+	for (int i = 0; i < n; i++) {
+		if (str[i] < '0' || str[i] > '9') return -1;
+		val = val * 10 + str[i] - '0';
+	}
+	return val;
+}
+
+/*
+ * mktime() is slow, mostly because it has to look up the timezone each time,
+ * and pictures are usually taken in bursts, so the start of the last hour
+ * that was converted is remembered and the minutes and seconds added to it.
+ */
+static struct {
+	long   key;
+	time_t start;
+} last_hour = {.key = -1};
+
+bool
+exif_parse_datetime(const char *str, time_t *tstamp, char *datestr)
+{
+	if (strlen(str) < EXIF_DATELEN || str[4] != ':' || str[7] != ':'
+	    || str[10] != ' ' || str[13] != ':' || str[16] != ':') {
+		return false;
+	}
+	int year = parse_digits(str, 4), mon = parse_digits(str + 5, 2),
+	    day = parse_digits(str + 8, 2), hour = parse_digits(str + 11, 2),
+	    min = parse_digits(str + 14, 2), sec = parse_digits(str + 17, 2);
+	/* Some cameras write all zeroes or spaces when the date is unknown */
+	if (year < 1 || mon < 1 || mon > 12 || day < 1 || day > 31 || hour < 0
+	    || hour > 23 || min < 0 || min > 59 || sec < 0 || sec > 60) {
+		return false;
+	}
+
+	long key = ((year * 13L + mon) * 32 + day) * 24 + hour;
+	if (key != last_hour.key) {
+		struct tm tm = {
+			.tm_year  = year - 1900,
+			.tm_mon   = mon - 1,
+			.tm_mday  = day,
+			.tm_hour  = hour,
+			.tm_isdst = -1,
+		};
+		time_t start = mktime(&tm);
+		if (start == (time_t)-1) return false;
+		last_hour.key   = key;
+		last_hour.start = start;
+	}
+	*tstamp = last_hour.start + min * 60 + sec;
+
+	memcpy(datestr, str, EXIF_DATELEN);
+	datestr[4]            = '-';
+	datestr[7]            = '-';
+	datestr[EXIF_DATELEN] = '\0';
+
+	return true;
+}
@@ -0,0 +1,125 @@
+#include "format.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Open addressing table with room to spare for all the colors counted */
+#define COLOR_BITS  9
+#define COLOR_SLOTS (1 << COLOR_BITS)
+#define COLOR_EMPTY UINT32_MAX
+
+/* Difference in lightness, out of 255, between the pixels of an edge */
+#define EDGE_JUMP 48
+/* Fractions of the pairs of pixels above which an image is a graphic */
+#define GRAPHIC_FLAT       0.5
+#define GRAPHIC_EDGES_FLAT 0.25
+#define GRAPHIC_EDGES      0.05
+
+static void
+color_add(uint32_t *table, uint32_t color, size_t *colors)
+{
+	uint32_t i = (color * 2654435761u) >> (32 - COLOR_BITS);
+	while (table[i] != COLOR_EMPTY) {
+		if (table[i] == color) return;
+		i = (i + 1) & (COLOR_SLOTS - 1);
+	}
+	table[i] = color;
+	(*colors)++;
+}
+
+static unsigned
+luma(const unsigned char *p)
+{
+	return (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8;
+}
+
+static void
+pair_add(const unsigned char *a, const unsigned char *b, size_t *flat,
+         size_t *edges)
+{
+	unsigned la = luma(a), lb = luma(b);
+	if (!memcmp(a, b, 3)) (*flat)++;
+	if ((la > lb ? la - lb : lb - la) > EDGE_JUMP) (*edges)++;
+}
+
+void
+format_analyze(const unsigned char *rgba, size_t width, size_t height,
+               struct format_stats *stats)
+{
+	uint32_t table[COLOR_SLOTS];
+	size_t   flat = 0, edges = 0, pairs = 0;
+
+	memset(stats, 0, sizeof *stats);
+	memset(table, 0xff, sizeof table);
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			const unsigned char *p = rgba + (y * width + x) * 4;
+			if (p[3] != 0xff) stats->alpha = true;
+			if (stats->colors <= FORMAT_PALETTE_COLORS) {
+				color_add(table, p[0] << 16 | p[1] << 8 | p[2], &stats->colors);
+			}
+			if (x > 0) {
+				pair_add(p - 4, p, &flat, &edges);
+				pairs++;
+			}
+			if (y > 0) {
+				pair_add(p - width * 4, p, &flat, &edges);
+				pairs++;
+			}
+		}
+	}
+	if (pairs > 0) {
+		stats->flat  = (double)flat / pairs;
+		stats->edges = (double)edges / pairs;
+	}
+}
+
+enum image_kind
+format_kind(const struct format_stats *stats)
+{
+	if (stats->alpha) return KIND_ALPHA;
+	if (stats->colors <= FORMAT_PALETTE_COLORS) return KIND_PALETTE;
+	/* Photos hardly have two neighbouring pixels of the very same color */
+	if (stats->flat >= GRAPHIC_FLAT
+	    || (stats->flat >= GRAPHIC_EDGES_FLAT
+	        && stats->edges >= GRAPHIC_EDGES)) {
+		return KIND_GRAPHIC;
+	}
+	return KIND_PHOTO;
+}
+
+enum image_format
+format_choose(enum image_kind kind, bool webp)
+{
+	switch (kind) {
+	case KIND_GRAPHIC:
+	case KIND_PALETTE:
+		return FORMAT_PNG;
+	case KIND_ALPHA:
+		return webp ? FORMAT_WEBP : FORMAT_PNG;
+	default:
+		return webp ? FORMAT_WEBP : FORMAT_JPEG;
+	}
+}
+
+const char *
+format_ext(enum image_format format)
+{
+	static const char *exts[] = {
+		[FORMAT_JPEG] = ".jpg",
+		[FORMAT_PNG]  = ".png",
+		[FORMAT_WEBP] = ".webp",
+	};
+	return exts[format];
+}
+
+const char *
+format_name(enum image_format format)
+{
+	static const char *names[] = {
+		[FORMAT_JPEG] = "jpeg",
+		[FORMAT_PNG]  = "png",
+		[FORMAT_WEBP] = "webp",
+	};
+	return names[format];
+}
@@ -0,0 +1,439 @@
+#include "fragment.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct chunk {
+	const char *start;
+	size_t      len;
+	/* Whether the chunk can be part of a fragment */
+	bool foldable;
+	/* Whether the chunk has anything to render, i.e. it isn't just text */
+	bool tags;
+};
+
+static inline bool
+is_tag(const char *p)
+{
+	return p[0] == '{' && (p[1] == '{' || p[1] == '%' || p[1] == '#');
+}
+
+/* Right after the closing delimiter of the tag at p; NULL if there's none */
+static const char *
+tag_end(const char *p)
+{
+	const char *close = p[1] == '{' ? "}}" : p[1] == '%' ? "%}" : "#}";
+	const char *end   = strstr(p + 2, close);
+	return end != NULL ? end + 2 : NULL;
+}
+
+/* The keyword of the statement at p, e.g. "if" in "{% if x %}" */
+static size_t
+tag_keyword(const char *p, const char **kw)
+{
+	size_t n = 0;
+	for (p += 2; *p == '-' || isspace((unsigned char)*p); p++)
+		;
+	while (isalpha((unsigned char)p[n])) n++;
+	*kw = p;
+	return n;
+}
+
+static inline bool
+keyword_is(const char *kw, size_t n, const char *s)
+{
+	return strlen(s) == n && strncmp(kw, s, n) == 0;
+}
+
+static inline bool
+is_ident(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Whether the identifier dep appears anywhere between start and end */
+static bool
+refers_to(const char *start, const char *end, const char *dep)
+{
+	size_t n = strlen(dep);
+	for (const char *p = start; p + n <= end; p++) {
+		if (strncmp(p, dep, n) != 0) continue;
+		if ((p == start || !is_ident(p[-1])) && (p + n == end || !is_ident(p[n])))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Scans the if or for statement at p up to its end. Sets foldable to false if
+ * it has any other kind of statement inside. Returns NULL if it isn't closed.
+ */
+static const char *
+statement_end(const char *p, bool *foldable)
+{
+	size_t depth = 0;
+	while ((p = strchr(p, '{')) != NULL) {
+		if (!is_tag(p)) {
+			p++;
+			continue;
+		}
+		const char *end = tag_end(p);
+		if (end == NULL) return NULL;
+		if (p[1] == '%') {
+			const char *kw;
+			size_t      n = tag_keyword(p, &kw);
+			if (keyword_is(kw, n, "if") || keyword_is(kw, n, "for")) {
+				depth++;
+			} else if (keyword_is(kw, n, "endif")
+			           || keyword_is(kw, n, "endfor")) {
+				if (--depth == 0) return end;
+			} else if (!keyword_is(kw, n, "else")
+			           && !keyword_is(kw, n, "elif")) {
+				*foldable = false;
+			}
+		}
+		p = end;
+	}
+	return NULL;
+}
+
+static bool
+chunks_push(struct chunk **chunks, size_t *len, size_t *cap,
+            struct chunk chunk)
+{
+	if (*len == *cap) {
+		size_t        ncap = *cap ? *cap * 2 : 32;
+		struct chunk *new  = realloc(*chunks, ncap * sizeof *new);
+		if (new == NULL) return false;
+		*chunks = new;
+		*cap    = ncap;
+	}
+	(*chunks)[(*len)++] = chunk;
+	return true;
+}
+
+/* Splits the template into top level chunks */
+static bool
+chunks_scan(const char *src, const char *dep, struct chunk **chunks,
+            size_t *len)
+{
+	size_t      cap = 0;
+	const char *pos = src;
+	while (*pos != '\0') {
+		struct chunk chunk = {.start = pos, .foldable = true};
+		const char  *end;
+		if (!is_tag(pos)) {
+			for (end = pos + 1; *end != '\0' && !is_tag(end); end++)
+				;
+		} else if ((end = tag_end(pos)) == NULL) {
+			end            = pos + strlen(pos);
+			chunk.foldable = false;
+		} else if (pos[1] == '{') {
+			chunk.tags = true;
+		} else if (pos[1] == '%') {
+			const char *kw;
+			size_t      n = tag_keyword(pos, &kw);
+			chunk.tags    = true;
+			if (keyword_is(kw, n, "if") || keyword_is(kw, n, "for")) {
+				end = statement_end(pos, &chunk.foldable);
+				if (end == NULL) {
+					end            = pos + strlen(pos);
+					chunk.foldable = false;
+				}
+			} else {
+				chunk.foldable = false;
+			}
+		}
+		chunk.len = end - pos;
+		if (chunk.tags && refers_to(pos, end, dep)) chunk.foldable = false;
+		if (!chunks_push(chunks, len, &cap, chunk)) return false;
+		pos = end;
+	}
+	return true;
+}
+
+/* Output of fragments_flatten(), grown as needed */
+struct text {
+	char  *str;
+	size_t len;
+	size_t cap;
+};
+
+static bool
+text_append(struct text *t, const char *str, size_t len)
+{
+	if (t->len + len + 1 > t->cap) {
+		size_t ncap = t->cap ? t->cap * 2 : 4096;
+		while (ncap < t->len + len + 1) ncap *= 2;
+		char *nstr = realloc(t->str, ncap);
+		if (nstr == NULL) return false;
+		t->str = nstr;
+		t->cap = ncap;
+	}
+	memcpy(t->str + t->len, str, len);
+	t->len += len;
+	t->str[t->len] = '\0';
+	return true;
+}
+
+/* A block of a template, from right after its tag up to its endblock tag */
+struct block {
+	const char *name;
+	size_t      namelen;
+	const char *start;
+	const char *end;
+};
+
+/* The name of the block at p if it's a block statement; 0 if it isn't */
+static size_t
+block_name(const char *p, const char **name)
+{
+	const char *kw;
+	size_t      n = tag_keyword(p, &kw);
+	if (p[1] != '%' || !keyword_is(kw, n, "block")) return 0;
+	for (kw += n; isspace((unsigned char)*kw); kw++)
+		;
+	for (n = 0; is_ident(kw[n]); n++)
+		;
+	*name = kw;
+	return n;
+}
+
+/*
+ * The endblock tag that closes the block whose contents start at p, or NULL if
+ * there's none. Sets *after to right after it.
+ */
+static const char *
+block_end(const char *p, const char **after)
+{
+	size_t depth = 1;
+	while ((p = strchr(p, '{')) != NULL) {
+		const char *end, *kw, *name;
+		if (!is_tag(p)) {
+			p++;
+			continue;
+		}
+		if ((end = tag_end(p)) == NULL) return NULL;
+		size_t n = tag_keyword(p, &kw);
+		if (block_name(p, &name) > 0) {
+			depth++;
+		} else if (p[1] == '%' && keyword_is(kw, n, "endblock")
+		           && --depth == 0) {
+			*after = end;
+			return p;
+		}
+		p = end;
+	}
+	return NULL;
+}
+
+/* The name of the template that src extends, if it starts by extending one */
+static bool
+extends_name(const char *src, char *name, size_t size)
+{
+	const char *p = src;
+	while ((p = strchr(p, '{')) != NULL && !(is_tag(p) && p[1] == '%')) p++;
+	if (p == NULL) return false;
+	const char *kw;
+	size_t      n = tag_keyword(p, &kw);
+	if (!keyword_is(kw, n, "extends")) return false;
+	for (kw += n; isspace((unsigned char)*kw); kw++)
+		;
+	const char *end;
+	if (*kw != '"' || (end = strchr(kw + 1, '"')) == NULL
+	    || (size_t)(end - kw) > size) {
+		return false;
+	}
+	memcpy(name, kw + 1, end - kw - 1);
+	name[end - kw - 1] = '\0';
+	return true;
+}
+
+/* Blocks can only be nested so deep, and templates only extend so many */
+#define MAX_DEPTH 16
+
+/*
+ * Copies the template between start and end into out without its block tags,
+ * and with the contents of each block replaced by those of the first block
+ * with the same name in blocks, if any.
+ */
+static bool
+blocks_fill(struct text *out, const char *start, const char *end,
+            const struct block *blocks, size_t nblocks, int depth)
+{
+	const char *p = start;
+	if (depth == MAX_DEPTH) return false;
+	while (p < end) {
+		const char *tag = strchr(p, '{');
+		const char *name, *close, *after, *tagend;
+		size_t      n;
+		if (tag == NULL || tag >= end) break;
+		if (!is_tag(tag) || (n = block_name(tag, &name)) == 0) {
+			if (!text_append(out, p, tag + 1 - p)) return false;
+			p = tag + 1;
+			continue;
+		}
+		if ((tagend = tag_end(tag)) == NULL
+		    || (close = block_end(tagend, &after)) == NULL || after > end
+		    || !text_append(out, p, tag - p)) {
+			return false;
+		}
+		const char *bstart = tagend, *bend = close;
+		for (size_t i = 0; i < nblocks; i++) {
+			if (blocks[i].namelen == n && !strncmp(blocks[i].name, name, n)) {
+				bstart = blocks[i].start;
+				bend   = blocks[i].end;
+				break;
+			}
+		}
+		if (!blocks_fill(out, bstart, bend, blocks, nblocks, depth + 1)) {
+			return false;
+		}
+		p = after;
+	}
+	return text_append(out, p, end - p);
+}
+
+/*
+ * Adds the blocks of the template in src to blocks, including nested ones.
+ * Returns false if any of them isn't closed or uses super().
+ */
+static bool
+blocks_scan(const char *src, struct block **blocks, size_t *len, size_t *cap)
+{
+	const char *p = src;
+	while ((p = strchr(p, '{')) != NULL) {
+		struct block block;
+		const char  *tagend, *after;
+		if (!is_tag(p) || (block.namelen = block_name(p, &block.name)) == 0) {
+			p++;
+			continue;
+		}
+		if ((tagend = tag_end(p)) == NULL
+		    || (block.end = block_end(tagend, &after)) == NULL
+		    || refers_to(tagend, block.end, "super")) {
+			return false;
+		}
+		block.start = tagend;
+		if (*len == *cap) {
+			*cap             = *cap ? *cap * 2 : 8;
+			struct block *nb = realloc(*blocks, *cap * sizeof *nb);
+			if (nb == NULL) return false;
+			*blocks = nb;
+		}
+		(*blocks)[(*len)++] = block;
+		p                   = tagend;
+	}
+	return true;
+}
+
+char *
+fragments_flatten(const char *src, template_lookup_fn lookup, void *data)
+{
+	char          name[256];
+	struct block *blocks  = NULL;
+	size_t        nblocks = 0, cap = 0;
+	struct text   out     = {0};
+	int           depth;
+
+	/*
+	 * The blocks of each template take precedence over the ones of the
+	 * templates it extends, so they are gathered from the child up, and only
+	 * the template at the top of the chain is copied
+	 */
+	for (depth = 0; extends_name(src, name, sizeof name); depth++) {
+		if (depth == MAX_DEPTH || !blocks_scan(src, &blocks, &nblocks, &cap)
+		    || (src = lookup(name, data)) == NULL) {
+			goto fail;
+		}
+	}
+	if (depth == 0
+	    || !blocks_fill(&out, src, src + strlen(src), blocks, nblocks, 0)) {
+		goto fail;
+	}
+	free(blocks);
+
+	return out.str;
+fail:
+	free(blocks);
+	free(out.str);
+	return NULL;
+}
+
+bool
+fragments_split(struct fragments *frags, const char *src, const char *dep,
+                const char *var)
+{
+	struct chunk *chunks  = NULL;
+	size_t        nchunks = 0;
+
+	memset(frags, 0, sizeof *frags);
+	if (!chunks_scan(src, dep, &chunks, &nchunks)) goto fail;
+
+	/* Each fragment takes at most one chunk, and so does its reference */
+	size_t reflen = strlen(var) + 32;
+	frags->tmpl   = malloc(strlen(src) + nchunks * reflen + 1);
+	frags->srcs   = calloc(nchunks + 1, sizeof *frags->srcs);
+	frags->keys   = calloc(nchunks + 1, sizeof *frags->keys);
+	if (frags->tmpl == NULL || frags->srcs == NULL || frags->keys == NULL) {
+		goto fail;
+	}
+
+	char  *out = frags->tmpl;
+	size_t i   = 0;
+	while (i < nchunks) {
+		if (!chunks[i].foldable) {
+			memcpy(out, chunks[i].start, chunks[i].len);
+			out += chunks[i].len;
+			i++;
+			continue;
+		}
+		/* The longest run of foldable chunks */
+		const char *start = chunks[i].start;
+		size_t      len   = 0;
+		bool        tags  = false;
+		for (; i < nchunks && chunks[i].foldable; i++) {
+			len += chunks[i].len;
+			tags |= chunks[i].tags;
+		}
+		if (!tags) {
+			memcpy(out, start, len);
+			out += len;
+			continue;
+		}
+		char key[24];
+		snprintf(key, sizeof key, "f%zu", frags->len);
+		frags->srcs[frags->len] = strndup(start, len);
+		frags->keys[frags->len] = strdup(key);
+		if (frags->srcs[frags->len] == NULL || frags->keys[frags->len] == NULL) {
+			frags->len++;
+			goto fail;
+		}
+		frags->len++;
+		out += sprintf(out, "{{ %s.%s }}", var, key);
+	}
+	*out = '\0';
+	free(chunks);
+
+	if (frags->len == 0) fragments_free(frags);
+	return true;
+fail:
+	free(chunks);
+	fragments_free(frags);
+	return false;
+}
+
+void
+fragments_free(struct fragments *frags)
+{
+	for (size_t i = 0; i < frags->len; i++) {
+		free(frags->srcs[i]);
+		free(frags->keys[i]);
+	}
+	free(frags->srcs);
+	free(frags->keys);
+	free(frags->tmpl);
+	memset(frags, 0, sizeof *frags);
+}
@@ -1,6 +1,7 @@
 #include "fs.h"
 
 #include "log.h"
+#include "compress.h"
 
 #include "vector.h"
 #include "slice.h"
@@ -16,7 +17,9 @@
 #include <strings.h>
 #include <sys/stat.h>
 #ifdef __linux__
+#include <sys/ioctl.h>
 #include <sys/sendfile.h>
+#include <linux/fs.h>
 #endif
 
 #define BUFSIZE 8192
@@ -214,6 +217,12 @@ rmextra(const char *path, struct hmap *preserved, preremove_fn cb,
 		}
 
 		if (hmap_get(preserved, ent->d_name) != NULL) continue;
+		/* Compressed siblings go along with the files they were made from */
+		char stem[NAME_MAX + 1];
+		if (compress_stem(ent->d_name, stem, sizeof stem)
+		    && hmap_get(preserved, stem) != NULL) {
+			continue;
+		}
 
 		char target[PATH_MAX];
 		sprintf(target, "%s/%s", path, ent->d_name);
@@ -380,3 +389,28 @@ dir_error:
 	close(fdsrc);
 	return false;
 }
+
+bool
+fileclone(const char *restrict src, const char *restrict dst)
+{
+#ifdef FICLONE
+	int fdsrc = open(src, O_RDONLY);
+	if (fdsrc < 0) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", src);
+		return false;
+	}
+	int fddst = open(dst, O_CREAT | O_EXCL | O_WRONLY, 0644);
+	if (fddst < 0) {
+		log_printl_errno(LOG_ERROR, "Couldn't create %s", dst);
+		close(fdsrc);
+		return false;
+	}
+	int res = ioctl(fddst, FICLONE, fdsrc);
+	close(fddst);
+	close(fdsrc);
+	if (res == 0) return true;
+	unlink(dst);
+#endif
+	/* Not hard linked, as dst gets a modtime of its own */
+	return filesync(src, dst, NULL, false);
+}
@@ -0,0 +1,142 @@
+#include "hash.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define BUFSIZE 65536
+
+#define PRIME1 0x87c37b91114253d5ULL
+#define PRIME2 0x4cf5ad432745937fULL
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+mixword(uint64_t k)
+{
+	k *= PRIME1;
+	k = rotl64(k, 31);
+	k *= PRIME2;
+	return k;
+}
+
+static inline void
+hash_round(struct hash_state *s, uint64_t k)
+{
+	s->h ^= mixword(k);
+	s->h = rotl64(s->h, 27) * 5 + 0x52dce729;
+}
+
+/* Final avalanche, same as murmur3's fmix64 */
+static inline uint64_t
+fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+void
+hash_init(struct hash_state *s, uint64_t seed)
+{
+	s->h    = seed ^ 0x9e3779b97f4a7c15ULL;
+	s->len  = 0;
+	s->nbuf = 0;
+}
+
+void
+hash_update(struct hash_state *s, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t             k;
+
+	s->len += len;
+	if (s->nbuf > 0) {
+		size_t n = 8 - s->nbuf;
+		if (n > len) n = len;
+		memcpy(s->buf + s->nbuf, p, n);
+		s->nbuf += n;
+		p += n;
+		len -= n;
+		if (s->nbuf < 8) return;
+		memcpy(&k, s->buf, 8);
+		hash_round(s, k);
+		s->nbuf = 0;
+	}
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&k, p, 8);
+		hash_round(s, k);
+	}
+	memcpy(s->buf, p, len);
+	s->nbuf = len;
+}
+
+uint64_t
+hash_final(struct hash_state *s)
+{
+	uint64_t h = s->h;
+	if (s->nbuf > 0) {
+		uint64_t k = 0;
+		for (size_t i = 0; i < s->nbuf; i++) {
+			k |= (uint64_t)s->buf[i] << (8 * i);
+		}
+		h ^= mixword(k);
+	}
+	h ^= s->len;
+	return fmix64(h);
+}
+
+uint64_t
+hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+	struct hash_state s;
+	hash_init(&s, seed);
+	hash_update(&s, data, len);
+	return hash_final(&s);
+}
+
+bool
+hash_file(const char *path, uint64_t *hash)
+{
+	struct hash_state s;
+	unsigned char     buf[BUFSIZE];
+	ssize_t           nread;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", path);
+		return false;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	hash_init(&s, 0);
+	while ((nread = read(fd, buf, BUFSIZE)) > 0) {
+		hash_update(&s, buf, nread);
+	}
+	close(fd);
+	if (nread < 0) {
+		log_printl_errno(LOG_ERROR, "Couldn't read %s", path);
+		return false;
+	}
+
+	*hash = hash_final(&s);
+	return true;
+}
+
+void
+hash_hex(uint64_t hash, char *buf)
+{
+	snprintf(buf, HASH_HEXLEN + 1, "%016llx", (unsigned long long)hash);
+}
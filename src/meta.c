@@ -0,0 +1,248 @@
+#include "meta.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "hash.h"
+
+#define META_MAGIC "revelamd"
+
+/* Bump whenever struct meta_record or the way the metadata is read changes */
+#define META_VERSION 6
+
+struct meta_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t count;
+	/*
+	 * Offsets from UTC in winter and in summer when the file was written;
+	 * the dates in the records are in local time.
+	 */
+	int64_t tzoff[2];
+};
+
+static void
+meta_tzoff(int64_t tzoff[2])
+{
+	struct tm jan = {.tm_year = 100, .tm_mon = 0, .tm_mday = 1, .tm_isdst = -1};
+	struct tm jul = {.tm_year = 100, .tm_mon = 6, .tm_mday = 1, .tm_isdst = -1};
+	/* Seconds since the epoch of both dates in UTC */
+	tzoff[0] = mktime(&jan) - 946684800;
+	tzoff[1] = mktime(&jul) - 962409600;
+}
+
+void
+meta_open(struct meta *meta, const char *path)
+{
+	struct stat        st;
+	struct meta_header hdr;
+	int64_t            tzoff[2];
+
+	memset(meta, 0, sizeof *meta);
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			log_printl_errno(LOG_ERROR, "Couldn't read %s", path);
+		}
+		return;
+	}
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof hdr) goto out;
+	if (read(fd, &hdr, sizeof hdr) != sizeof hdr) goto out;
+
+	meta_tzoff(tzoff);
+	if (memcmp(hdr.magic, META_MAGIC, sizeof hdr.magic)
+	    || hdr.version != META_VERSION
+	    || hdr.record_size != sizeof(struct meta_record)
+	    || hdr.tzoff[0] != tzoff[0] || hdr.tzoff[1] != tzoff[1]
+	    || hdr.count
+	           != ((size_t)st.st_size - sizeof hdr) / sizeof(struct meta_record)) {
+		log_printl(LOG_DEBUG, "Ignoring outdated %s", path);
+		goto out;
+	}
+	if (hdr.count == 0) goto out;
+
+	meta->maplen = st.st_size;
+	meta->map    = mmap(NULL, meta->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (meta->map == MAP_FAILED) {
+		log_printl_errno(LOG_ERROR, "Couldn't map %s", path);
+		meta->map = NULL;
+		goto out;
+	}
+	meta->old  = (const struct meta_record *)((char *)meta->map + sizeof hdr);
+	meta->nold = hdr.count;
+
+out:
+	close(fd);
+}
+
+static uint64_t
+meta_key(const char *relpath)
+{
+	return hash_bytes(relpath, strlen(relpath), META_VERSION);
+}
+
+bool
+meta_lookup(struct meta *meta, const char *relpath, const struct stat *st,
+            struct image_exif *exif, struct meta_thumb *thumb,
+            struct meta_encoding *encoding)
+{
+	uint64_t key = meta_key(relpath);
+	size_t   lo = 0, hi = meta->nold;
+
+	while (lo < hi) {
+		size_t                    mid = lo + (hi - lo) / 2;
+		const struct meta_record *rec = &meta->old[mid];
+		if (rec->key < key) {
+			lo = mid + 1;
+		} else if (rec->key > key) {
+			hi = mid;
+		} else {
+			if (rec->size != st->st_size || rec->mtime_sec != st->st_mtim.tv_sec
+			    || rec->mtime_nsec != st->st_mtim.tv_nsec) {
+				return false;
+			}
+			*exif = rec->exif;
+			*thumb                                   = rec->thumb;
+			thumb->placeholder[PLACEHOLDER_SIZE - 1] = '\0';
+			*encoding                                = rec->encoding;
+			meta->hits++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t
+meta_add(struct meta *meta, const char *relpath, const struct stat *st,
+         const struct image_exif *exif, const struct meta_thumb *thumb,
+         const struct meta_encoding *encoding)
+{
+	if (meta->len == meta->cap) {
+		size_t              cap = meta->cap ? meta->cap * 2 : 256;
+		struct meta_record *records =
+			realloc(meta->records, cap * sizeof *records);
+		if (records == NULL) return SIZE_MAX;
+		meta->records = records;
+		meta->cap     = cap;
+	}
+	struct meta_record *rec = &meta->records[meta->len++];
+	/* Zero the padding too, so that the file is the same between builds */
+	memset(rec, 0, sizeof *rec);
+	rec->key        = meta_key(relpath);
+	rec->size       = st->st_size;
+	rec->mtime_sec  = st->st_mtim.tv_sec;
+	rec->mtime_nsec = st->st_mtim.tv_nsec;
+	memcpy(&rec->exif, exif, sizeof *exif);
+	strncpy(rec->thumb.placeholder, thumb->placeholder, PLACEHOLDER_SIZE - 1);
+	rec->thumb.width  = thumb->width;
+	rec->thumb.height = thumb->height;
+	rec->encoding.key           = encoding->key;
+	rec->encoding.image_quality = encoding->image_quality;
+	rec->encoding.thumb_quality = encoding->thumb_quality;
+	rec->encoding.kind          = encoding->kind;
+	rec->encoding.phash         = encoding->phash;
+	rec->encoding.phashed       = encoding->phashed;
+	return meta->len - 1;
+}
+
+void
+meta_set_thumb(struct meta *meta, size_t index, const struct meta_thumb *thumb)
+{
+	if (index >= meta->len) return;
+	struct meta_record *rec = &meta->records[index];
+	if (!strcmp(rec->thumb.placeholder, thumb->placeholder)
+	    && rec->thumb.width == thumb->width
+	    && rec->thumb.height == thumb->height) {
+		return;
+	}
+	memset(rec->thumb.placeholder, 0, PLACEHOLDER_SIZE);
+	strncpy(rec->thumb.placeholder, thumb->placeholder, PLACEHOLDER_SIZE - 1);
+	rec->thumb.width  = thumb->width;
+	rec->thumb.height = thumb->height;
+	meta->changed     = true;
+}
+
+void
+meta_set_encoding(struct meta *meta, size_t index,
+                  const struct meta_encoding *encoding)
+{
+	if (index >= meta->len) return;
+	struct meta_encoding *enc = &meta->records[index].encoding;
+	if (enc->key == encoding->key
+	    && enc->image_quality == encoding->image_quality
+	    && enc->thumb_quality == encoding->thumb_quality
+	    && enc->kind == encoding->kind && enc->phash == encoding->phash
+	    && enc->phashed == encoding->phashed) {
+		return;
+	}
+	enc->key           = encoding->key;
+	enc->image_quality = encoding->image_quality;
+	enc->thumb_quality = encoding->thumb_quality;
+	enc->kind          = encoding->kind;
+	enc->phash         = encoding->phash;
+	enc->phashed       = encoding->phashed;
+	meta->changed      = true;
+}
+
+static int
+record_cmp(const void *va, const void *vb)
+{
+	const struct meta_record *a = va, *b = vb;
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+bool
+meta_write(struct meta *meta, const char *path)
+{
+	if (meta->hits == meta->len && meta->len == meta->nold && !meta->changed) {
+		return true;
+	}
+
+	char               tmp[PATH_MAX];
+	struct meta_header hdr = {
+		.version     = META_VERSION,
+		.record_size = sizeof(struct meta_record),
+		.count       = meta->len,
+	};
+	memcpy(hdr.magic, META_MAGIC, sizeof hdr.magic);
+	meta_tzoff(hdr.tzoff);
+	qsort(meta->records, meta->len, sizeof *meta->records, record_cmp);
+
+	snprintf(tmp, PATH_MAX, "%s.tmp", path);
+	FILE *f = fopen(tmp, "w");
+	if (f == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", tmp);
+		return false;
+	}
+	if (fwrite(&hdr, sizeof hdr, 1, f) != 1
+	    || fwrite(meta->records, sizeof *meta->records, meta->len, f)
+	           != meta->len) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", tmp);
+		fclose(f);
+		unlink(tmp);
+		return false;
+	}
+	if (fclose(f) || rename(tmp, path)) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", path);
+		unlink(tmp);
+		return false;
+	}
+
+	return true;
+}
+
+void
+meta_close(struct meta *meta)
+{
+	if (meta->map != NULL) munmap(meta->map, meta->maplen);
+	free(meta->records);
+	memset(meta, 0, sizeof *meta);
+}
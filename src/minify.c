@@ -0,0 +1,136 @@
+#include "minify.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+
+/* Elements whose contents are copied as they are */
+static const char *raw_tags[] = {"pre", "textarea", "script", "style"};
+
+#define ISSPACE(c) isspace((unsigned char)(c))
+
+/*
+ * If the tag whose name starts at s is one of raw_tags, returns the length of
+ * its name and sets name to it; returns 0 otherwise.
+ */
+static size_t
+raw_tag(const char *s, const char *end, const char **name)
+{
+	for (size_t i = 0; i < sizeof raw_tags / sizeof *raw_tags; i++) {
+		size_t n = strlen(raw_tags[i]);
+		if ((size_t)(end - s) > n && !strncasecmp(s, raw_tags[i], n)
+		    && (ISSPACE(s[n]) || s[n] == '>' || s[n] == '/')) {
+			*name = raw_tags[i];
+			return n;
+		}
+	}
+	return 0;
+}
+
+/* Finds the closing tag of the raw element name in [s, end) */
+static const char *
+raw_end(const char *s, const char *end, const char *name, size_t n)
+{
+	for (; end - s > (ptrdiff_t)n + 1; s++) {
+		if (s[0] == '<' && s[1] == '/' && !strncasecmp(s + 2, name, n)) {
+			return s;
+		}
+	}
+	return end;
+}
+
+static const char *
+comment_end(const char *s, const char *end)
+{
+	for (; end - s >= 3; s++) {
+		if (s[0] == '-' && s[1] == '-' && s[2] == '>') return s + 3;
+	}
+	return NULL;
+}
+
+/*
+ * Copies the tag starting at in to out, collapsing the whitespace between
+ * attributes, and returns where the tag ends in the input.
+ */
+static const char *
+copy_tag(char **pout, const char *in, const char *end)
+{
+	char *out   = *pout;
+	char  quote = '\0';
+	*out++      = *in++;
+	while (in < end) {
+		char c = *in;
+		if (quote) {
+			if (c == quote) quote = '\0';
+			*out++ = *in++;
+			continue;
+		}
+		if (ISSPACE(c)) {
+			while (in < end && ISSPACE(*in)) in++;
+			*out++ = ' ';
+			continue;
+		}
+		in++;
+		if (c == '"' || c == '\'') {
+			quote = c;
+		} else if (c == '>') {
+			if (out[-1] == ' ') out--;
+			*out++ = c;
+			break;
+		}
+		*out++ = c;
+	}
+	*pout = out;
+	return in;
+}
+
+size_t
+minify_html(char *buf, size_t len)
+{
+	const char *in = buf, *end = buf + len;
+	char       *out = buf;
+
+	while (in < end) {
+		if (ISSPACE(*in)) {
+			bool newline = false;
+			for (; in < end && ISSPACE(*in); in++) {
+				if (*in == '\n') newline = true;
+			}
+			if (out == buf) continue;
+			/* There might be some already if a comment was in between */
+			if (ISSPACE(out[-1])) {
+				if (newline) out[-1] = '\n';
+				continue;
+			}
+			*out++ = newline ? '\n' : ' ';
+			continue;
+		}
+		/* Only tags, comments and doctypes; a lone < is just text */
+		if (*in != '<' || end - in < 2
+		    || !(isalpha((unsigned char)in[1]) || in[1] == '/'
+		         || in[1] == '!')) {
+			*out++ = *in++;
+			continue;
+		}
+		if (end - in >= 5 && !strncmp(in, "<!--", 4) && in[4] != '[') {
+			const char *close = comment_end(in + 4, end);
+			if (close != NULL) {
+				in = close;
+				continue;
+			}
+		}
+
+		const char *name;
+		size_t      n = raw_tag(in + 1, end, &name);
+		in            = copy_tag(&out, in, end);
+		if (n > 0) {
+			const char *close = raw_end(in, end, name, n);
+			memmove(out, in, close - in);
+			out += close - in;
+			in = close;
+		}
+	}
+
+	return out - buf;
+}
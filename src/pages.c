@@ -0,0 +1,134 @@
+#include "pages.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+#include "log.h"
+
+size_t
+pages_count(size_t n, size_t per_page)
+{
+	if (per_page == 0 || n <= per_page) return 1;
+	return (n + per_page - 1) / per_page;
+}
+
+void
+pages_range(size_t n, size_t per_page, size_t page, size_t *start,
+            size_t *end)
+{
+	if (per_page == 0) {
+		*start = 0;
+		*end   = n;
+		return;
+	}
+	*start = (page - 1) * per_page;
+	*end   = *start + per_page < n ? *start + per_page : n;
+}
+
+void
+pages_path(char *buf, const char *dir, size_t page)
+{
+	if (page <= 1) {
+		sprintf(buf, "%s/index.html", dir);
+	} else {
+		sprintf(buf, "%s/" PAGES_DIR "/%zu/index.html", dir, page);
+	}
+}
+
+void
+pages_url(char *buf, size_t size, const char *base, size_t page)
+{
+	if (page <= 1) {
+		snprintf(buf, size, "%s/", base);
+	} else {
+		snprintf(buf, size, "%s/" PAGES_DIR "/%zu/", base, page);
+	}
+}
+
+bool
+pages_mkdir(const char *dir, size_t page, bool dry)
+{
+	char        path[PATH_MAX];
+	struct stat dstat;
+	sprintf(path, "%s/" PAGES_DIR, dir);
+	if (nmkdir(path, &dstat, dry) == NMKDIR_ERROR) return false;
+	sprintf(path, "%s/" PAGES_DIR "/%zu", dir, page);
+	return nmkdir(path, &dstat, dry) != NMKDIR_ERROR;
+}
+
+void
+pages_hashes_read(const char *dir, uint64_t **hashes, size_t *n)
+{
+	char  path[PATH_MAX];
+	int   version;
+	FILE *f;
+
+	*hashes = NULL;
+	*n      = 0;
+	joinpathb(path, dir, PAGES_FILE);
+	if ((f = fopen(path, "r")) == NULL) return;
+	if (fscanf(f, "revela-pages %d %zu\n", &version, n) != 2
+	    || version != PAGES_FILE_VERSION || *n == 0
+	    || (*hashes = calloc(*n, sizeof **hashes)) == NULL) {
+		goto fail;
+	}
+	for (size_t i = 0; i < *n; i++) {
+		if (fscanf(f, "%" SCNx64 "\n", &(*hashes)[i]) != 1) goto fail;
+	}
+	fclose(f);
+	return;
+
+fail:
+	fclose(f);
+	free(*hashes);
+	*hashes = NULL;
+	*n      = 0;
+}
+
+bool
+pages_hashes_write(const char *dir, const uint64_t *hashes, size_t n)
+{
+	char  path[PATH_MAX];
+	FILE *f;
+
+	joinpathb(path, dir, PAGES_FILE);
+	if ((f = fopen(path, "w")) == NULL) goto fail;
+	fprintf(f, "revela-pages %d %zu\n", PAGES_FILE_VERSION, n);
+	for (size_t i = 0; i < n; i++) {
+		fprintf(f, "%016" PRIx64 "\n", hashes[i]);
+	}
+	if (fclose(f)) goto fail;
+
+	return true;
+fail:
+	log_printl_errno(LOG_ERROR, "Couldn't write %s", path);
+	return false;
+}
+
+void
+pages_prune(const char *dir, size_t count, bool dry)
+{
+	char        path[PATH_MAX];
+	struct stat st;
+
+	for (size_t page = count + 1;; page++) {
+		sprintf(path, "%s/" PAGES_DIR "/%zu", dir, page);
+		if (stat(path, &st)) break;
+		if (!rmentry(path, dry)) return;
+	}
+	if (count > 1 || dry) return;
+	joinpathb(path, dir, PAGES_DIR);
+	/* Fails if it's not empty, i.e. if something else was put there */
+	if (rmdir(path) == 0) {
+		log_printl(LOG_DETAIL, "Deleting %s", path);
+	} else if (errno != ENOENT && errno != ENOTDIR && errno != ENOTEMPTY
+	           && errno != EEXIST) {
+		log_printl_errno(LOG_ERROR, "Can't delete %s", path);
+	}
+}
@@ -0,0 +1,113 @@
+#include "phash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Frequencies kept in each direction, from the second lowest */
+#define FREQS 8
+
+#define PI 3.14159265358979323846
+
+/* cos(k * pi / (PHASH_SIZE * 2)), without needing libm for it */
+static double
+dct_cos(unsigned k)
+{
+	double   sign = 1, x, x2, term = 1, sum = 1;
+	unsigned half = PHASH_SIZE * 2;
+
+	k %= half * 2;
+	if (k > half) k = half * 2 - k;
+	if (k > half / 2) {
+		k    = half - k;
+		sign = -1;
+	}
+	x  = k * PI / half;
+	x2 = x * x;
+	/* x is at most pi/2, where the series is exact to double precision */
+	for (unsigned i = 1; i < 12; i++) {
+		term *= -x2 / ((2 * i - 1) * (2 * i));
+		sum += term;
+	}
+	return sign * sum;
+}
+
+static int
+coef_cmp(const void *va, const void *vb)
+{
+	double a = *(const double *)va, b = *(const double *)vb;
+	return (a > b) - (a < b);
+}
+
+/*
+ * The DCT is separable: the rows are transformed first, keeping only the
+ * frequencies that are needed, and then the columns of the result. The inner
+ * loops go over contiguous arrays with no dependencies between iterations, so
+ * that compilers can turn them into vector instructions.
+ */
+uint64_t
+phash(const unsigned char *gray)
+{
+	double basis[FREQS][PHASH_SIZE], rows[FREQS][PHASH_SIZE];
+	double coefs[FREQS * FREQS], sorted[FREQS * FREQS], px[PHASH_SIZE];
+
+	for (unsigned u = 0; u < FREQS; u++) {
+		for (unsigned x = 0; x < PHASH_SIZE; x++) {
+			basis[u][x] = dct_cos((2 * x + 1) * (u + 1));
+		}
+	}
+
+	/* rows[u][y] is frequency u of row y */
+	for (unsigned y = 0; y < PHASH_SIZE; y++) {
+		for (unsigned x = 0; x < PHASH_SIZE; x++) {
+			px[x] = gray[y * PHASH_SIZE + x];
+		}
+		for (unsigned u = 0; u < FREQS; u++) {
+			double sum = 0;
+			for (unsigned x = 0; x < PHASH_SIZE; x++) {
+				sum += px[x] * basis[u][x];
+			}
+			rows[u][y] = sum;
+		}
+	}
+	for (unsigned v = 0; v < FREQS; v++) {
+		for (unsigned u = 0; u < FREQS; u++) {
+			double sum = 0;
+			for (unsigned y = 0; y < PHASH_SIZE; y++) {
+				sum += rows[u][y] * basis[v][y];
+			}
+			coefs[v * FREQS + u] = sum;
+		}
+	}
+
+	memcpy(sorted, coefs, sizeof sorted);
+	qsort(sorted, FREQS * FREQS, sizeof *sorted, coef_cmp);
+	double median = (sorted[FREQS * FREQS / 2 - 1] + sorted[FREQS * FREQS / 2])
+	              / 2;
+
+	uint64_t hash = 0;
+	for (unsigned i = 0; i < FREQS * FREQS; i++) {
+		if (coefs[i] > median) hash |= (uint64_t)1 << i;
+	}
+	return hash;
+}
+
+unsigned
+phash_distance(uint64_t a, uint64_t b)
+{
+	uint64_t x = a ^ b;
+	unsigned n = 0;
+	/* Clears the lowest bit that is set each time */
+	for (; x != 0; n++) {
+		x &= x - 1;
+	}
+	return n;
+}
+
+uint64_t
+phash_band(uint64_t hash, unsigned band)
+{
+	/* The bands are 5 or 6 bits wide */
+	unsigned start = band * 64 / PHASH_BANDS;
+	unsigned end   = (band + 1) * 64 / PHASH_BANDS;
+	return (hash >> start) & ((UINT64_C(1) << (end - start)) - 1);
+}
@@ -0,0 +1,72 @@
+#include "placeholder.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+/*
+ * The pixels are added up 8 bytes at a time: the even and the odd bytes of each
+ * word go into separate accumulators of four 16-bit lanes, which can take
+ * FLUSH_GROUPS bytes of 0xff before they overflow. Three words make a group of
+ * 8 whole pixels, so each lane always adds up the same channel.
+ */
+#define EVEN_BYTES   0x00ff00ff00ff00ffULL
+#define GROUP_PIXELS 8
+#define GROUP_BYTES  (GROUP_PIXELS * 3)
+#define FLUSH_GROUPS 257
+
+/* Adds the lanes of the accumulators to the sums of their channels */
+static void
+lanes_flush(uint64_t acc[6], uint64_t sums[3])
+{
+	const uint16_t one    = 1;
+	bool           little = *(const unsigned char *)&one;
+
+	for (size_t w = 0; w < 3; w++) {
+		for (size_t odd = 0; odd < 2; odd++) {
+			uint64_t lanes = acc[w * 2 + odd];
+			for (size_t j = 0; j < 4; j++) {
+				/* Where the byte of the lane was in memory */
+				size_t k   = j * 2 + odd;
+				size_t pos = w * 8 + (little ? k : 7 - k);
+				sums[pos % 3] += (lanes >> (j * 16)) & 0xffff;
+			}
+			acc[w * 2 + odd] = 0;
+		}
+	}
+}
+
+void
+placeholder_color(const unsigned char *rgb, size_t npixels, char *placeholder)
+{
+	uint64_t sums[3] = {0}, acc[6] = {0};
+	size_t   ngroups = npixels / GROUP_PIXELS;
+
+	placeholder[0] = '\0';
+	if (npixels == 0) return;
+
+	while (ngroups > 0) {
+		size_t n = ngroups < FLUSH_GROUPS ? ngroups : FLUSH_GROUPS;
+		for (size_t g = 0; g < n; g++, rgb += GROUP_BYTES) {
+			for (size_t w = 0; w < 3; w++) {
+				uint64_t word;
+				memcpy(&word, rgb + w * 8, sizeof word);
+				acc[w * 2] += word & EVEN_BYTES;
+				acc[w * 2 + 1] += (word >> 8) & EVEN_BYTES;
+			}
+		}
+		lanes_flush(acc, sums);
+		ngroups -= n;
+	}
+	for (size_t i = 0; i < npixels % GROUP_PIXELS; i++, rgb += 3) {
+		sums[0] += rgb[0];
+		sums[1] += rgb[1];
+		sums[2] += rgb[2];
+	}
+
+	snprintf(placeholder, PLACEHOLDER_SIZE, "#%02x%02x%02x",
+	         (unsigned)((sums[0] + npixels / 2) / npixels),
+	         (unsigned)((sums[1] + npixels / 2) / npixels),
+	         (unsigned)((sums[2] + npixels / 2) / npixels));
+}
@@ -0,0 +1,398 @@
+#include "plan.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Whether the exif hashmap is set at all */
+#define PLAN_EXIF_BIT (1u << PLAN_NSLOTS)
+
+/*
+ * Integer sentinels are printed as 19000000NN, or as -19000000NN in the second
+ * set, so that comparisons with them go different ways in each set
+ */
+#define PLAN_INT_SENTINEL 1900000000
+
+static const char *slot_keys[PLAN_NSLOTS] = {
+	[PLAN_SOURCE]            = "source",
+	[PLAN_DATE]              = "date",
+	[PLAN_PREV]              = "prev",
+	[PLAN_NEXT]              = "next",
+	[PLAN_ZOOM]              = "zoom",
+	[PLAN_FORMAT]            = "format",
+	[PLAN_EXIF_DATE]         = "date",
+	[PLAN_EXIF_CAMERA]       = "camera",
+	[PLAN_EXIF_LENS]         = "lens",
+	[PLAN_EXIF_EXPOSURE]     = "exposure",
+	[PLAN_EXIF_FNUMBER]      = "fnumber",
+	[PLAN_EXIF_FOCAL_LENGTH] = "focal_length",
+	[PLAN_EXIF_LATITUDE]     = "latitude",
+	[PLAN_EXIF_LONGITUDE]    = "longitude",
+	[PLAN_EXIF_ISO]          = "iso",
+	[PLAN_EXIF_ORIENTATION]  = "orientation",
+};
+
+struct plan_segment {
+	/* Static text at the offset in the plan's text */
+	size_t off;
+	size_t len;
+	/* The slot that comes after the text; -1 for the last segment */
+	int slot;
+};
+
+struct plan {
+	uint32_t             shape;
+	char                *text;
+	size_t               textlen;
+	struct plan_segment *segs;
+	size_t               nsegs;
+};
+
+static inline void
+values_set_str(struct plan_values *v, enum plan_slot slot, const char *val)
+{
+	if (val == NULL || val[0] == '\0') return;
+	v->str[slot] = val;
+	v->shape |= 1u << slot;
+}
+
+static inline void
+values_set_num(struct plan_values *v, enum plan_slot slot, int64_t val)
+{
+	if (val <= 0) return;
+	v->num[slot] = val;
+	snprintf(v->numstr[slot], sizeof v->numstr[slot], "%lld", (long long)val);
+	v->shape |= 1u << slot;
+}
+
+void
+plan_values_init(struct plan_values *v, const struct image *image)
+{
+	const struct vector     *images = image->album->images;
+	const struct image_exif *exif   = &image->exif;
+
+	memset(v, 0, sizeof *v);
+	values_set_str(v, PLAN_SOURCE, image->url_image);
+	values_set_str(v, PLAN_DATE, image->datestr);
+	if (image->index > 0) {
+		const struct image *prev = images->values[image->index - 1];
+		values_set_str(v, PLAN_PREV, prev->link);
+	}
+	if (image->index + 1 < images->len) {
+		const struct image *next = images->values[image->index + 1];
+		values_set_str(v, PLAN_NEXT, next->link);
+	}
+	values_set_str(v, PLAN_ZOOM, image->url_zoom);
+	values_set_str(v, PLAN_FORMAT, image->format);
+	if (!exif->present) return;
+
+	v->shape |= PLAN_EXIF_BIT;
+	values_set_str(v, PLAN_EXIF_DATE, exif->datetime);
+	values_set_str(v, PLAN_EXIF_CAMERA, exif->camera);
+	values_set_str(v, PLAN_EXIF_LENS, exif->lens);
+	values_set_str(v, PLAN_EXIF_EXPOSURE, exif->exposure);
+	values_set_str(v, PLAN_EXIF_FNUMBER, exif->fnumber);
+	values_set_str(v, PLAN_EXIF_FOCAL_LENGTH, exif->focal_length);
+	values_set_str(v, PLAN_EXIF_LATITUDE, exif->latitude);
+	values_set_str(v, PLAN_EXIF_LONGITUDE, exif->longitude);
+	values_set_num(v, PLAN_EXIF_ISO, exif->iso);
+	values_set_num(v, PLAN_EXIF_ORIENTATION, exif->orientation);
+}
+
+void
+plan_values_sentinels(struct plan_values *sentinels,
+                      const struct plan_values *v, int set)
+{
+	memset(sentinels, 0, sizeof *sentinels);
+	sentinels->shape = v->shape;
+	for (int i = 0; i < PLAN_NSLOTS; i++) {
+		if (!(v->shape & (1u << i))) continue;
+		if (i >= PLAN_FIRST_INT) {
+			sentinels->num[i] = PLAN_INT_SENTINEL + i;
+			if (set != 0) sentinels->num[i] = -sentinels->num[i];
+			snprintf(sentinels->numstr[i], sizeof sentinels->numstr[i],
+			         "%lld", (long long)sentinels->num[i]);
+		} else {
+			/* The text of string sentinels is kept in numstr too */
+			snprintf(sentinels->numstr[i], sizeof sentinels->numstr[i],
+			         set == 0 ? "@@revela:%02d@@" : "@@REVELA-%02d-ALT@@", i);
+			sentinels->str[i] = sentinels->numstr[i];
+		}
+	}
+}
+
+static inline const char *
+values_text(const struct plan_values *v, int slot)
+{
+	return slot >= PLAN_FIRST_INT ? v->numstr[slot] : v->str[slot];
+}
+
+static void
+map_set_slot(struct roscha_object *map, const struct plan_values *v, int slot)
+{
+	if (!(v->shape & (1u << slot))) return;
+	if (slot >= PLAN_FIRST_INT) {
+		roscha_hmap_set_new(map, slot_keys[slot], (v->num[slot]));
+	} else {
+		roscha_hmap_set_new(map, slot_keys[slot],
+		                    (slice_whole((char *)v->str[slot])));
+	}
+}
+
+struct roscha_object *
+plan_values_map(const struct plan_values *v)
+{
+	struct roscha_object *map = roscha_object_new(hmap_new_with_cap(8));
+	int                   i;
+
+	for (i = 0; i < PLAN_EXIF_DATE; i++) {
+		map_set_slot(map, v, i);
+	}
+	if (v->shape & PLAN_EXIF_BIT) {
+		struct roscha_object *exif = roscha_object_new(hmap_new_with_cap(16));
+		for (; i < PLAN_NSLOTS; i++) {
+			map_set_slot(exif, v, i);
+		}
+		roscha_hmap_set(map, "exif", exif);
+		roscha_object_unref(exif);
+	}
+
+	return map;
+}
+
+bool
+plan_values_safe(const struct plan_values *v)
+{
+	for (int i = 0; i < PLAN_FIRST_INT; i++) {
+		if (!(v->shape & (1u << i))) continue;
+		if (strpbrk(v->str[i], "<>&\"'") != NULL) return false;
+	}
+	return true;
+}
+
+static inline bool
+is_ident(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+static inline const char *
+skip_space(const char *p, const char *end)
+{
+	while (p < end && isspace((unsigned char)*p)) p++;
+	return p;
+}
+
+/* Whether the identifier image appears between start and end */
+static bool
+mentions_image(const char *start, const char *end)
+{
+	for (const char *p = start; p + 5 <= end; p++) {
+		if (strncmp(p, "image", 5) != 0) continue;
+		if ((p == start || !is_ident(p[-1]))
+		    && (p + 5 == end || !is_ident(p[5]))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Whether the text between start and end is just an image var, e.g. image.x */
+static bool
+is_image_var(const char *start, const char *end)
+{
+	start = skip_space(start, end);
+	while (end > start && isspace((unsigned char)end[-1])) end--;
+	if (end - start <= 5 || strncmp(start, "image", 5) != 0) return false;
+	for (const char *p = start + 5; p < end;) {
+		if (*p != '.' || p + 1 == end || !is_ident(p[1])) return false;
+		for (p++; p < end && is_ident(*p); p++)
+			;
+	}
+	return true;
+}
+
+/* The condition of the if or elif statement between start and end, or NULL */
+static const char *
+condition(const char *start, const char *end)
+{
+	start    = skip_space(start, end);
+	size_t n = end - start > 2 && !strncmp(start, "if", 2)     ? 2
+	         : end - start > 4 && !strncmp(start, "elif", 4) ? 4
+	                                                           : 0;
+	if (n == 0 || !isspace((unsigned char)start[n])) return NULL;
+	return start + n;
+}
+
+bool
+plan_template_safe(const char *src)
+{
+	const char *p = src;
+	while ((p = strchr(p, '{')) != NULL) {
+		if (p[1] != '{' && p[1] != '%') {
+			p++;
+			continue;
+		}
+		bool        expr  = p[1] == '{';
+		const char *start = p + 2;
+		const char *end   = strstr(start, expr ? "}}" : "%}");
+		if (end == NULL) return false;
+		p = end + 2;
+		if (*start == '-') start++;
+		if (end > start && end[-1] == '-') end--;
+		if (!mentions_image(start, end)) continue;
+
+		/* Values may only be output as they are, and statements may only check
+		 * whether they are set */
+		if (!expr) {
+			if ((start = condition(start, end)) == NULL) return false;
+			start = skip_space(start, end);
+			if (end - start > 4 && !strncmp(start, "not", 3)
+			    && isspace((unsigned char)start[3])) {
+				start += 4;
+			}
+		}
+		if (!is_image_var(start, end)) return false;
+	}
+	return true;
+}
+
+bool
+plan_equal(const struct plan *a, const struct plan *b)
+{
+	if (a->shape != b->shape || a->nsegs != b->nsegs) return false;
+	for (size_t i = 0; i < a->nsegs; i++) {
+		const struct plan_segment *sa = &a->segs[i], *sb = &b->segs[i];
+		if (sa->slot != sb->slot || sa->len != sb->len
+		    || memcmp(a->text + sa->off, b->text + sb->off, sa->len)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct plan *
+plan_compile(const char *output, size_t len, const struct plan_values *sentinels)
+{
+	struct plan *plan = calloc(1, sizeof *plan);
+	if (plan == NULL) return NULL;
+	/* The text of the plan is at most as long as the output */
+	plan->text  = malloc(len + 1);
+	plan->shape = sentinels->shape;
+	size_t cap  = 16;
+	plan->segs  = malloc(cap * sizeof *plan->segs);
+	if (plan->text == NULL || plan->segs == NULL) goto fail;
+
+	const char *pos = output, *end = output + len;
+	for (;;) {
+		/* The next sentinel of any of the slots that are set */
+		const char *found = NULL;
+		int         slot  = -1;
+		for (int i = 0; i < PLAN_NSLOTS; i++) {
+			if (!(sentinels->shape & (1u << i))) continue;
+			const char *at = strstr(pos, values_text(sentinels, i));
+			if (at != NULL && at < end && (found == NULL || at < found)) {
+				found = at;
+				slot  = i;
+			}
+		}
+
+		if (plan->nsegs == cap) {
+			cap *= 2;
+			struct plan_segment *segs =
+				realloc(plan->segs, cap * sizeof *plan->segs);
+			if (segs == NULL) goto fail;
+			plan->segs = segs;
+		}
+		struct plan_segment *seg = &plan->segs[plan->nsegs++];
+		seg->off                 = plan->textlen;
+		seg->len                 = (found != NULL ? found : end) - pos;
+		seg->slot                = slot;
+		memcpy(plan->text + plan->textlen, pos, seg->len);
+		plan->textlen += seg->len;
+
+		if (found == NULL) break;
+		pos = found + strlen(values_text(sentinels, slot));
+	}
+
+	return plan;
+fail:
+	plan_free(plan);
+	return NULL;
+}
+
+uint32_t
+plan_shape(const struct plan *plan)
+{
+	return plan->shape;
+}
+
+size_t
+plan_render(const struct plan *plan, const struct plan_values *v, char **buf,
+            size_t *cap)
+{
+	size_t i, len = plan->textlen;
+	for (i = 0; i < plan->nsegs; i++) {
+		if (plan->segs[i].slot >= 0) {
+			len += strlen(values_text(v, plan->segs[i].slot));
+		}
+	}
+	if (len + 1 > *cap) {
+		size_t ncap = len + 1 > *cap * 2 ? len + 1 : *cap * 2;
+		char  *nbuf = realloc(*buf, ncap);
+		if (nbuf == NULL) return 0;
+		*buf = nbuf;
+		*cap = ncap;
+	}
+
+	char *out = *buf;
+	for (i = 0; i < plan->nsegs; i++) {
+		const struct plan_segment *seg = &plan->segs[i];
+		memcpy(out, plan->text + seg->off, seg->len);
+		out += seg->len;
+		if (seg->slot < 0) continue;
+		const char *val  = values_text(v, seg->slot);
+		size_t      vlen = strlen(val);
+		memcpy(out, val, vlen);
+		out += vlen;
+	}
+	*out = '\0';
+
+	return len;
+}
+
+size_t
+plan_iov(const struct plan *plan, const struct plan_values *v,
+         struct iovec *iov, size_t cap)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < plan->nsegs; i++) {
+		const struct plan_segment *seg = &plan->segs[i];
+		if (seg->len > 0) {
+			if (n < cap) {
+				iov[n].iov_base = plan->text + seg->off;
+				iov[n].iov_len  = seg->len;
+			}
+			n++;
+		}
+		if (seg->slot < 0) continue;
+		const char *val = values_text(v, seg->slot);
+		if (n < cap) {
+			iov[n].iov_base = (char *)val;
+			iov[n].iov_len  = strlen(val);
+		}
+		n++;
+	}
+
+	return n;
+}
+
+void
+plan_free(struct plan *plan)
+{
+	if (plan == NULL) return;
+	free(plan->text);
+	free(plan->segs);
+	free(plan);
+}
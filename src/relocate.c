@@ -0,0 +1,462 @@
+#include "relocate.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "log.h"
+#include "assets.h"
+#include "zoom.h"
+
+static const char *manifest_header = "# revela-files 1";
+
+static void
+fingerprint_key(uint64_t hash, off_t size, char *buf)
+{
+	sprintf(buf, "%016llx-%lld", (unsigned long long)hash, (long long)size);
+}
+
+struct manifest *
+manifest_read(const char *slug)
+{
+	char path[PATH_MAX];
+	joinpathb(path, slug, MANIFEST_FILE);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		if (errno != ENOENT && errno != ENOTDIR) {
+			log_printl_errno(LOG_ERROR, "Couldn't read %s", path);
+		}
+		return NULL;
+	}
+
+	struct manifest *m = calloc(1, sizeof *m);
+	if (m == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		fclose(f);
+		return NULL;
+	}
+	m->slug    = strdup(slug);
+	m->entries = hmap_new();
+	m->list    = vector_new();
+
+	char   *line = NULL;
+	size_t  cap  = 0;
+	ssize_t len;
+	while ((len = getline(&line, &cap, f)) > 0) {
+		unsigned long long hash;
+		long long          size, sec;
+		long               nsec;
+		int                off = 0;
+
+		if (line[len - 1] == '\n') line[--len] = '\0';
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%llx %lld %lld.%ld %n", &hash, &size, &sec, &nsec,
+		           &off)
+		        != 4
+		    || line[off] == '\0') {
+			log_printl(LOG_ERROR, "Warning: ignoring bad line in %s", path);
+			continue;
+		}
+
+		struct manifest_entry *e = calloc(1, sizeof *e);
+		if (e == NULL || (e->basename = strdup(line + off)) == NULL) {
+			log_printl_errno(LOG_FATAL, "Memory allocation error");
+			free(e);
+			free(line);
+			fclose(f);
+			manifest_destroy(m);
+			return NULL;
+		}
+		e->manifest        = m;
+		e->size            = size;
+		e->modtime.tv_sec  = sec;
+		e->modtime.tv_nsec = nsec;
+		e->hash            = hash;
+		fingerprint_key(e->hash, e->size, e->key);
+		hmap_set(m->entries, e->basename, e);
+		vector_push(m->list, e);
+	}
+
+	free(line);
+	fclose(f);
+	return m;
+}
+
+bool
+image_fingerprint(struct image *image, const struct manifest *m)
+{
+	if (image->hashed) return true;
+	if (m != NULL) {
+		struct manifest_entry *e = hmap_get(m->entries, image->basename);
+		if (e != NULL && e->size == image->size
+		    && TIMEQUAL(e->modtime, image->modtime)) {
+			image->hash   = e->hash;
+			image->hashed = true;
+			return true;
+		}
+	}
+	if (!hash_file(image->source, &image->hash)) return false;
+	image->hashed = true;
+	return true;
+}
+
+bool
+manifest_write(struct album *album, bool dry)
+{
+	const struct manifest *old   = album->manifest;
+	bool                   stale = old == NULL
+	             || old->list->len != album->images->len;
+	size_t        i;
+	struct image *image;
+
+	if (dry) return true;
+
+	vector_foreach (album->images, i, image) {
+		if (!image_fingerprint(image, old)) return false;
+		if (stale) continue;
+		struct manifest_entry *e = hmap_get(old->entries, image->basename);
+		if (e == NULL || e->hash != image->hash || e->size != image->size
+		    || !TIMEQUAL(e->modtime, image->modtime)) {
+			stale = true;
+		}
+	}
+	if (!stale) return true;
+
+	char path[PATH_MAX];
+	joinpathb(path, album->slug, MANIFEST_FILE);
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", path);
+		return false;
+	}
+	fprintf(f, "%s\n", manifest_header);
+	vector_foreach (album->images, i, image) {
+		fprintf(f, "%016llx %lld %lld.%09ld %s\n",
+		        (unsigned long long)image->hash, (long long)image->size,
+		        (long long)image->modtime.tv_sec, image->modtime.tv_nsec,
+		        image->basename);
+	}
+	if (fclose(f)) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", path);
+		return false;
+	}
+
+	return true;
+}
+
+void
+manifest_destroy(struct manifest *m)
+{
+	size_t                 i;
+	struct manifest_entry *e;
+	vector_foreach (m->list, i, e) {
+		free(e->basename);
+		free(e);
+	}
+	vector_free(m->list);
+	hmap_free(m->entries);
+	free(m->slug);
+	free(m);
+}
+
+static void
+move_file(const char *from, const char *to, const struct timespec *mtim)
+{
+	if (renameat(AT_FDCWD, from, AT_FDCWD, to)) {
+		if (errno != ENOENT) {
+			log_printl_errno(LOG_ERROR, "Couldn't move %s to %s", from, to);
+		}
+		return;
+	}
+	/*
+	 * The contents are the same, only the timestamps of the source might have
+	 * changed if it was copied instead of moved.
+	 */
+	setdatetime(to, mtim);
+}
+
+static bool
+move_album(struct manifest *m, struct album *album, bool dry)
+{
+	log_printl(LOG_DETAIL, "Moving %s to %s", m->slug, album->slug);
+	if (!dry && renameat(AT_FDCWD, m->slug, AT_FDCWD, album->slug)) {
+		log_printl_errno(LOG_FATAL, "Couldn't move %s to %s", m->slug,
+		                 album->slug);
+		return false;
+	}
+	/* All the pages link to the old album url, so re-render them */
+	album->config_updated = true;
+	free(m->slug);
+	m->slug         = strdup(album->slug);
+	m->orphan       = false;
+	album->manifest = m;
+
+	return true;
+}
+
+/*
+ * Sets the paths that the outputs of the entry would have if they had been made
+ * with the current settings, in the format with the extension outext, or that
+ * of the source if it is NULL; see image_paths().
+ */
+static bool
+entry_paths(struct image_paths *paths, const struct site_config *conf,
+            const struct manifest_entry *e, const char *outext)
+{
+	char tag[ASSETS_TAG_LEN + 1];
+	if (!conf->output.hash_names) {
+		return image_paths(paths, conf->albums.layout, e->manifest->slug,
+		                   e->basename, NULL, outext);
+	}
+	const char *ext = strrchr(e->basename, '.');
+	if (ext == NULL) return false;
+	image_tag(conf, e->size, &e->modtime, ext, tag);
+	return image_paths(paths, conf->albums.layout, e->manifest->slug,
+	                   e->basename, tag, outext);
+}
+
+static bool
+move_image(struct manifest_entry *e, struct image *image, struct hmap *dsts,
+           bool dry)
+{
+	const struct site_config *conf   = image->album->site->config;
+	enum image_layout         layout = conf->albums.layout;
+	struct image_paths        old;
+	struct stat               st, dstat;
+
+	/* The same pixels, so the same format was chosen for them */
+	if (!entry_paths(&old, conf, e, image->out_ext)) return true;
+	/* Don't steal the outputs of an image that is still there */
+	if (hmap_get(dsts, old.image) != NULL) return true;
+	if (stat(old.image, &st) || !S_ISREG(st.st_mode)) return true;
+
+	log_printl(LOG_DETAIL, "Moving %s to %s", old.image, image->dst_image);
+	e->moved = true;
+	if (dry) return true;
+
+	if (stat(old.dir, &dstat)) return true;
+	if (nmkdir(image->album->slug, &st, false) == NMKDIR_ERROR) return false;
+	if (nmkdir(image->dst, &st, false) == NMKDIR_ERROR) return false;
+
+	move_file(old.image, image->dst_image, &image->modtime);
+	move_file(old.thumb, image->dst_thumb, &image->modtime);
+	/* Only a complete pyramid, and not over another one; see zoom_make() */
+	if (image->url_zoom != NULL && access(image->dst_tiles, F_OK) != 0
+	    && zoom_uptodate(&conf->zoom, old.zoom, &e->modtime) == 1) {
+		move_file(old.tiles, image->dst_tiles, &image->modtime);
+		move_file(old.zoom, image->dst_zoom, &image->modtime);
+	}
+
+	/*
+	 * prerm_imagedir() relies on the modtime of the old dir to find the pages
+	 * of its neighbours that need to be updated once it is removed.
+	 */
+	if (layout == LAYOUT_NESTED) setdatetime(old.dir, &dstat.st_mtim);
+
+	return true;
+}
+
+/*
+ * Adds the entries of the manifest whose optimized images don't belong to any
+ * of the images in dsts to orphans. If dsts is NULL, all of the entries are
+ * added. Returns the number of entries added.
+ */
+static size_t
+orphans_add(struct hmap *orphans, struct manifest *m, struct hmap *dsts,
+            const struct site_config *conf)
+{
+	size_t                 i, n = 0;
+	struct manifest_entry *e;
+	vector_foreach (m->list, i, e) {
+		struct image_paths paths;
+		if (dsts != NULL) {
+			/*
+			 * Images in another format than their source's are added too,
+			 * but move_image() won't take the outputs of images still there
+			 */
+			if (!entry_paths(&paths, conf, e, NULL)) continue;
+			if (hmap_get(dsts, paths.image) != NULL) continue;
+		}
+		if (hmap_get(orphans, e->key) != NULL) continue;
+		hmap_set(orphans, e->key, e);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Loads the manifests from the dirs in the output dir. If only_orphans is set,
+ * the dirs that belong to the albums in slugs are skipped.
+ */
+static void
+manifests_load(struct site *site, struct hmap *slugs, bool only_orphans)
+{
+	DIR           *dir = opendir(".");
+	struct dirent *ent;
+	if (dir == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", site->output_dir);
+		return;
+	}
+
+	while ((ent = readdir(dir))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+		struct album *album = hmap_get(slugs, ent->d_name);
+		if (album != NULL && only_orphans) continue;
+
+		struct manifest *m = manifest_read(ent->d_name);
+		if (m == NULL) continue;
+		m->shared = true;
+		m->orphan = album == NULL;
+		if (album != NULL) album->manifest = m;
+		vector_push(site->manifests, m);
+	}
+
+	closedir(dir);
+}
+
+static bool
+relocate_images(struct site *site, struct album *album, struct hmap *dsts,
+                struct hmap **orphans, size_t norphans)
+{
+	size_t        i;
+	struct image *image;
+
+	vector_foreach (album->images, i, image) {
+		char                   key[HASH_HEXLEN + 24];
+		struct manifest_entry *e = NULL;
+		if (access(image->dst_image, F_OK) == 0) continue;
+		/* Unreadable sources will be reported when converting them */
+		if (!image_fingerprint(image, NULL)) continue;
+
+		fingerprint_key(image->hash, image->size, key);
+		for (size_t j = 0; j < norphans && e == NULL; j++) {
+			e = hmap_get(orphans[j], key);
+		}
+		if (e == NULL || e->moved) continue;
+		/*
+		 * In streaming mode the images of the other albums aren't known, so
+		 * only take outputs from dirs that don't belong to any album.
+		 */
+		if (site->streaming && !e->manifest->orphan
+		    && e->manifest != album->manifest) {
+			continue;
+		}
+
+		/*
+		 * If the old album dir doesn't belong to any current album and the
+		 * new one doesn't exist yet, the album was most likely renamed or
+		 * moved, so move the whole dir instead of image by image.
+		 */
+		if (e->manifest->orphan && access(album->slug, F_OK) != 0) {
+			if (!move_album(e->manifest, album, site->dry_run)) return false;
+			if (site->dry_run || access(image->dst_image, F_OK) == 0) {
+				e->moved = true;
+				continue;
+			}
+		}
+
+		if (!move_image(e, image, dsts, site->dry_run)) return false;
+	}
+
+	return true;
+}
+
+bool
+relocate(struct site *site)
+{
+	bool             ok      = true;
+	struct hmap     *slugs   = hmap_new();
+	struct hmap     *dsts    = hmap_new();
+	struct hmap     *orphans = hmap_new();
+	size_t           i, j, norphans = 0;
+	struct album    *album;
+	struct image    *image;
+	struct manifest *m;
+
+	vector_foreach (site->albums, i, album) {
+		hmap_set(slugs, album->slug, album);
+		vector_foreach (album->images, j, image) {
+			hmap_set(dsts, image->dst_image, image);
+		}
+	}
+
+	manifests_load(site, slugs, false);
+	vector_foreach (site->manifests, i, m) {
+		norphans += orphans_add(orphans, m, dsts, site->config);
+	}
+	if (norphans == 0) goto out;
+
+	vector_foreach (site->albums, i, album) {
+		ok = relocate_images(site, album, dsts, &orphans, 1);
+		if (!ok) break;
+	}
+
+out:
+	hmap_free(orphans);
+	hmap_free(dsts);
+	hmap_free(slugs);
+	return ok;
+}
+
+bool
+relocate_init(struct site *site)
+{
+	struct hmap     *slugs = hmap_new();
+	size_t           i;
+	struct album    *album;
+	struct manifest *m;
+
+	vector_foreach (site->albums, i, album) {
+		hmap_set(slugs, album->slug, album);
+	}
+	manifests_load(site, slugs, true);
+	site->orphans = hmap_new();
+	vector_foreach (site->manifests, i, m) {
+		orphans_add(site->orphans, m, NULL, site->config);
+	}
+
+	hmap_free(slugs);
+	return true;
+}
+
+bool
+relocate_album(struct site *site, struct album *album)
+{
+	struct hmap  *dsts      = hmap_new();
+	struct hmap  *own       = hmap_new();
+	struct hmap  *orphans[] = {own, site->orphans};
+	size_t        i, n = 0;
+	struct image *image;
+	bool          ok = true;
+
+	vector_foreach (album->images, i, image) {
+		hmap_set(dsts, image->dst_image, image);
+	}
+	album->manifest = manifest_read(album->slug);
+	if (album->manifest != NULL) {
+		n = orphans_add(own, album->manifest, dsts, site->config);
+	}
+	if (n > 0 || site->manifests->len > 0) {
+		ok = relocate_images(site, album, dsts, orphans, 2);
+	}
+
+	hmap_free(own);
+	hmap_free(dsts);
+	return ok;
+}
+
+void
+relocate_album_done(struct album *album)
+{
+	if (album->manifest != NULL && !album->manifest->shared) {
+		manifest_destroy(album->manifest);
+	}
+	album->manifest = NULL;
+}
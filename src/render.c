@@ -1,41 +1,54 @@
 #include "render.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <dirent.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "fs.h"
 #include "log.h"
+#include "hash.h"
+#include "plan.h"
 #include "site.h"
+#include "pages.h"
+#include "compress.h"
 
-static void
-images_walk(struct vector *images)
-{
-	size_t        i;
-	struct image *image;
-	size_t        last = images->len - 1;
-
-	vector_foreach (images, i, image) {
-		roscha_hmap_set_new(image->map, "source",
-		                    (slice_whole(image->url_image)));
-		roscha_hmap_set_new(image->map, "date", (slice_whole(image->datestr)));
-		char *url;
-		if (i > 0) {
-			struct image *prev = images->values[i - 1];
-			url                = prev->url;
-			roscha_hmap_set_new(image->map, "prev", (slice_whole(url)));
-		}
-		if (i < last) {
-			struct image *next = images->values[i + 1];
-			url                = next->url;
-			roscha_hmap_set_new(image->map, "next", (slice_whole(url)));
-		}
+#define INDEX_TMPL "index.html"
+#define ALBUM_TMPL "album.html"
+#define IMAGE_TMPL "image.html"
+/* The image template with its fragments replaced by their outputs */
+#define FRAGMENTS_TMPL "revela:image.html"
+/* hmap with the outputs of the fragments for the current album */
+#define FRAGMENTS_VAR "fragments"
 
-		roscha_hmap_set_new(image->thumb, "link", (slice_whole(image->url)));
-		roscha_hmap_set_new(image->thumb, "source",
-		                    (slice_whole(image->url_thumb)));
+#define image_tmpl(w) ((w)->fragments ? FRAGMENTS_TMPL : IMAGE_TMPL)
 
-		roscha_vector_push(image->album->thumbs, image->thumb);
+/* sprite and cell are the atlas of the thumbnail, if any, see sprite.h */
+static void
+thumbs_push(struct roscha_object *thumbs, const char *link, const char *source,
+            const char *placeholder, const char *sprite,
+            const struct sprite_cell *cell)
+{
+	struct roscha_object *thumb = roscha_object_new(hmap_new_with_cap(8));
+	roscha_hmap_set_new(thumb, "link", (slice_whole((char *)link)));
+	roscha_hmap_set_new(thumb, "source", (slice_whole((char *)source)));
+	if (placeholder != NULL && placeholder[0] != '\0') {
+		roscha_hmap_set_new(thumb, "placeholder",
+		                    (slice_whole((char *)placeholder)));
+	}
+	if (sprite != NULL) {
+		roscha_hmap_set_new(thumb, "sprite", (slice_whole((char *)sprite)));
+		roscha_hmap_set_new(thumb, "x", ((int64_t)cell->x));
+		roscha_hmap_set_new(thumb, "y", ((int64_t)cell->y));
+		roscha_hmap_set_new(thumb, "w", ((int64_t)cell->w));
+		roscha_hmap_set_new(thumb, "h", ((int64_t)cell->h));
 	}
+	roscha_vector_push(thumbs, thumb);
+	roscha_object_unref(thumb);
 }
 
 static inline void
@@ -52,12 +65,13 @@ years_push_new_year(struct roscha_object *years, char *yearstr,
 }
 
 static void
-years_push_album(struct roscha_object *years, struct album *album)
+years_push_album(struct roscha_object *years, struct album *album,
+                 struct roscha_object *map)
 {
 	struct roscha_object *year;
 	struct roscha_object *albums;
 	if (years->vector->len == 0) {
-		years_push_new_year(years, album->year, &years, &albums);
+		years_push_new_year(years, album->year, &year, &albums);
 	} else {
 		year                          = years->vector->values[years->vector->len - 1];
 		struct roscha_object *yearval = roscha_hmap_get(year, "name");
@@ -67,123 +81,1182 @@ years_push_album(struct roscha_object *years, struct album *album)
 			albums = roscha_hmap_get(year, "albums");
 		}
 	}
-	roscha_vector_push(albums, album->map);
+	roscha_vector_push(albums, map);
 }
 
-bool
-render_set_album_vars(struct render *r, struct album *album)
+static void
+album_set_common_vars(struct roscha_object *map, const struct album *album)
 {
 	if (album->config->title) {
-		roscha_hmap_set_new(album->map, "title",
-		                    (slice_whole(album->config->title)));
+		roscha_hmap_set_new(map, "title", (slice_whole(album->config->title)));
 	}
 	if (album->config->desc) {
-		roscha_hmap_set_new(album->map, "desc",
-		                    (slice_whole(album->config->desc)));
+		roscha_hmap_set_new(map, "desc", (slice_whole(album->config->desc)));
+	}
+	roscha_hmap_set_new(map, "link", (slice_whole(album->url)));
+	roscha_hmap_set_new(map, "date", (slice_whole(album->datestr)));
+	roscha_hmap_set_new(map, "year", (slice_whole(album->year)));
+	if (album->site->config->albums.viewer) {
+		roscha_hmap_set_new(map, "viewer", ((bool)true));
+	}
+}
+
+/*
+ * Lightweight hashmap for the album to be used in the index, with only the
+ * first few thumbs, either from its images or, if they were already released,
+ * from its previews.
+ */
+static struct roscha_object *
+album_summary_map(const struct render *r, const struct album *album)
+{
+	size_t                i, n;
+	struct roscha_object *map = roscha_object_new(hmap_new_with_cap(8));
+	struct roscha_object *thumbs;
+
+	album_set_common_vars(map, album);
+	if (album->images->len == 0) {
+		n      = album->npreviews;
+		thumbs = roscha_object_new(vector_new_with_cap(n));
+		for (i = 0; i < n; i++) {
+			thumbs_push(thumbs, album->previews[i].link,
+			            album->previews[i].source,
+			            album->previews[i].placeholder, NULL, NULL);
+		}
+	} else {
+		n      = r->npreviews < album->images->len ? r->npreviews
+		                                           : album->images->len;
+		thumbs = roscha_object_new(vector_new_with_cap(n));
+		for (i = 0; i < n; i++) {
+			struct image *image = album->images->values[i];
+			thumbs_push(thumbs, image->link, image->url_thumb,
+			            image->thumb.placeholder, NULL, NULL);
+		}
+	}
+	roscha_hmap_set(map, "thumbs", thumbs);
+	roscha_hmap_set(map, "previews", thumbs);
+	roscha_object_unref(thumbs);
+
+	return map;
+}
+
+/* Hashes a string, telling NULL apart from an empty string */
+static inline uint64_t
+hash_str(const char *str, uint64_t seed)
+{
+	return str == NULL ? hash_bytes("", 0, seed)
+	                   : hash_bytes(str, strlen(str) + 1, seed);
+}
+
+static uint64_t
+album_common_hash(const struct album *album, uint64_t h)
+{
+	h = hash_str(album->config->title, h);
+	h = hash_str(album->config->desc, h);
+	h = hash_str(album->url, h);
+	h = hash_str(album->datestr, h);
+	h = hash_str(album->year, h);
+	return hash_bytes(&album->site->config->albums.viewer,
+	                  sizeof album->site->config->albums.viewer, h);
+}
+
+/* Hash of the vars of the album in the index; see album_summary_map() */
+static uint64_t
+album_summary_hash(const struct render *r, const struct album *album,
+                   uint64_t h)
+{
+	size_t i, n;
+	h = album_common_hash(album, h);
+	if (album->images->len == 0) {
+		for (i = 0; i < album->npreviews; i++) {
+			h = hash_str(album->previews[i].link, h);
+			h = hash_str(album->previews[i].source, h);
+			h = hash_str(album->previews[i].placeholder, h);
+		}
+		return h;
+	}
+	n = r->npreviews < album->images->len ? r->npreviews : album->images->len;
+	for (i = 0; i < n; i++) {
+		const struct image *image = album->images->values[i];
+		h = hash_str(image->link, h);
+		h = hash_str(image->url_thumb, h);
+		h = hash_str(image->thumb.placeholder, h);
+	}
+	return h;
+}
+
+/* Hash of the vars of an album page; see render_album_page() */
+static uint64_t
+album_page_hash(const struct render *r, const struct album *album, size_t page,
+                size_t count)
+{
+	size_t   i, start, end;
+	uint64_t h = hash_bytes(&count, sizeof count, page);
+
+	h = hash_bytes(&r->minify, sizeof r->minify, h);
+	h = album_common_hash(album, h);
+	pages_range(album->images->len, r->conf->albums.per_page, page, &start,
+	            &end);
+	for (i = start; i < end; i++) {
+		const struct image *image = album->images->values[i];
+		h = hash_str(image->link, h);
+		h = hash_str(image->url_thumb, h);
+		h = hash_str(image->thumb.placeholder, h);
+		if (image->sprite != NULL) {
+			h = hash_str(image->sprite, h);
+			h = hash_bytes(&image->cell, sizeof image->cell, h);
+		}
+	}
+	return h;
+}
+
+/* Links to the previous and next pages, which must outlive the page map */
+struct page_links {
+	char prev[PATH_MAX];
+	char next[PATH_MAX];
+};
+
+/* The "page" hashmap for a page of a listing at base */
+static struct roscha_object *
+page_map(const char *base, size_t page, size_t count, struct page_links *links)
+{
+	struct roscha_object *map = roscha_object_new(hmap_new_with_cap(8));
+	roscha_hmap_set_new(map, "number", ((int64_t)page));
+	roscha_hmap_set_new(map, "count", ((int64_t)count));
+	if (page > 1) {
+		pages_url(links->prev, sizeof links->prev, base, page - 1);
+		roscha_hmap_set_new(map, "prev", (slice_whole(links->prev)));
+	}
+	if (page < count) {
+		pages_url(links->next, sizeof links->next, base, page + 1);
+		roscha_hmap_set_new(map, "next", (slice_whole(links->next)));
 	}
-	roscha_hmap_set_new(album->map, "link", (slice_whole(album->url)));
-	roscha_hmap_set_new(album->map, "date", (slice_whole(album->datestr)));
-	roscha_hmap_set_new(album->map, "year", (slice_whole(album->year)));
+	return map;
+}
 
-	images_walk(album->images);
+/*
+ * Whether the page at path needs to be rendered, given the hash of its vars
+ * and the hashes of the previous build. -1 on error.
+ */
+static int
+page_outdated(const struct render *r, const char *path, size_t page,
+              uint64_t hash, const uint64_t *old, size_t nold)
+{
+	if (page > nold || old[page - 1] != hash) return 1;
+	int isupdate = render_is_uptodate(r, path);
+	if (isupdate == -1) return -1;
+	return !isupdate;
+}
 
-	roscha_hmap_set(album->map, "thumbs", album->thumbs);
+/*
+ * Writes the hashes of the pages of the listing in dir if they changed, and
+ * removes the pages that are no longer needed.
+ */
+static void
+pages_finish(const struct render *r, const char *dir, const uint64_t *hashes,
+             size_t count, const uint64_t *old, size_t nold)
+{
+	if (!r->dry_run
+	    && (nold != count || memcmp(old, hashes, count * sizeof *hashes))) {
+		pages_hashes_write(dir, hashes, count);
+	}
+	pages_prune(dir, count, r->dry_run);
+}
 
-	years_push_album(r->years, album);
-	roscha_vector_push(r->albums, album->map);
+/* The plan for image pages of some shape; NULL if they can't be compiled */
+struct worker_plan {
+	uint32_t     shape;
+	struct plan *plan;
+};
 
+static void
+worker_plans_clear(struct render_worker *w)
+{
+	size_t              i;
+	struct worker_plan *wp;
+	if (w->plans == NULL) return;
+	vector_foreach (w->plans, i, wp) {
+		plan_free(wp->plan);
+		free(wp);
+	}
+	w->plans->len = 0;
+}
+
+static void
+worker_fragments_clear(struct render_worker *w)
+{
+	if (w->fragouts == NULL) return;
+	for (size_t i = 0; i < w->r->fragments.len; i++) {
+		sdsfree(w->fragouts[i]);
+	}
+	free(w->fragouts);
+	w->fragouts = NULL;
+}
+
+/* Renders the fragments of the image template for the current album */
+static void
+worker_fragments_render(struct render_worker *w)
+{
+	const struct fragments *frags = &w->r->fragments;
+	struct roscha_object   *map;
+	sds                    *outs;
+
+	if (!w->fragments) return;
+	outs = calloc(frags->len, sizeof *outs);
+	if (outs == NULL) {
+		w->fragments = false;
+		return;
+	}
+	map = roscha_object_new(hmap_new_with_cap(frags->len));
+	for (size_t i = 0; i < frags->len; i++) {
+		char name[64];
+		snprintf(name, sizeof name, FRAGMENTS_TMPL ":%s", frags->keys[i]);
+		outs[i] = roscha_env_render(w->env, name);
+		roscha_hmap_set_new(map, frags->keys[i], (slice_whole(outs[i])));
+	}
+	roscha_object_unref(roscha_hmap_set(w->env->vars, FRAGMENTS_VAR, map));
+	roscha_object_unref(map);
+	/* The previous outputs are no longer referenced by the vars */
+	worker_fragments_clear(w);
+	w->fragouts          = outs;
+	w->fragments_checked = false;
+}
+
+/*
+ * Builds the vars of the album, which are used by both the album template and
+ * the image template, and makes them the current "album" var of the worker.
+ * They are built only once a page of the album is actually rendered.
+ */
+static void
+album_materialize(struct render_worker *w, struct album *album)
+{
+	if (w->album == album) return;
+
+	size_t                i;
+	struct image         *image;
+	struct roscha_object *map    = roscha_object_new(hmap_new_with_cap(8));
+	struct roscha_object *thumbs = roscha_object_new(
+		vector_new_with_cap(album->images->len));
+
+	album_set_common_vars(map, album);
 	/*
-	 * The common vars for the images in this album; used by both the album
-	 * template and the image template.
+	 * The placeholders and the sprites are left out, as they might still be
+	 * being made by the main thread while the image pages are rendered
 	 */
-	roscha_object_unref(roscha_hmap_set(r->env->vars, "album", album->map));
+	vector_foreach (album->images, i, image) {
+		thumbs_push(thumbs, image->link, image->url_thumb, NULL, NULL, NULL);
+	}
+	roscha_hmap_set(map, "thumbs", thumbs);
+	roscha_object_unref(thumbs);
+
+	roscha_object_unref(roscha_hmap_set(w->env->vars, "album", map));
+	if (w->album_map != NULL) roscha_object_unref(w->album_map);
+	w->album_map = map;
+	w->album     = album;
+	/* The plans have the vars of the previous album baked in */
+	worker_plans_clear(w);
+	worker_fragments_render(w);
+}
+
+void
+render_unset_album_vars(struct render *r)
+{
+	if (r->dry_run) return;
+	for (size_t i = 0; i < r->nworkers; i++) {
+		struct render_worker *w = &r->workers[i];
+		if (w->album == NULL) continue;
+		roscha_hmap_unset(w->env->vars, "album");
+		roscha_object_unref(w->album_map);
+		w->album_map = NULL;
+		w->album     = NULL;
+		worker_plans_clear(w);
+		if (w->fragouts != NULL) {
+			roscha_hmap_unset(w->env->vars, FRAGMENTS_VAR);
+			worker_fragments_clear(w);
+		}
+	}
+}
+
+/*
+ * Writes the page along with its compressed siblings, which get the modtime
+ * that the page will have once rendered.
+ */
+static bool
+render_write(const struct render *r, const char *opath, struct iovec *iov,
+             size_t iovcnt)
+{
+	if (!compress_iov(opath, iov, iovcnt, &r->modtime)) return false;
+	int fd = open(opath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) goto fail;
+	while (iovcnt > 0) {
+		ssize_t n = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			close(fd);
+			goto fail;
+		}
+		/* Skip what was written, which might end in the middle of a piece */
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	if (close(fd)) goto fail;
 
 	return true;
+fail:
+	log_printl_errno(LOG_FATAL, "Can't write %s", opath);
+	/* So that what was written isn't taken as up to date by the next build */
+	unlink(opath);
+	return false;
+}
+
+/* Minifies the page in buf if enabled, returning its new length */
+static size_t
+page_minify(const struct render *r, struct minify_stats *stats, char *buf,
+            size_t len)
+{
+	if (!r->minify) return len;
+	size_t n = minify_html(buf, len);
+	stats->pages++;
+	stats->in += len;
+	stats->out += n;
+	return n;
 }
 
 static bool
-render(struct roscha_env *env, const char *tmpl, const char *opath)
+render(const struct render *r, struct roscha_env *env, const char *tmpl,
+       const char *opath, struct minify_stats *stats)
+{
+	sds          output = roscha_env_render(env, tmpl);
+	struct iovec iov    = {
+		.iov_base = output,
+		.iov_len  = page_minify(r, stats, output, sdslen(output)),
+	};
+	bool ok = render_write(r, opath, &iov, 1);
+	sdsfree(output);
+	return ok;
+}
+
+static sds
+render_image_vars(struct render_worker *w, const char *tmpl,
+                  const struct plan_values *values)
+{
+	struct roscha_env    *env = w->env;
+	struct roscha_object *map = plan_values_map(values);
+	roscha_hmap_set(env->vars, "image", map);
+	sds output = roscha_env_render(env, tmpl);
+	roscha_hmap_unset(env->vars, "image");
+	roscha_object_unref(map);
+	return output;
+}
+
+static inline double
+elapsed(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Renders the first image page of each album with both the image template and
+ * the one with fragments, and stops using fragments if the pages differ.
+ */
+static void
+worker_fragments_check(struct render_worker *w, const struct plan_values *values)
 {
-	bool   ok     = true;
-	sds    output = roscha_env_render(env, tmpl);
-	size_t outlen = strlen(output);
-	FILE  *f      = fopen(opath, "w");
-	if (fwrite(output, 1, outlen, f) != outlen) {
-		ok = false;
-		log_printl_errno(LOG_FATAL, "Can't write %s", opath);
+	w->fragments_checked = true;
+	if (!w->fragments) return;
+
+	sds  want = render_image_vars(w, IMAGE_TMPL, values);
+	sds  got  = render_image_vars(w, FRAGMENTS_TMPL, values);
+	bool same = sdslen(want) == sdslen(got) && !memcmp(want, got, sdslen(got));
+	if (!same) {
+		log_printl(LOG_DEBUG, "Not using fragments of " IMAGE_TMPL);
+		w->fragments = false;
 	}
-	fclose(f);
+	sdsfree(want);
+	sdsfree(got);
+}
+
+/* Compiles the page with one of the sets of sentinels; see plan.h */
+static struct plan *
+worker_plan_probe(struct render_worker *w, const struct plan_values *values,
+                  int set)
+{
+	struct plan_values sentinels;
+	plan_values_sentinels(&sentinels, values, set);
+	sds          probe = render_image_vars(w, image_tmpl(w), &sentinels);
+	struct plan *plan  = plan_compile(probe, sdslen(probe), &sentinels);
+	sdsfree(probe);
+	return plan;
+}
+
+/*
+ * Finds the plan for pages of the same shape as values in the current album,
+ * compiling it if there's none yet. The shape is marked as not compilable if
+ * the two sets of sentinels give different plans, i.e. the template branches
+ * on or transforms the values. The first page of each shape is rendered by the
+ * interpreter too, and the same goes if the outputs differ; output is set to
+ * the interpreter's output in that case.
+ */
+static struct plan *
+worker_plan(struct render_worker *w, const struct plan_values *values,
+            sds *output)
+{
+	size_t              i;
+	struct worker_plan *wp;
+
+	if (w->plans == NULL) w->plans = vector_new_with_cap(8);
+	vector_foreach (w->plans, i, wp) {
+		if (wp->shape == values->shape) return wp->plan;
+	}
+	wp = malloc(sizeof *wp);
+	if (wp == NULL) return NULL;
+	wp->shape = values->shape;
+
+	wp->plan         = worker_plan_probe(w, values, 0);
+	struct plan *alt = worker_plan_probe(w, values, 1);
+	if (wp->plan != NULL && (alt == NULL || !plan_equal(wp->plan, alt))) {
+		log_printl(LOG_DEBUG,
+		           "image.html can't be compiled for pages of shape %x, it "
+		           "depends on the values of the image vars",
+		           (unsigned)values->shape);
+		plan_free(wp->plan);
+		wp->plan = NULL;
+	}
+	plan_free(alt);
+
+	*output = render_image_vars(w, image_tmpl(w), values);
+	if (wp->plan != NULL) {
+		size_t len = plan_render(wp->plan, values, &w->buf, &w->bufcap);
+		if (len != sdslen(*output) || memcmp(w->buf, *output, len)) {
+			log_printl(LOG_DEBUG,
+			           "image.html can't be compiled for pages of shape %x",
+			           (unsigned)values->shape);
+			plan_free(wp->plan);
+			wp->plan = NULL;
+		}
+	}
+	vector_push(w->plans, wp);
+	return NULL;
+}
+
+/* Points the worker's iov at the pieces of the page, growing it as needed */
+static bool
+worker_iov(struct render_worker *w, const struct plan *plan,
+           const struct plan_values *values)
+{
+	size_t n = plan_iov(plan, values, w->iov, w->iovcap);
+	if (n > w->iovcap) {
+		struct iovec *iov = realloc(w->iov, n * sizeof *iov);
+		if (iov == NULL) return false;
+		w->iov    = iov;
+		w->iovcap = n;
+		plan_iov(plan, values, w->iov, w->iovcap);
+	}
+	w->iovlen = n;
+	return true;
+}
+
+static bool
+render_image(struct render_worker *w, const struct render_job *job)
+{
+	struct plan_values values;
+	struct timespec    start;
+	struct plan       *plan   = NULL;
+	sds                output = NULL;
+	bool               ok;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	plan_values_init(&values, job->image);
+	if (!w->fragments_checked) worker_fragments_check(w, &values);
+	if (w->r->compile && plan_values_safe(&values)) {
+		plan = worker_plan(w, &values, &output);
+	}
+	if (plan != NULL && w->r->minify) {
+		/* Minifying needs the whole page in a buffer of its own */
+		size_t len = plan_render(plan, &values, &w->buf, &w->bufcap);
+		if (len > 0) {
+			struct iovec iov = {
+				.iov_base = w->buf,
+				.iov_len  = page_minify(w->r, &w->minified[PAGE_IMAGE], w->buf,
+				                        len),
+			};
+			ok = render_write(w->r, job->path, &iov, 1);
+			w->tplanned += elapsed(&start);
+			w->nplanned++;
+			return ok;
+		}
+	} else if (plan != NULL && worker_iov(w, plan, &values)) {
+		ok = render_write(w->r, job->path, w->iov, w->iovlen);
+		w->tplanned += elapsed(&start);
+		w->nplanned++;
+		return ok;
+	}
+
+	if (output == NULL) output = render_image_vars(w, image_tmpl(w), &values);
+	struct iovec iov = {
+		.iov_base = output,
+		.iov_len  = page_minify(w->r, &w->minified[PAGE_IMAGE], output,
+		                        sdslen(output)),
+	};
+	ok = render_write(w->r, job->path, &iov, 1);
 	sdsfree(output);
+	w->tinterpreted += elapsed(&start);
+	w->ninterpreted++;
 	return ok;
 }
 
+/*
+ * Adds the image template with fragments and the fragments themselves to the
+ * worker's environment, which takes ownership of the names and sources.
+ */
+static void
+worker_fragments_load(struct render_worker *w)
+{
+	const struct fragments *frags = &w->r->fragments;
+
+	if (frags->len == 0) return;
+	for (size_t i = 0; i < frags->len; i++) {
+		char name[64];
+		snprintf(name, sizeof name, FRAGMENTS_TMPL ":%s", frags->keys[i]);
+		if (!roscha_env_add_template(w->env, strdup(name),
+		                             strdup(frags->srcs[i]))) {
+			log_printl(LOG_DEBUG, "Not using fragments of " IMAGE_TMPL);
+			return;
+		}
+	}
+	if (!roscha_env_add_template(w->env, strdup(FRAGMENTS_TMPL),
+	                             strdup(frags->tmpl))) {
+		log_printl(LOG_DEBUG, "Not using fragments of " IMAGE_TMPL);
+		return;
+	}
+	w->fragments = true;
+	/* The album might have been set for one of its album pages already */
+	if (w->album != NULL) worker_fragments_render(w);
+}
+
+/* Sets the asset var, with the url of each static file by its path */
+static void
+worker_assets_load(struct render_worker *w)
+{
+	const struct assets  *assets = &w->r->assets;
+	struct roscha_object *map;
+	size_t                i;
+	struct asset         *asset;
+
+	map = roscha_object_new(hmap_new_with_cap(assets->list->len));
+	vector_foreach (assets->list, i, asset) {
+		roscha_hmap_set_new(map, asset->path, (slice_whole(asset->url)));
+	}
+	roscha_object_unref(roscha_hmap_set(w->env->vars, "asset", map));
+	roscha_object_unref(map);
+}
+
+/*
+ * Sets up the worker's environment the first time the worker needs it. The
+ * templates are parsed later on, by worker_template(), so that builds with
+ * nothing to render don't parse them at all.
+ */
+static struct roscha_env *
+render_worker_env(struct render_worker *w)
+{
+	if (w->env != NULL) return w->env;
+
+	struct render *r = w->r;
+	w->loaded        = calloc(r->ntemplates + 1, sizeof *w->loaded);
+	if (w->loaded == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return NULL;
+	}
+	w->env = roscha_env_new();
+	roscha_hmap_set_new(w->env->vars, "title", (slice_whole(r->conf->title)));
+	roscha_hmap_set_new(w->env->vars, "index",
+	                    (slice_whole(r->conf->base_url)));
+	worker_assets_load(w);
+
+	return w->env;
+}
+
+/*
+ * Parses the template into the worker's environment if it wasn't already,
+ * along with the ones that it extends or includes, since roscha only looks
+ * those up by their name when rendering. Templates that aren't in the
+ * templates dir are left for roscha to report.
+ */
+static bool
+worker_template(struct render_worker *w, const char *name)
+{
+	const struct render *r = w->r;
+	size_t               i;
+
+	for (i = 0; i < r->ntemplates; i++) {
+		if (!strcmp(r->templates[i].name, name)) break;
+	}
+	if (i == r->ntemplates || w->loaded[i]) return true;
+
+	const char *src = r->templates[i].src;
+	if (!roscha_env_add_template(w->env, strdup(name), strdup(src))) {
+		struct vector *errors = roscha_env_check_errors(w->env);
+		log_printl(LOG_FATAL, "Couldn't initialize template engine: %s",
+		           errors->values[0]);
+		return false;
+	}
+	w->loaded[i] = true;
+
+	for (const char *p = src; (p = strstr(p, "{%")) != NULL; p += 2) {
+		char dep[NAME_MAX + 1];
+		if ((sscanf(p, "{%% extends \"%255[^\"]\"", dep) == 1
+		     || sscanf(p, "{%% include \"%255[^\"]\"", dep) == 1)
+		    && !worker_template(w, dep)) {
+			return false;
+		}
+	}
+	if (!strcmp(name, IMAGE_TMPL)) worker_fragments_load(w);
+
+	return true;
+}
+
+/*
+ * Renders an album page. When the album has more than one page, the thumbs of
+ * the album map are swapped with the ones of the page while rendering it.
+ */
+static bool
+render_album_page(struct render_worker *w, const struct render_job *job)
+{
+	struct album         *album    = job->album;
+	size_t                per_page = w->r->conf->albums.per_page;
+	size_t                count    = pages_count(album->images->len, per_page);
+	struct roscha_object *thumbs, *all, *page;
+	struct page_links     links;
+	size_t                i, start, end;
+	bool                  ok;
+
+	/*
+	 * The album pages are rendered after all of the images were made, so unlike
+	 * the ones in the album vars, these thumbs have their placeholders and
+	 * sprites
+	 */
+	pages_range(album->images->len, per_page, job->page, &start, &end);
+	thumbs = roscha_object_new(vector_new_with_cap(end - start));
+	for (i = start; i < end; i++) {
+		struct image *image = album->images->values[i];
+		thumbs_push(thumbs, image->link, image->url_thumb,
+		            image->thumb.placeholder, image->sprite, &image->cell);
+	}
+	all  = roscha_hmap_set(w->album_map, "thumbs", thumbs);
+	page = page_map(album->url, job->page, count, &links);
+	roscha_hmap_set(w->env->vars, "page", page);
+	ok = render(w->r, w->env, ALBUM_TMPL, job->path,
+	            &w->minified[PAGE_ALBUM]);
+	roscha_hmap_unset(w->env->vars, "page");
+	roscha_object_unref(page);
+	/* The image pages of the album still need all of the thumbs */
+	roscha_object_unref(roscha_hmap_set(w->album_map, "thumbs", all));
+	roscha_object_unref(all);
+	roscha_object_unref(thumbs);
+
+	return ok;
+}
+
+static bool
+render_job_run(struct render_worker *w, struct render_job *job)
+{
+	bool ok;
+
+	if (render_worker_env(w) == NULL
+	    || !worker_template(w, job->image != NULL ? IMAGE_TMPL : ALBUM_TMPL)) {
+		free(job->path);
+		return false;
+	}
+	album_materialize(w, job->album);
+	if (job->image == NULL) {
+		ok = render_album_page(w, job);
+	} else {
+		ok = render_image(w, job);
+	}
+	/* Pages that failed are left without the modtime of the templates, so
+	 * that they are rendered again by the next build */
+	if (ok) setdatetime(job->path, &w->r->modtime);
+	if (!ok && job->listing != NULL) job->listing->hashes[job->page - 1] = 0;
+	if (ok && job->image != NULL
+	    && job->album->site->config->albums.layout == LAYOUT_NESTED) {
+		/* Creating the page changed the modtime of the image dir, which is
+		 * used to know where removed images used to be */
+		struct timespec ddate = {.tv_sec = job->image->tstamp, .tv_nsec = 0};
+		setdatetime(job->image->dst, &ddate);
+	}
+
+	free(job->path);
+	return ok;
+}
+
+static void *
+render_worker_loop(void *data)
+{
+	struct render_worker *w = data;
+	struct render_queue  *q = &w->r->queue;
+
+	pthread_mutex_lock(&q->lock);
+	for (;;) {
+		while (q->len == 0 && !q->stop) {
+			pthread_cond_wait(&q->ready, &q->lock);
+		}
+		if (q->len == 0) break;
+		struct render_job job = q->jobs[q->head];
+		q->head               = (q->head + 1) % q->cap;
+		q->len--;
+		q->busy++;
+		pthread_mutex_unlock(&q->lock);
+
+		bool ok = render_job_run(w, &job);
+
+		pthread_mutex_lock(&q->lock);
+		q->busy--;
+		if (!ok) q->failed = true;
+		pthread_cond_broadcast(&q->done);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+static bool
+render_submit(struct render *r, const char *path, struct album *album,
+              const struct image *image, size_t page, struct listing *listing)
+{
+	struct render_queue *q   = &r->queue;
+	struct render_job    job = {
+		.path    = strdup(path),
+		.album   = album,
+		.image   = image,
+		.page    = page,
+		.listing = listing,
+	};
+	if (r->nworkers == 1) return render_job_run(&r->workers[0], &job);
+
+	pthread_mutex_lock(&q->lock);
+	while (q->len == q->cap) {
+		pthread_cond_wait(&q->done, &q->lock);
+	}
+	q->jobs[(q->head + q->len) % q->cap] = job;
+	q->len++;
+	pthread_cond_signal(&q->ready);
+	bool ok = !q->failed;
+	pthread_mutex_unlock(&q->lock);
+
+	return ok;
+}
+
+/*
+ * Frees the listings, writing their hashes first if write is set. Only to be
+ * called once the workers are done with them.
+ */
+static void
+listings_clear(struct render *r, bool write)
+{
+	size_t          i;
+	struct listing *listing;
+	vector_foreach (r->listings, i, listing) {
+		bool changed = listing->changed;
+		for (size_t k = 0; k < listing->count; k++) {
+			if (listing->hashes[k] == 0) changed = true;
+		}
+		if (write && changed) {
+			pages_hashes_write(listing->dir, listing->hashes, listing->count);
+		}
+		free(listing->dir);
+		free(listing->hashes);
+		free(listing);
+	}
+	r->listings->len = 0;
+}
+
 bool
-render_make_index(struct render *r, const char *path)
+render_wait(struct render *r)
 {
-	bool ok = true;
-	if (r->albums_updated == 0) {
-		int isupdate = file_is_uptodate(path, &r->modtime);
-		if (isupdate == -1) return false;
-		if (isupdate == 1) return true;
+	struct render_queue *q  = &r->queue;
+	bool                 ok = true;
+	if (r->dry_run) return true;
+
+	if (r->nworkers > 1) {
+		pthread_mutex_lock(&q->lock);
+		while (q->len > 0 || q->busy > 0) {
+			pthread_cond_wait(&q->done, &q->lock);
+		}
+		ok = !q->failed;
+		pthread_mutex_unlock(&q->lock);
 	}
+	listings_clear(r, true);
 
-	log_printl(LOG_INFO, "Rendering %s", path);
+	return ok;
+}
 
-	if (r->dry_run) goto done;
+/*
+ * Renders a page of the index out of n albums. year is only set for the index
+ * of a year.
+ */
+static bool
+render_index_page(struct render *r, const char *path, struct album **albums,
+                  size_t n, const char *base, size_t page, size_t count,
+                  const char *year)
+{
+	size_t                i;
+	struct roscha_env    *env = r->workers[0].env;
+	struct page_links     links;
+	struct roscha_object *years = roscha_object_new(vector_new_with_cap(8));
+	struct roscha_object *all   = roscha_object_new(vector_new_with_cap(n));
+	struct roscha_object *pmap  = page_map(base, page, count, &links);
+	bool                  ok;
+
+	for (i = 0; i < n; i++) {
+		struct roscha_object *map = album_summary_map(r, albums[i]);
+		years_push_album(years, albums[i], map);
+		roscha_vector_push(all, map);
+		roscha_object_unref(map);
+	}
+	if (year != NULL) {
+		roscha_hmap_set_new(pmap, "year", (slice_whole((char *)year)));
+	}
 
-	roscha_hmap_set(r->env->vars, "years", r->years);
-	roscha_hmap_set(r->env->vars, "albums", r->albums);
-	ok = render(r->env, "index.html", path);
-	roscha_hmap_unset(r->env->vars, "years");
-	roscha_hmap_unset(r->env->vars, "albums");
+	roscha_hmap_set(env->vars, "years", years);
+	roscha_hmap_set(env->vars, "albums", all);
+	roscha_hmap_set(env->vars, "page", pmap);
+	ok = render(r, env, INDEX_TMPL, path,
+	            &r->workers[0].minified[PAGE_INDEX]);
+	roscha_hmap_unset(env->vars, "years");
+	roscha_hmap_unset(env->vars, "albums");
+	roscha_hmap_unset(env->vars, "page");
+	roscha_object_unref(years);
+	roscha_object_unref(all);
+	roscha_object_unref(pmap);
 
-	setdatetime(path, &r->modtime);
-done:
+	if (ok) setdatetime(path, &r->modtime);
 	return ok;
 }
 
+/* Renders the pages of the index of n albums in dir that changed */
+static bool
+render_index_pages(struct render *r, const char *dir, struct album **albums,
+                   size_t n, const char *base, const char *year)
+{
+	char      path[PATH_MAX];
+	uint64_t *old, *hashes;
+	size_t    nold, start, end, i;
+	size_t    per_page = r->conf->index.per_page;
+	size_t    count    = pages_count(n, per_page);
+	bool      ok       = true;
+
+	if ((hashes = calloc(count, sizeof *hashes)) == NULL) return false;
+	pages_hashes_read(dir, &old, &nold);
+	for (size_t page = 1; page <= count; page++) {
+		uint64_t h = hash_bytes(&count, sizeof count, page);
+		h          = hash_bytes(&r->minify, sizeof r->minify, h);
+		h          = hash_str(year, h);
+		pages_range(n, per_page, page, &start, &end);
+		for (i = start; i < end; i++) {
+			h = album_summary_hash(r, albums[i], h);
+		}
+		hashes[page - 1] = h;
+
+		pages_path(path, dir, page);
+		int outdated = page_outdated(r, path, page, h, old, nold);
+		if (outdated == -1) goto fail;
+		if (!outdated) continue;
+
+		log_printl(LOG_INFO, "Rendering %s", path);
+		if (page > 1 && !pages_mkdir(dir, page, r->dry_run)) goto fail;
+		if (r->dry_run) continue;
+		/* The index is rendered with the first worker's environment, which
+		 * isn't in use anymore; see render_make_index() */
+		if (render_worker_env(&r->workers[0]) == NULL
+		    || !worker_template(&r->workers[0], INDEX_TMPL)) {
+			goto fail;
+		}
+		if (!render_index_page(r, path, albums + start, end - start, base,
+		                       page, count, year)) {
+			goto fail;
+		}
+	}
+	pages_finish(r, dir, hashes, count, old, nold);
+
+out:
+	free(old);
+	free(hashes);
+	return ok;
+fail:
+	ok = false;
+	goto out;
+}
+
 bool
-render_make_album(struct render *r, const char *path, const struct album *album)
+render_make_index(struct render *r, const char *dir,
+                  const struct vector *albums)
 {
-	bool ok = true;
-	if (album->images_updated == 0 && !album->config_updated) {
-		int isupdate = file_is_uptodate(path, &r->modtime);
-		if (isupdate == -1) return false;
-		if (isupdate == 1) return true;
+	struct album **values = (struct album **)albums->values;
+	char           ydir[PATH_MAX], ybase[PATH_MAX];
+	struct stat    dstat;
+	struct hmap   *years;
+	size_t         i, start;
+
+	/* The workers might still be rendering with the first environment */
+	if (!r->dry_run && !render_wait(r)) return false;
+	if (!render_index_pages(r, dir, values, albums->len, r->conf->base_url,
+	                        NULL)) {
+		return false;
 	}
+	if (!r->conf->index.years) return true;
 
-	log_printl(LOG_INFO, "Rendering %s", path);
+	/* The albums are sorted by date, so the albums of each year are together */
+	joinpathb(ydir, dir, YEARS_DIR);
+	if (nmkdir(ydir, &dstat, r->dry_run) == NMKDIR_ERROR) return false;
+	years = hmap_new();
+	for (start = 0; start < albums->len; start = i) {
+		const char *year = values[start]->year;
+		for (i = start + 1; i < albums->len; i++) {
+			if (strcmp(values[i]->year, year)) break;
+		}
+		hmap_set(years, year, (char *)year);
+		sprintf(ydir, "%s/" YEARS_DIR "/%s", dir, year);
+		snprintf(ybase, sizeof ybase, "%s/" YEARS_DIR "/%s",
+		         r->conf->base_url, year);
+		if (nmkdir(ydir, &dstat, r->dry_run) == NMKDIR_ERROR
+		    || !render_index_pages(r, ydir, values + start, i - start, ybase,
+		                           year)) {
+			hmap_free(years);
+			return false;
+		}
+	}
+	joinpathb(ydir, dir, YEARS_DIR);
+	if (rmextra(ydir, years, NULL, NULL, r->dry_run) < 0) {
+		log_printl_errno(LOG_ERROR,
+		                 "Something happened while deleting extraneous files");
+	}
+	hmap_free(years);
 
-	if (r->dry_run) goto done;
+	return true;
+}
 
-	ok = render(r->env, "album.html", path);
+bool
+render_make_album(struct render *r, const char *dir, struct album *album)
+{
+	char            path[PATH_MAX];
+	uint64_t       *old, *hashes;
+	size_t          nold, page;
+	size_t          per_page = r->conf->albums.per_page;
+	size_t          count    = pages_count(album->images->len, per_page);
+	struct listing *listing  = NULL;
+	bool            ok       = true;
 
-	setdatetime(path, &r->modtime);
-done:
+	if ((hashes = calloc(count, sizeof *hashes)) == NULL) return false;
+	if (!r->dry_run) {
+		/* The jobs of the pages clear their hashes if they fail */
+		if ((listing = malloc(sizeof *listing)) == NULL
+		    || (listing->dir = strdup(dir)) == NULL) {
+			free(listing);
+			free(hashes);
+			return false;
+		}
+		listing->hashes = hashes;
+		listing->count  = count;
+		vector_push(r->listings, listing);
+	}
+	pages_hashes_read(dir, &old, &nold);
+	if (listing != NULL) listing->changed = nold != count;
+	for (page = 1; page <= count; page++) {
+		hashes[page - 1] = album_page_hash(r, album, page, count);
+		if (listing != NULL && page <= nold
+		    && old[page - 1] != hashes[page - 1]) {
+			listing->changed = true;
+		}
+		pages_path(path, dir, page);
+		int outdated = page_outdated(r, path, page, hashes[page - 1], old,
+		                             nold);
+		if (outdated == -1) goto fail;
+		if (!outdated) continue;
+
+		log_printl(LOG_INFO, "Rendering %s", path);
+		if (page > 1 && !pages_mkdir(dir, page, r->dry_run)) goto fail;
+		if (r->dry_run) continue;
+		/* The page is queued even if an earlier one failed */
+		if (!render_submit(r, path, album, NULL, page, listing)) {
+			page++;
+			goto fail;
+		}
+	}
+	pages_prune(dir, count, r->dry_run);
+
+out:
+	free(old);
+	if (listing == NULL) free(hashes);
 	return ok;
+fail:
+	/* The pages that weren't handed to the workers weren't rendered */
+	for (; listing != NULL && page <= count; page++) {
+		hashes[page - 1] = 0;
+	}
+	ok = false;
+	goto out;
+}
+
+int
+render_is_uptodate(const struct render *r, const char *path)
+{
+	int res = file_is_uptodate(path, &r->modtime);
+	if (res != 1) return res;
+	return compress_uptodate(path, &r->modtime);
 }
 
 bool
 render_make_image(struct render *r, const char *path, const struct image *image)
 {
-	bool ok = true;
-
 	log_printl(LOG_INFO, "Rendering %s", path);
 
-	if (r->dry_run) goto done;
+	if (r->dry_run) return true;
 
-	roscha_hmap_set(r->env->vars, "image", image->map);
-	ok = render(r->env, "image.html", path);
-	roscha_hmap_unset(r->env->vars, "image");
+	return render_submit(r, path, image->album, image, 0, NULL);
+}
 
-	setdatetime(path, &r->modtime);
-done:
-	return ok;
+/* Reads the whole file at path into a null terminated string */
+static char *
+file_read(const char *path)
+{
+	struct stat st;
+	char       *src = NULL;
+	FILE       *f   = fopen(path, "r");
+	if (f == NULL) return NULL;
+	if (fstat(fileno(f), &st) || (src = malloc(st.st_size + 1)) == NULL
+	    || fread(src, 1, st.st_size, f) != (size_t)st.st_size) {
+		free(src);
+		fclose(f);
+		return NULL;
+	}
+	src[st.st_size] = '\0';
+	fclose(f);
+	return src;
+}
+
+/*
+ * Reads the templates, and hashes their names and contents in no particular
+ * order.
+ */
+static bool
+templates_read(struct render *r, uint64_t *hash)
+{
+	DIR *dir = opendir(r->tmplpath);
+	if (dir == NULL) {
+		log_printl_errno(LOG_FATAL, "Unable to read templates dir");
+		return false;
+	}
+
+	struct dirent *ent;
+	size_t         cap = 0;
+	*hash              = TEMPLATES_STAMP_VERSION;
+	while ((ent = readdir(dir))) {
+		char        path[PATH_MAX];
+		struct stat st;
+		joinpathb(path, r->tmplpath, ent->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) continue;
+		if (r->ntemplates == cap) {
+			cap = cap ? cap * 2 : 8;
+			struct template_src *tmpls =
+				realloc(r->templates, cap * sizeof *tmpls);
+			if (tmpls == NULL) goto fail;
+			r->templates = tmpls;
+		}
+		struct template_src *tmpl = &r->templates[r->ntemplates];
+		if ((tmpl->src = file_read(path)) == NULL) goto fail;
+		if ((tmpl->name = strdup(ent->d_name)) == NULL) {
+			free(tmpl->src);
+			goto fail;
+		}
+		r->ntemplates++;
+		uint64_t fhash = hash_bytes(tmpl->src, strlen(tmpl->src), 0);
+		*hash ^= hash_bytes(ent->d_name, strlen(ent->d_name), fhash);
+	}
+	closedir(dir);
+
+	return true;
+fail:
+	log_printl_errno(LOG_FATAL, "Couldn't read the templates");
+	closedir(dir);
+	return false;
+}
+
+/*
+ * Whether the templates are the same as the ones that the stamp in the output
+ * dir was written for, i.e. they are known to parse fine.
+ */
+static bool
+templates_stamp_matches(const char *stamppath, uint64_t hash)
+{
+	char  line[64], expected[64], hex[HASH_HEXLEN + 1];
+	FILE *f = fopen(stamppath, "r");
+	if (f == NULL) return false;
+	bool ok = fgets(line, sizeof line, f) != NULL;
+	fclose(f);
+
+	hash_hex(hash, hex);
+	snprintf(expected, sizeof expected, "revela-templates %d %s\n",
+	         TEMPLATES_STAMP_VERSION, hex);
+	return ok && !strcmp(line, expected);
+}
+
+static void
+templates_stamp_write(const char *stamppath, uint64_t hash)
+{
+	char  hex[HASH_HEXLEN + 1];
+	FILE *f = fopen(stamppath, "w");
+	if (f == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", stamppath);
+		return;
+	}
+	hash_hex(hash, hex);
+	fprintf(f, "revela-templates %d %s\n", TEMPLATES_STAMP_VERSION, hex);
+	fclose(f);
+}
+
+/* The source of a template by its name, for fragments_flatten() */
+static const char *
+template_lookup(const char *name, void *data)
+{
+	const struct render *r = data;
+	for (size_t i = 0; i < r->ntemplates; i++) {
+		if (!strcmp(r->templates[i].name, name)) return r->templates[i].src;
+	}
+	return NULL;
+}
+
+/*
+ * Splits the image template into fragments that are rendered once per album
+ * instead of once per page; see fragment.h. The templates that it extends are
+ * inlined first, so that their parts, e.g. the head of base.html, are split
+ * too.
+ */
+static void
+image_template_split(struct render *r)
+{
+	const char *src = template_lookup(IMAGE_TMPL, r);
+	if (src == NULL) return;
+	char *flat = fragments_flatten(src, template_lookup, r);
+	if (fragments_split(&r->fragments, flat != NULL ? flat : src, "image",
+	                    FRAGMENTS_VAR)
+	    && r->fragments.len > 0) {
+		log_printl(LOG_DEBUG, "Rendering %zu fragments of " IMAGE_TMPL
+		           " once per album", r->fragments.len);
+	}
+	free(flat);
 }
 
 bool
-render_init(struct render *r, const char *root, struct site_config *conf,
-            struct vector *albums)
+render_init(struct render *r, const char *root, const char *outdir,
+            struct site_config *conf)
 {
 	char       *tmplpath = joinpath(root, TEMPLATESDIR);
 	struct stat tstat;
@@ -197,33 +1270,155 @@ render_init(struct render *r, const char *root, struct site_config *conf,
 		}
 	}
 
-	r->modtime = tstat.st_mtim;
+	r->modtime   = tstat.st_mtim;
+	r->npreviews = conf->index.previews;
+	r->minify    = conf->output.minify;
+	r->conf      = conf;
+	r->tmplpath  = tmplpath;
 
-	if (r->dry_run) goto cleanup;
-
-	r->env  = roscha_env_new();
-	bool ok = roscha_env_load_dir(r->env, tmplpath);
-	if (!ok) {
-		struct vector *errors = roscha_env_check_errors(r->env);
-		log_printl(LOG_FATAL, "Couldn't initialize template engine: %s",
-		           errors->values[0]);
+	char staticp[PATH_MAX];
+	joinpathb(staticp, root, STATICDIR);
+	if (!assets_load(&r->assets, staticp, conf->base_url,
+	                 conf->output.hash_names)) {
+		log_printl(LOG_FATAL, "Can't read static files");
 		return false;
 	}
-	r->years  = roscha_object_new(vector_new_with_cap(8));
-	r->albums = roscha_object_new(vector_new_with_cap(64));
+	/* The pages link to the static files by their hashed names */
+	if (conf->output.hash_names
+	    && (r->assets.modtime.tv_sec > r->modtime.tv_sec
+	        || (r->assets.modtime.tv_sec == r->modtime.tv_sec
+	            && r->assets.modtime.tv_nsec > r->modtime.tv_nsec))) {
+		r->modtime = r->assets.modtime;
+	}
+
+	if (r->dry_run) return true;
+
+	if (r->nworkers == 0) {
+		long ncpus  = sysconf(_SC_NPROCESSORS_ONLN);
+		r->nworkers = ncpus > 0 ? ncpus : 1;
+	}
+	uint64_t hash;
+	char     stamppath[PATH_MAX];
+	if (!templates_read(r, &hash)) return false;
+	for (size_t i = 0; r->compile && i < r->ntemplates; i++) {
+		if (plan_template_safe(r->templates[i].src)) continue;
+		log_printl(LOG_DETAIL, "Not compiling image pages, %s uses the values "
+		           "of the image vars", r->templates[i].name);
+		r->compile = false;
+	}
+	image_template_split(r);
+	r->workers  = calloc(r->nworkers, sizeof *r->workers);
+	r->listings = vector_new();
+	for (size_t i = 0; i < r->nworkers; i++) {
+		r->workers[i].r = r;
+	}
+
+	/*
+	 * Templates that changed since the last build are all parsed right away
+	 * so that errors are reported before building anything. Otherwise each
+	 * worker only parses the ones it renders with; see worker_template().
+	 */
+	joinpathb(stamppath, outdir, TEMPLATES_STAMP);
+	if (!templates_stamp_matches(stamppath, hash)) {
+		if (render_worker_env(&r->workers[0]) == NULL) return false;
+		for (size_t i = 0; i < r->ntemplates; i++) {
+			if (!worker_template(&r->workers[0], r->templates[i].name)) {
+				return false;
+			}
+		}
+		templates_stamp_write(stamppath, hash);
+	}
+	if (r->nworkers == 1) return true;
 
-	roscha_hmap_set_new(r->env->vars, "title", (slice_whole(conf->title)));
-	roscha_hmap_set_new(r->env->vars, "index", (slice_whole(conf->base_url)));
+	struct render_queue *q = &r->queue;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->ready, NULL);
+	pthread_cond_init(&q->done, NULL);
+	q->cap  = r->nworkers * 64;
+	q->jobs = calloc(q->cap, sizeof *q->jobs);
+	for (size_t i = 0; i < r->nworkers; i++) {
+		struct render_worker *w = &r->workers[i];
+		if (pthread_create(&w->thread, NULL, render_worker_loop, w)) {
+			log_printl_errno(LOG_FATAL, "Couldn't start render workers");
+			r->nworkers = i;
+			return false;
+		}
+	}
+	log_printl(LOG_DETAIL, "Rendering with %zu workers", r->nworkers);
 
-cleanup:
-	free(tmplpath);
 	return true;
 }
 
 void
 render_deinit(struct render *r)
 {
-	roscha_env_destroy(r->env);
-	roscha_object_unref(r->years);
-	roscha_object_unref(r->albums);
+	struct render_queue *q = &r->queue;
+	if (q->jobs != NULL) {
+		pthread_mutex_lock(&q->lock);
+		q->stop = true;
+		pthread_cond_broadcast(&q->ready);
+		pthread_mutex_unlock(&q->lock);
+		for (size_t i = 0; i < r->nworkers; i++) {
+			pthread_join(r->workers[i].thread, NULL);
+		}
+		free(q->jobs);
+		pthread_cond_destroy(&q->done);
+		pthread_cond_destroy(&q->ready);
+		pthread_mutex_destroy(&q->lock);
+	}
+	if (r->listings != NULL) {
+		/* Left by a failed build, whose dirs might not be around anymore */
+		listings_clear(r, false);
+		vector_free(r->listings);
+	}
+	if (r->workers == NULL) goto out;
+	size_t              nplanned = 0, ninterpreted = 0;
+	double              tplanned = 0, tinterpreted = 0;
+	struct minify_stats minified[PAGE_KINDS] = {0};
+	for (size_t i = 0; i < r->nworkers; i++) {
+		struct render_worker *w = &r->workers[i];
+		nplanned += w->nplanned;
+		ninterpreted += w->ninterpreted;
+		tplanned += w->tplanned;
+		tinterpreted += w->tinterpreted;
+		for (size_t k = 0; k < PAGE_KINDS; k++) {
+			minified[k].pages += w->minified[k].pages;
+			minified[k].in += w->minified[k].in;
+			minified[k].out += w->minified[k].out;
+		}
+		worker_plans_clear(w);
+		if (w->plans != NULL) vector_free(w->plans);
+		free(w->buf);
+		free(w->iov);
+		if (w->album_map != NULL) roscha_object_unref(w->album_map);
+		if (w->env != NULL) roscha_env_destroy(w->env);
+		free(w->loaded);
+		worker_fragments_clear(w);
+	}
+	free(r->workers);
+	if (r->compile && nplanned + ninterpreted > 0) {
+		log_printl(LOG_DETAIL,
+		           "Image pages: %zu from plans (%.0f/s), %zu interpreted "
+		           "(%.0f/s)",
+		           nplanned, tplanned > 0 ? nplanned / tplanned : 0.0,
+		           ninterpreted,
+		           tinterpreted > 0 ? ninterpreted / tinterpreted : 0.0);
+	}
+	static const char *kinds[] = {"Index", "Album", "Image"};
+	for (size_t k = 0; k < PAGE_KINDS; k++) {
+		if (minified[k].pages == 0) continue;
+		log_printl(LOG_DETAIL,
+		           "%s pages: %zu minified from %zu to %zu bytes (-%.1f%%)",
+		           kinds[k], minified[k].pages, minified[k].in, minified[k].out,
+		           100.0 * (minified[k].in - minified[k].out) / minified[k].in);
+	}
+out:
+	for (size_t i = 0; i < r->ntemplates; i++) {
+		free(r->templates[i].name);
+		free(r->templates[i].src);
+	}
+	free(r->templates);
+	fragments_free(&r->fragments);
+	assets_free(&r->assets);
+	free(r->tmplpath);
 }
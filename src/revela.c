@@ -31,7 +31,7 @@ parse_arguments(int argc, char *argv[])
 {
 	int opt;
 	char *cmd = argv[0];
-	while ((opt = getopt(argc, argv, "i:o:nhV")) != -1) {
+	while ((opt = getopt(argc, argv, "i:o:j:d:cnshV")) != -1) {
 		switch (opt) {
 		case 'i':
 			site.root_dir = strdup(optarg);
@@ -39,9 +39,27 @@ parse_arguments(int argc, char *argv[])
 		case 'o':
 			site.output_dir = realpath(optarg, NULL);
 			break;
+		case 'j': {
+			char *end;
+			long  jobs = strtol(optarg, &end, 10);
+			if (*end != '\0' || jobs < 1) {
+				bad_arguments(cmd);
+			}
+			site.jobs = jobs;
+			break;
+		}
+		case 'd':
+			site.duplicates = strdup(optarg);
+			break;
+		case 'c':
+			site.compile = true;
+			break;
 		case 'n':
 			site.dry_run = true;
 			break;
+		case 's':
+			site.streaming = true;
+			break;
 		case 'h':
 			printf(usage, cmd);
 			exit(0);
@@ -4,15 +4,34 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <dirent.h>
 #include <limits.h>
+#include <sys/resource.h>
 
 #include "fs.h"
 #include "log.h"
 #include "hmap.h"
+#include "hash.h"
+#include "cache.h"
+#include "pages.h"
+#include "assets.h"
+#include "zoom.h"
+#include "compress.h"
+#include "relocate.h"
+#include "placeholder.h"
+#include "viewer.h"
+#include "ssim.h"
+#include "format.h"
+#include "phash.h"
 
 /* TODO: handle error cases for paths that are too long */
 
+/* Lowest quality that the search for the quality of an image tries */
+#define SEARCH_MIN_QUALITY 30
+/* zlib level 9 with adaptive filtering; see the PNG quality in gm(1) */
+#define PNG_QUALITY 95
+
 static const char *index_html = "index.html";
 /* File which revela uses solely to store the modtime of the album.ini file to
  * check whether we should re-render the album html files.
@@ -29,8 +48,9 @@ prerm_imagedir(const char *path, void *data)
 {
 	struct stat   st;
 	struct album *album = data;
-	char          htmlpath[PATH_MAX];
 
+	/* There are no pages of neighbouring images to update with the viewer */
+	if (album->site->config->albums.viewer) return true;
 	if (stat(path, &st)) {
 		log_printl_errno(LOG_ERROR, "Couldn't stat %s", path);
 		return false;
@@ -47,16 +67,16 @@ prerm_imagedir(const char *path, void *data)
 		}
 		if (prev) {
 			if (!prev->modified) {
-				joinpathb(htmlpath, prev->dst, index_html);
-				if (!render_make_image(&album->site->render, htmlpath, prev)) {
+				if (!render_make_image(&album->site->render, prev->dst_page,
+				                       prev)) {
 					goto fail;
 				}
 			}
 		}
 		if (next) {
 			if (!next->modified) {
-				joinpathb(htmlpath, next->dst, index_html);
-				if (!render_make_image(&album->site->render, htmlpath, next)) {
+				if (!render_make_image(&album->site->render, next->dst_page,
+				                       next)) {
 					goto fail;
 				}
 			}
@@ -68,6 +88,55 @@ fail:
 	return true;
 }
 
+/* Renders the page of the image again unless it was already updated */
+static bool
+image_refresh(struct site *site, struct image *image)
+{
+	if (image->modified) return true;
+	image->modified = true;
+	image->album->images_updated++;
+	return render_make_image(&site->render, image->dst_page, image);
+}
+
+/*
+ * Same as prerm_imagedir() for the layouts where images have no dir of their
+ * own, which rely on the order of the images in the manifest of the previous
+ * build instead.
+ */
+static bool
+album_refresh_neighbours(struct site *site, struct album *album)
+{
+	const struct manifest *m = album->manifest;
+	struct manifest_entry *e;
+	struct image          *image, *prev = NULL;
+	struct hmap           *current;
+	size_t                 i;
+	bool                   removed = false, ok = true;
+
+	if (m == NULL || site->config->albums.viewer) return true;
+	current = hmap_new();
+	vector_foreach (album->images, i, image) {
+		hmap_set(current, image->basename, image);
+	}
+	vector_foreach (m->list, i, e) {
+		image = hmap_get(current, e->basename);
+		if (image == NULL) {
+			removed = true;
+			continue;
+		}
+		if (removed) {
+			if (prev != NULL && !image_refresh(site, prev)) ok = false;
+			if (!image_refresh(site, image)) ok = false;
+			removed = false;
+		}
+		prev = image;
+	}
+	if (removed && prev != NULL && !image_refresh(site, prev)) ok = false;
+
+	hmap_free(current);
+	return ok;
+}
+
 static bool
 wand_passfail(MagickWand *wand, MagickPassFail status)
 {
@@ -86,36 +155,174 @@ wand_passfail(MagickWand *wand, MagickPassFail status)
 #define TRYWAND(w, f) \
 	if (!wand_passfail(w, f)) goto magick_fail
 
+/*
+ * Strips, sets the quality and resizes the image in the wand according to conf.
+ */
 static bool
-optimize_image(MagickWand *wand, const char *dst,
-               const struct image_config *conf, const struct timespec *srcmtim,
-               bool dry)
+transform_image(MagickWand *wand, const struct image_config *conf)
 {
-	log_printl(LOG_DETAIL, "Converting %s", dst);
-	if (dry) goto out;
-
-	unsigned long nx = conf->max_width, ny = conf->max_height;
 	if (conf->strip) {
 		TRYWAND(wand, MagickStripImage(wand));
 	}
 	TRYWAND(wand, MagickSetCompressionQuality(wand, conf->quality));
 	unsigned long x = MagickGetImageWidth(wand), y = MagickGetImageHeight(wand);
-	/* Resize only if the image is actually bigger. No point in making small
-	 * images bigger. */
-	if (x > nx || y > ny) {
-		if (conf->smart_resize) {
-			double ratio = (double)x / y;
-			if (x > y) {
-				ny = nx / ratio;
+	unsigned long nx = x, ny = y;
+	image_fit(conf, &nx, &ny);
+	if (nx != x || ny != y) {
+		TRYWAND(wand,
+		        MagickResizeImage(wand, nx, ny, GaussianFilter, conf->blur));
+	}
+
+	return true;
+magick_fail:
+	return false;
+}
+
+/*
+ * Encodes the image in the wand with quality, decodes it back into pix and
+ * measures how similar it looks to ref, both of them grayscale pixels of the
+ * size of the image. Sets bytes to the size of the encoded image.
+ */
+static bool
+quality_probe(MagickWand *wand, const unsigned char *ref, unsigned char *pix,
+              uint8_t quality, double *score, size_t *bytes)
+{
+	unsigned long  x = MagickGetImageWidth(wand), y = MagickGetImageHeight(wand);
+	unsigned char *blob  = NULL;
+	MagickWand    *probe = NewMagickWand();
+	bool           ok    = false;
+
+	TRYWAND(wand, MagickSetCompressionQuality(wand, quality));
+	blob = MagickWriteImageBlob(wand, bytes);
+	if (blob == NULL) {
+		log_printl(LOG_ERROR, "Couldn't encode a probe at quality %u",
+		           (unsigned)quality);
+		goto magick_fail;
+	}
+	TRYWAND(probe, MagickReadImageBlob(probe, blob, *bytes));
+	TRYWAND(probe,
+	        MagickGetImagePixels(probe, 0, 0, x, y, "I", CharPixel, pix));
+	if (!ssim(ref, pix, x, y, score)) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		goto magick_fail;
+	}
+	ok = true;
+magick_fail:
+	if (blob != NULL) MagickRelinquishMemory(blob);
+	DestroyMagickWand(probe);
+	return ok;
+}
+
+/*
+ * Finds the lowest quality up to the one in conf at which the image in the
+ * wand keeps the ssim in conf, halving the range of qualities left with each
+ * probe. Images in lossless formats are left alone, with quality unset.
+ */
+static bool
+quality_search(MagickWand *wand, const struct image_config *conf,
+               uint8_t *quality, struct quality_stats *stats)
+{
+	char *format = MagickGetImageFormat(wand);
+	/* Either as read or as set by format_image() */
+	bool  lossy  = format != NULL
+	           && (!strcasecmp(format, "JPEG") || !strcasecmp(format, "WEBP"));
+	if (format != NULL) MagickRelinquishMemory(format);
+	if (!lossy) return true;
+
+	unsigned long  x = MagickGetImageWidth(wand), y = MagickGetImageHeight(wand);
+	unsigned char *ref = malloc(x * y * 2), *pix = ref + x * y;
+	uint8_t        hi  = conf->quality;
+	uint8_t        lo  = hi < SEARCH_MIN_QUALITY ? hi : SEARCH_MIN_QUALITY;
+	size_t         maxbytes, bytes, best;
+	double         score;
+	if (ref == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return false;
+	}
+	TRYWAND(wand, MagickGetImagePixels(wand, 0, 0, x, y, "I", CharPixel, ref));
+
+	if (!quality_probe(wand, ref, pix, hi, &score, &maxbytes)) {
+		goto magick_fail;
+	}
+	best = maxbytes;
+	/* Otherwise not even the highest quality allowed is good enough */
+	if (score >= conf->ssim) {
+		while (lo < hi) {
+			uint8_t mid = lo + (hi - lo) / 2;
+			if (!quality_probe(wand, ref, pix, mid, &score, &bytes)) {
+				goto magick_fail;
+			}
+			if (score >= conf->ssim) {
+				hi   = mid;
+				best = bytes;
 			} else {
-				nx = ny * ratio;
+				lo = mid + 1;
 			}
 		}
-		TRYWAND(wand,
-		        MagickResizeImage(wand, nx, ny, GaussianFilter, conf->blur));
+	}
+	free(ref);
+	*quality = hi;
+	stats->images++;
+	stats->saved += maxbytes - best;
+	return true;
+magick_fail:
+	free(ref);
+	return false;
+}
+
+/*
+ * Sets the format chosen for the image in the wand, see POLICY_AUTO, along
+ * with the settings that suit it: graphics with few colors get a palette, and
+ * PNGs the strongest compression.
+ */
+static bool
+format_image(MagickWand *wand, const struct image *image)
+{
+	if (image->format == NULL) return true;
+	TRYWAND(wand, MagickSetImageFormat(wand, image->format));
+	if (image->encoding.kind == KIND_PALETTE) {
+		TRYWAND(wand, MagickSetImageType(wand, PaletteType));
+	}
+	if (!strcmp(image->out_ext, format_ext(FORMAT_PNG))) {
+		TRYWAND(wand, MagickSetCompressionQuality(wand, PNG_QUALITY));
+	}
+
+	return true;
+magick_fail:
+	return false;
+}
+
+/*
+ * Converts the image in the wand according to conf and writes it to dst. With
+ * ssim in conf, quality is the one to encode lossy images with, which is
+ * searched for and set if it's 0; see quality_search().
+ */
+static bool
+optimize_image(struct site *site, const struct image *image, const char *dst,
+               const struct image_config *conf, uint8_t *quality)
+{
+	MagickWand *wand = site->wand;
+	log_printl(LOG_DETAIL, "Converting %s", dst);
+	if (site->dry_run) goto out;
+
+	if (!transform_image(wand, conf)) return false;
+	if (!format_image(wand, image)) return false;
+	if (conf->ssim > 0) {
+		if (*quality == 0
+		    && !quality_search(wand, conf, quality, &site->quality)) {
+			return false;
+		}
+		if (*quality != 0) {
+			TRYWAND(wand, MagickSetCompressionQuality(wand, *quality));
+		}
+	}
+	/* dst might be a hard link to a cache entry left by an older build */
+	if (unlink(dst) && errno != ENOENT) {
+		log_printl_errno(LOG_ERROR, "Couldn't replace %s", dst);
+		return false;
 	}
 	TRYWAND(wand, MagickWriteImage(wand, dst));
-	setdatetime(dst, srcmtim);
+	setdatetime(dst, &image->modtime);
 
 out:
 	return true;
@@ -123,53 +330,419 @@ magick_fail:
 	return false;
 }
 
+/*
+ * Sets the placeholder of the image out of the thumbnail in the wand, along
+ * with the size of the thumbnail, and keeps them in the metadata so that they
+ * don't need to be made again.
+ */
 static bool
-images_walk(struct site *site, struct vector *images)
+image_set_thumb(struct site *site, struct image *image)
+{
+	MagickWand    *wand = site->wand;
+	unsigned long  x = MagickGetImageWidth(wand), y = MagickGetImageHeight(wand);
+	unsigned char *rgb = malloc(x * y * 3);
+	if (rgb == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return false;
+	}
+	if (!wand_passfail(wand, MagickGetImagePixels(wand, 0, 0, x, y, "RGB",
+	                                              CharPixel, rgb))) {
+		free(rgb);
+		return false;
+	}
+	placeholder_color(rgb, x * y, image->thumb.placeholder);
+	image->thumb.width  = x;
+	image->thumb.height = y;
+	meta_set_thumb(&site->meta, image->meta_index, &image->thumb);
+	free(rgb);
+	return true;
+}
+
+/*
+ * Makes the placeholder of the image and takes the size of its thumbnail out
+ * of the thumbnail if they weren't in the metadata of the previous build, e.g.
+ * because the thumbnail was taken from the derivative cache.
+ */
+static bool
+image_load_thumb(struct site *site, struct image *image)
+{
+	if (image->thumb.placeholder[0] != '\0' || site->dry_run) return true;
+	TRYWAND(site->wand, MagickReadImage(site->wand, image->dst_thumb));
+	bool ok = image_set_thumb(site, image);
+	MagickRemoveImage(site->wand);
+	return ok;
+magick_fail:
+	return false;
+}
+
+/*
+ * Removes the outputs of previous versions of the image from its own dir, whose
+ * names had other tags in them; see image_tag().
+ */
+static bool
+image_dir_clean(const struct image *image, bool dry)
+{
+	struct hmap *keep = hmap_new_with_cap(4);
+	const char  *name;
+	name = rbasename(image->dst_image);
+	hmap_set(keep, name, (char *)name);
+	name = rbasename(image->dst_thumb);
+	hmap_set(keep, name, (char *)name);
+	name = rbasename(image->dst_page);
+	hmap_set(keep, name, (char *)name);
+	if (image->url_zoom != NULL) {
+		name = rbasename(image->dst_zoom);
+		hmap_set(keep, name, (char *)name);
+		name = rbasename(image->dst_tiles);
+		hmap_set(keep, name, (char *)name);
+	}
+	ssize_t n = rmextra(image->dst, keep, NULL, NULL, dry);
+	hmap_free(keep);
+	return n >= 0;
+}
+
+/*
+ * Makes the tile pyramid of the image if it gets one and it isn't up to date,
+ * out of the source in the wand if decoded is set, or reading it otherwise.
+ * Sets zoomed if it was made.
+ */
+static bool
+image_make_zoom(struct site *site, struct image *image, bool decoded,
+                bool *zoomed)
+{
+	if (image->url_zoom == NULL) return true;
+	int isupdate = zoom_uptodate(&site->config->zoom, image->dst_zoom,
+	                             &image->modtime);
+	if (isupdate == -1) return false;
+	if (isupdate) return true;
+	*zoomed = true;
+
+	if (!decoded && !site->dry_run) {
+		TRYWAND(site->wand, MagickReadImage(site->wand, image->source));
+	}
+	bool ok = zoom_make(site->wand, &site->config->zoom, image->dst_zoom,
+	                    image->dst_tiles, &image->modtime, site->render.nworkers,
+	                    site->dry_run);
+	if (!decoded && !site->dry_run) MagickRemoveImage(site->wand);
+	return ok;
+magick_fail:
+	return false;
+}
+
+/*
+ * Tells the decoder the smallest size that the source can be read at for the
+ * optimized image, so that JPEGs are decoded at 1/2, 1/4 or 1/8 of their size
+ * instead of in full; the other formats ignore it. Not when the tile pyramid
+ * needs the full size pixels or the size of the source isn't known. Returns
+ * whether the size was set.
+ */
+static bool
+image_decode_hint(struct site *site, const struct image *image)
+{
+	const struct site_config *conf = site->config;
+	unsigned long x = image->exif.width, y = image->exif.height;
+	if (!conf->decode.scaled || image->url_zoom != NULL || x == 0 || y == 0) {
+		return false;
+	}
+	image_fit(&conf->images, &x, &y);
+	if (x == image->exif.width && y == image->exif.height) return false;
+	return MagickSetSize(site->wand, x, y) == MagickPass;
+}
+
+/* The outputs of a picture, see site.twins */
+struct twin {
+	const char *image;
+	const char *thumb;
+};
+
+/*
+ * Sets key to what identifies the outputs of the image: the contents of its
+ * source and the format they are in.
+ */
+static bool
+twin_key(struct image *image, char *key, size_t size)
 {
+	if (!image_fingerprint(image, image->album->manifest)) return false;
+	snprintf(key, size, "%016llx.%lld%s", (unsigned long long)image->hash,
+	         (long long)image->size, image->out_ext);
+	return true;
+}
+
+/*
+ * Copies the optimized image and the thumbnail that aren't up to date from
+ * those of a picture built before with the same source, i.e. the same file in
+ * another album, if there is one, setting imgupdate and thumbupdate. They are
+ * copied rather than linked since their modtimes are those of their sources.
+ */
+static bool
+twin_fetch(struct site *site, struct image *image, int *imgupdate,
+           int *thumbupdate)
+{
+	char         key[HASH_HEXLEN + 32];
+	struct twin *twin;
+	if (!twin_key(image, key, sizeof key)) return false;
+	if ((twin = hmap_get(site->twins, key)) == NULL) return true;
+
+	const char *srcs[] = {twin->image, twin->thumb};
+	const char *dsts[] = {image->dst_image, image->dst_thumb};
+	int        *updates[] = {imgupdate, thumbupdate};
+	for (size_t i = 0; i < 2; i++) {
+		if (*updates[i]) continue;
+		if (unlink(dsts[i]) && errno != ENOENT) {
+			log_printl_errno(LOG_ERROR, "Couldn't replace %s", dsts[i]);
+			return false;
+		}
+		if (!filesync(srcs[i], dsts[i], NULL, false)) continue;
+		log_printl(LOG_DETAIL, "Copying %s from %s", dsts[i], srcs[i]);
+		setdatetime(dsts[i], &image->modtime);
+		*updates[i] = 1;
+	}
+	return true;
+}
+
+/* Lets pictures from the same source built later take the outputs of image */
+static bool
+twin_add(struct site *site, struct image *image)
+{
+	char key[HASH_HEXLEN + 32];
+	if (!twin_key(image, key, sizeof key)) return false;
+	if (hmap_get(site->twins, key) != NULL) return true;
+
+	struct twin *twin = arena_alloc(&site->arena, sizeof *twin);
+	if (twin == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return false;
+	}
+	/* The image itself might be released before the build is done */
+	twin->image = arena_strdup(&site->arena, image->dst_image);
+	twin->thumb = arena_strdup(&site->arena, image->dst_thumb);
+	hmap_set(site->twins, arena_strdup(&site->arena, key), twin);
+	return true;
+}
+
+/*
+ * Hashes the settings that the qualities chosen for the derivatives of an image
+ * depend on; see struct meta_encoding.
+ */
+static uint64_t
+image_encoding_key(const struct site_config *conf, const char *ext)
+{
+	uint64_t key = cache_derivative_key(0, &conf->images, ext);
+	return cache_derivative_key(key, &conf->thumbnails, ext);
+}
+
+/*
+ * Makes sure that the optimized image and the thumbnail of the image are up to
+ * date, taking them from the derivative cache if possible, and converting the
+ * source otherwise. The thumbnail is always made out of the resized image, and
+ * the placeholder out of the thumbnail. Sets made if they weren't up to date.
+ * The tile pyramid is made too if the source had to be read anyway, setting
+ * zoomed; see image_make_zoom().
+ */
+static bool
+image_make_derivatives(struct site *site, struct image *image, bool *made,
+                       bool *zoomed)
+{
+	struct site_config *conf   = site->config;
+	bool                cached = site->cache.dir != NULL && !site->dry_run;
+	uint64_t            imgkey = 0, thumbkey = 0;
+	int                 imgupdate, thumbupdate;
+
+	*made     = false;
+	imgupdate = file_is_uptodate(image->dst_image, &image->modtime);
+	if (imgupdate == -1) return false;
+	thumbupdate = file_is_uptodate(image->dst_thumb, &image->modtime);
+	if (thumbupdate == -1) return false;
+	if (imgupdate && thumbupdate) return image_load_thumb(site, image);
+	*made = true;
+	if (conf->output.hash_names && conf->albums.layout == LAYOUT_NESTED
+	    && !image_dir_clean(image, site->dry_run)) {
+		return false;
+	}
+
+	if (cached) {
+		if (!image_fingerprint(image, image->album->manifest)) return false;
+		imgkey   = cache_image_key(&site->cache, image, &conf->images);
+		thumbkey =
+			cache_derivative_key(imgkey, &conf->thumbnails, image->out_ext);
+		if (!imgupdate) {
+			imgupdate = cache_fetch(&site->cache, imgkey, image->out_ext,
+			                        image->dst_image, &image->modtime);
+		}
+		if (!thumbupdate) {
+			thumbupdate = cache_fetch(&site->cache, thumbkey, image->out_ext,
+			                          image->dst_thumb, &image->modtime);
+		}
+		if (imgupdate && thumbupdate) {
+			return image_load_thumb(site, image);
+		}
+	}
+
+	if (!site->dry_run && !twin_fetch(site, image, &imgupdate, &thumbupdate)) {
+		return false;
+	}
+	if (imgupdate && thumbupdate) return image_load_thumb(site, image);
+
+	/* Qualities chosen with other settings don't apply anymore */
+	uint64_t enckey = image_encoding_key(conf, image->out_ext);
+	if (image->encoding.key != enckey) {
+		image->encoding = (struct meta_encoding){
+			.key     = enckey,
+			.phash   = image->encoding.phash,
+			.kind    = image->encoding.kind,
+			.phashed = image->encoding.phashed,
+		};
+	}
+
+	if (!site->dry_run) {
+		bool           hinted = image_decode_hint(site, image);
+		MagickPassFail read   = MagickReadImage(site->wand, image->source);
+		/* So that it doesn't apply to the next files read with the wand */
+		if (hinted) MagickSetSize(site->wand, 0, 0);
+		TRYWAND(site->wand, read);
+	}
+	/* Before the full size pixels are gone */
+	if (!image_make_zoom(site, image, true, zoomed)) goto magick_fail;
+	if (!imgupdate) {
+		if (!optimize_image(site, image, image->dst_image, &conf->images,
+		                    &image->encoding.image_quality)) {
+			goto magick_fail;
+		}
+		if (cached) {
+			cache_store(&site->cache, imgkey, image->out_ext, image->dst_image);
+		}
+	} else if (!site->dry_run && !transform_image(site->wand, &conf->images)) {
+		goto magick_fail;
+	}
+	if (!thumbupdate) {
+		if (!optimize_image(site, image, image->dst_thumb, &conf->thumbnails,
+		                    &image->encoding.thumb_quality)) {
+			goto magick_fail;
+		}
+		/* The pixels of the thumbnail are still in the wand */
+		if (!site->dry_run && !image_set_thumb(site, image)) {
+			goto magick_fail;
+		}
+		if (cached) {
+			cache_store(&site->cache, thumbkey, image->out_ext,
+			            image->dst_thumb);
+		}
+	}
+	if (!site->dry_run) {
+		MagickRemoveImage(site->wand);
+		meta_set_encoding(&site->meta, image->meta_index, &image->encoding);
+	}
+
+	return image_load_thumb(site, image);
+magick_fail:
+	return false;
+}
+
+/*
+ * Adds the names of the outputs of the image in the album dir, and in its shard
+ * dir with LAYOUT_SHARDED, to the preserved entries of the album.
+ */
+static void
+image_preserve(const struct image *image, enum image_layout layout,
+               bool viewer)
+{
+	struct hmap *preserved = image->album->preserved;
+	const char  *base      = rbasename(image->dst);
+	if (layout == LAYOUT_NESTED) {
+		hmap_set(preserved, base, (char *)base);
+		return;
+	}
+	if (layout == LAYOUT_SHARDED) hmap_set(preserved, base, (char *)base);
+	base = rbasename(image->dst_image);
+	hmap_set(preserved, base, (char *)base);
+	base = rbasename(image->dst_thumb);
+	hmap_set(preserved, base, (char *)base);
+	if (image->url_zoom != NULL) {
+		base = rbasename(image->dst_zoom);
+		hmap_set(preserved, base, (char *)base);
+		base = rbasename(image->dst_tiles);
+		hmap_set(preserved, base, (char *)base);
+	}
+	if (viewer) return;
+	base = rbasename(image->dst_page);
+	hmap_set(preserved, base, (char *)base);
+}
+
+/*
+ * Removes what doesn't belong to any image from the shard dirs of the album,
+ * once the shard dirs without images were removed along with the rest of the
+ * extraneous files of the album.
+ */
+static bool
+shards_clean(struct album *album, bool dry)
+{
+	bool          done[256] = {false};
 	size_t        i;
 	struct image *image;
+	vector_foreach (album->images, i, image) {
+		size_t shard = strtoul(rbasename(image->dst), NULL, 16);
+		if (done[shard]) continue;
+		done[shard] = true;
+		if (rmextra(image->dst, album->preserved, NULL, NULL, dry) < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+images_walk(struct site *site, struct vector *images)
+{
+	size_t                      i;
+	struct image               *image;
+	const struct albums_config *conf = &site->config->albums;
+	/* Shard dirs already made for this album */
+	bool sharded[256] = {false};
 
 	vector_foreach (images, i, image) {
 		struct stat     dstat;
-		struct timespec ddate = {.tv_sec = image->tstamp, .tv_nsec = 0};
-		int             imgupdate, thumbupdate;
-		char            htmlpath[PATH_MAX];
-		const char     *base = rbasename(image->dst);
+		struct timespec ddate    = {.tv_sec = image->tstamp, .tv_nsec = 0};
+		const char     *htmlpath = image->dst_page;
+		bool            made, zoomed = false;
 
 		log_printl(LOG_DEBUG, "Image: %s, datetime %s", image->basename,
 		           image->datestr);
 
-		if (!nmkdir(image->dst, &dstat, site->dry_run)) return false;
-
-		imgupdate = file_is_uptodate(image->dst_image, &image->modtime);
-		if (imgupdate == -1) goto magick_fail;
-		thumbupdate = file_is_uptodate(image->dst_image, &image->modtime);
-		if (thumbupdate == -1) goto magick_fail;
-		if (!site->dry_run && (!imgupdate || !thumbupdate)) {
-			TRYWAND(site->wand, MagickReadImage(site->wand, image->source));
-		}
-		if (!imgupdate
-		    && !optimize_image(site->wand, image->dst_image,
-		                       &site->config->images, &image->modtime,
-		                       site->dry_run)) {
-			goto magick_fail;
-		}
-		if (!thumbupdate
-		    && !optimize_image(site->wand, image->dst_thumb,
-		                       &site->config->thumbnails, &image->modtime,
-		                       site->dry_run)) {
-			goto magick_fail;
+		if (conf->layout == LAYOUT_NESTED) {
+			if (!nmkdir(image->dst, &dstat, site->dry_run)) return false;
+		} else if (conf->layout == LAYOUT_SHARDED) {
+			size_t shard = strtoul(rbasename(image->dst), NULL, 16);
+			if (!sharded[shard]) {
+				if (!nmkdir(image->dst, &dstat, site->dry_run)) return false;
+				sharded[shard] = true;
+			}
 		}
-		if (!site->dry_run && (!imgupdate || !thumbupdate)) {
-			MagickRemoveImage(site->wand);
+
+		if (!image_make_derivatives(site, image, &made, &zoomed)) return false;
+		if (!site->dry_run && !twin_add(site, image)) return false;
+		if (!zoomed && !image_make_zoom(site, image, false, &zoomed)) {
+			return false;
 		}
 
-		joinpathb(htmlpath, image->dst, index_html);
-		hmap_set(image->album->preserved, base, (char *)base);
+		image_preserve(image, conf->layout, conf->viewer);
 
-		int isupdate = file_is_uptodate(htmlpath, &site->render.modtime);
+		if (conf->viewer) {
+			/* Left over from before the viewer was enabled */
+			if (access(htmlpath, F_OK) == 0
+			    && !rmentry(htmlpath, site->dry_run)) {
+				return false;
+			}
+			goto success;
+		}
+
+		int isupdate = render_is_uptodate(&site->render, htmlpath);
 		if (isupdate == -1) return false;
-		if (isupdate == 0 || image->album->config_updated) {
+		/*
+		 * With hashed names, new images mean new urls in the page, and a
+		 * new pyramid might be one that the page didn't link to yet
+		 */
+		if (isupdate == 0 || image->album->config_updated
+		    || (made && site->config->output.hash_names) || zoomed) {
 			if (!render_make_image(&site->render, htmlpath, image)) {
 				return false;
 			}
@@ -179,8 +752,8 @@ images_walk(struct site *site, struct vector *images)
 			if (i > 0) {
 				struct image *prev = images->values[i - 1];
 				if (!prev->modified) {
-					joinpathb(htmlpath, prev->dst, index_html);
-					if (!render_make_image(&site->render, htmlpath, prev)) {
+					if (!render_make_image(&site->render, prev->dst_page,
+					                       prev)) {
 						return false;
 					}
 					goto success;
@@ -196,7 +769,7 @@ images_walk(struct site *site, struct vector *images)
 		 */
 		if (i < images->len - 1) {
 			struct image *next = images->values[i + 1];
-			if (access(next->dst, F_OK) != 0) {
+			if (access(next->dst_page, F_OK) != 0) {
 				image->album->images_updated++;
 				if (!render_make_image(&site->render, htmlpath, image)) {
 					return false;
@@ -213,78 +786,334 @@ images_walk(struct site *site, struct vector *images)
 		}
 
 success:
-		if (!site->dry_run) setdatetime(image->dst, &ddate);
-		continue;
+		/* See prerm_imagedir() */
+		if (!site->dry_run && conf->layout == LAYOUT_NESTED) {
+			setdatetime(image->dst, &ddate);
+		}
+	}
+	return true;
+}
+
+/*
+ * Writes the atlas of the images in [start, end) of the album to path, with
+ * each thumbnail where its cell says.
+ */
+static bool
+sprite_write(struct site *site, struct album *album, size_t start, size_t end,
+             unsigned long w, unsigned long h, const char *path)
+{
+	MagickWand    *atlas   = NewMagickWand();
+	PixelWand     *bg      = NewPixelWand();
+	uint8_t        quality = site->config->thumbnails.quality;
+	MagickPassFail status;
+	size_t         i;
+	bool           ok = false;
+
+	PixelSetColor(bg, "#ffffff");
+	TRYWAND(atlas, MagickNewImage(atlas, w, h, bg));
+	for (i = start; i < end; i++) {
+		const struct image *image = album->images->values[i];
+		TRYWAND(site->wand, MagickReadImage(site->wand, image->dst_thumb));
+		status = MagickCompositeImage(atlas, site->wand, OverCompositeOp,
+		                              image->cell.x, image->cell.y);
+		MagickRemoveImage(site->wand);
+		TRYWAND(atlas, status);
+	}
+	TRYWAND(atlas, MagickSetCompressionQuality(atlas, quality));
+	TRYWAND(atlas, MagickWriteImage(atlas, path));
+	ok = true;
+
 magick_fail:
+	DestroyPixelWand(bg);
+	DestroyMagickWand(atlas);
+	return ok;
+}
+
+/*
+ * Lays out the thumbnails of the images in [start, end) of the album in an
+ * atlas and points their sprite to it, making it unless it exists already: its
+ * name has a hash of the thumbnails and of where they go, so it only changes
+ * along with them. Left out if the size of a thumbnail isn't known, e.g. for
+ * new images in a dry run.
+ */
+static bool
+sprite_make(struct site *site, struct album *album, size_t start, size_t end)
+{
+	struct sprite_cell *cells = malloc((end - start) * sizeof *cells);
+	struct hash_state   s;
+	struct image       *image;
+	uint64_t            key;
+	unsigned long       w, h;
+	char                tag[ASSETS_TAG_LEN + 1], path[PATH_MAX];
+	size_t              i;
+
+	if (cells == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
 		return false;
 	}
-	return true;
+	for (i = start; i < end; i++) {
+		image = album->images->values[i];
+		if (image->thumb.width == 0) {
+			free(cells);
+			return true;
+		}
+		cells[i - start] = (struct sprite_cell){
+			.w = image->thumb.width,
+			.h = image->thumb.height,
+		};
+	}
+	sprite_layout(cells, end - start, &w, &h);
+
+	hash_init(&s, 0);
+	for (i = start; i < end; i++) {
+		image       = album->images->values[i];
+		image->cell = cells[i - start];
+		int64_t fields[] = {image->size, image->modtime.tv_sec,
+		                    image->modtime.tv_nsec};
+		hash_update(&s, image->dst_thumb, strlen(image->dst_thumb) + 1);
+		hash_update(&s, fields, sizeof fields);
+		hash_update(&s, &image->cell, sizeof image->cell);
+	}
+	free(cells);
+	/* The thumbnails are made out of the optimized images */
+	key = cache_derivative_key(hash_final(&s), &site->config->images,
+	                           SPRITE_EXT);
+	key = cache_derivative_key(key, &site->config->thumbnails, SPRITE_EXT);
+	assets_tag(key, tag);
+
+	/* Allocated along with the images, which point to it */
+	size_t len = strlen(album->url) + 2 + sizeof SPRITE_NAME + ASSETS_TAG_LEN
+	           + sizeof SPRITE_EXT;
+	char  *url = arena_alloc(album->arena, len);
+	if (url == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return false;
+	}
+	sprintf(url, "%s/" SPRITE_NAME ".%s" SPRITE_EXT, album->url, tag);
+	joinpathb(path, album->slug, rbasename(url));
+	for (i = start; i < end; i++) {
+		image         = album->images->values[i];
+		image->sprite = url;
+	}
+	hmap_set(album->preserved, rbasename(url), (char *)rbasename(url));
+
+	if (access(path, F_OK) == 0) return true;
+	log_printl(LOG_DETAIL, "Making %s", path);
+	if (site->dry_run) return true;
+	return sprite_write(site, album, start, end, w, h, path);
 }
 
+/*
+ * Packs the thumbnails of each page of the album into atlases of up to
+ * albums.sprite thumbnails each; see sprite.h.
+ */
 static bool
-albums_walk(struct site *site)
+album_make_sprites(struct site *site, struct album *album)
+{
+	const struct albums_config *conf = &site->config->albums;
+	size_t count = pages_count(album->images->len, conf->per_page);
+	size_t page, i, start, end;
+
+	for (page = 1; page <= count; page++) {
+		pages_range(album->images->len, conf->per_page, page, &start, &end);
+		for (i = start; i < end; i += conf->sprite) {
+			size_t n = end - i < conf->sprite ? end - i : conf->sprite;
+			if (!sprite_make(site, album, i, i + n)) return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Sorts the images of a freshly loaded album and sets its year.
+ */
+static void
+album_sort_images(struct album *album)
 {
 	size_t        i;
-	struct album *album;
+	struct image *image;
+	album_set_year(album);
+	qsort(album->images->values, album->images->len, sizeof(void *),
+	      image_cmp);
+	vector_foreach (album->images, i, image) {
+		image->index = i;
+	}
+}
 
-	vector_foreach (site->albums, i, album) {
-		struct stat dstat;
-		char        pathbuf[PATH_MAX];
-		switch (nmkdir(album->slug, &dstat, site->dry_run)) {
-		case NMKDIR_ERROR:
-			return false;
-		case NMKDIR_CREATED:
+/*
+ * Loads the images of an album that was found by traverse() in a streaming
+ * build, where only the count of images was taken.
+ */
+static bool
+album_load_images(struct album *album)
+{
+	DIR *dir = opendir(album->source);
+	if (!dir) {
+		log_printl_errno(LOG_FATAL, "Can't open directory %s", album->source);
+		return false;
+	}
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		struct stat fstats;
+		char        subpath[PATH_MAX];
+		joinpathb(subpath, album->source, ent->d_name);
+		if (!isimage(subpath)) continue;
+		if (stat(subpath, &fstats)) {
+			log_printl_errno(LOG_FATAL, "Can't read %s", subpath);
+			goto fail;
+		}
+		if (!S_ISREG(fstats.st_mode)) continue;
+		struct image *image = image_new(subpath, &fstats, album);
+		if (image == NULL) goto fail;
+		album_add_image(album, image);
+	}
+	closedir(dir);
+
+	if (album->images->len == 0) {
+		log_printl(LOG_FATAL, "The images of %s are gone", album->source);
+		return false;
+	}
+	album_sort_images(album);
+	return true;
+
+fail:
+	closedir(dir);
+	return false;
+}
+
+static bool
+album_build(struct site *site, struct album *album)
+{
+	struct stat dstat;
+	char        pathbuf[PATH_MAX];
+	switch (nmkdir(album->slug, &dstat, site->dry_run)) {
+	case NMKDIR_ERROR:
+		return false;
+	case NMKDIR_CREATED:
+		album->config_updated = true;
+		if (!site->dry_run) {
+			joinpathb(pathbuf, album->slug, album_meta);
+			close(creat(pathbuf, 0644));
+			setdatetime(pathbuf, &album->modtime);
+		}
+		break;
+	case NMKDIR_NOOP:
+		joinpathb(pathbuf, album->slug, album_meta);
+		if (file_is_uptodate(pathbuf, &album->modtime) == 0) {
 			album->config_updated = true;
 			if (!site->dry_run) {
-				joinpathb(pathbuf, album->slug, album_meta);
 				close(creat(pathbuf, 0644));
 				setdatetime(pathbuf, &album->modtime);
 			}
-			break;
-		case NMKDIR_NOOP:
-			joinpathb(pathbuf, album->slug, album_meta);
-			if (file_is_uptodate(pathbuf, &album->modtime) == 0) {
-				album->config_updated = true;
-				if (!site->dry_run) {
-					close(creat(pathbuf, 0644));
-					setdatetime(pathbuf, &album->modtime);
-				}
-			}
-			break;
 		}
+		break;
+	}
 
-		hmap_set(site->album_dirs, album->slug, (char *)album->slug);
-		if (!site->dry_run) {
-			if (!render_set_album_vars(&site->render, album)) return false;
-		}
+	hmap_set(site->album_dirs, album->slug, (char *)album->slug);
 
-		log_printl(LOG_DEBUG, "Album: %s, datetime %s", album->slug,
-		           album->datestr);
-		if (!images_walk(site, album->images)) {
+	log_printl(LOG_DEBUG, "Album: %s, datetime %s", album->slug,
+	           album->datestr);
+	if (!images_walk(site, album->images)) {
+		return false;
+	}
+	if (site->config->albums.sprite > 0 && !album_make_sprites(site, album)) {
+		return false;
+	}
+
+	hmap_set(album->preserved, index_html, (char *)index_html);
+	hmap_set(album->preserved, album_meta, (char *)album_meta);
+	hmap_set(album->preserved, MANIFEST_FILE, MANIFEST_FILE);
+	hmap_set(album->preserved, PAGES_DIR, PAGES_DIR);
+	hmap_set(album->preserved, PAGES_FILE, PAGES_FILE);
+	if (site->config->albums.viewer) {
+		hmap_set(album->preserved, VIEWER_FILE, VIEWER_FILE);
+		if (!viewer_write(album, &site->config->images, site->dry_run)) {
 			return false;
 		}
+	}
+	enum image_layout layout = site->config->albums.layout;
+	if (layout != LAYOUT_NESTED && !album_refresh_neighbours(site, album)) {
+		return false;
+	}
+	ssize_t deleted = rmextra(album->slug, album->preserved,
+	                          layout == LAYOUT_NESTED ? prerm_imagedir : NULL,
+	                          album, site->dry_run);
+	if (deleted < 0) {
+		log_printl_errno(LOG_ERROR,
+		                 "Something happened while deleting extraneous files");
+	} else {
+		album->images_updated += deleted;
+	}
+	if (layout == LAYOUT_SHARDED && !shards_clean(album, site->dry_run)) {
+		log_printl_errno(LOG_ERROR,
+		                 "Something happened while deleting extraneous files");
+	}
+	if (!manifest_write(album, site->dry_run)) {
+		log_printl(LOG_ERROR, "Warning: couldn't update manifest of %s",
+		           album->slug);
+	}
 
-		hmap_set(album->preserved, index_html, (char *)index_html);
-		hmap_set(album->preserved, album_meta, (char *)album_meta);
-		ssize_t deleted = rmextra(album->slug, album->preserved, prerm_imagedir,
-		                          album, site->dry_run);
-		if (deleted < 0) {
-			log_printl_errno(
-				LOG_ERROR,
-				"Something happened while deleting extraneous files");
-		} else {
-			album->images_updated += deleted;
-		}
-		if (album->images_updated > 0) {
-			site->render.albums_updated++;
+	return render_make_album(&site->render, album->slug, album);
+}
+
+static bool
+albums_walk(struct site *site)
+{
+	size_t        i;
+	struct album *album;
+	size_t        peak = 0;
+
+	vector_foreach (site->albums, i, album) {
+		if (!site->streaming) {
+			if (!album_build(site, album)) return false;
+			continue;
 		}
 
-		joinpathb(pathbuf, album->slug, index_html);
-		if (!render_make_album(&site->render, pathbuf, album)) return false;
+		if (!album_load_images(album)) return false;
+		if (!relocate_album(site, album)) return false;
+		if (!album_build(site, album)) return false;
+		/* The pages of the album need to be rendered before releasing it */
+		if (!render_wait(&site->render)) return false;
+		relocate_album_done(album);
+		render_unset_album_vars(&site->render);
+		album_release_images(album, site->config->index.previews);
+		if (site->scratch.reserved > peak) peak = site->scratch.reserved;
+		arena_reset(&site->scratch);
+	}
+
+	if (!render_wait(&site->render)) return false;
+	if (site->streaming) {
+		qsort(site->albums->values, site->albums->len, sizeof(void *),
+		      album_cmp);
+		log_printl(LOG_DETAIL,
+		           "Streamed %zu albums using at most %zu KiB for images",
+		           site->albums->len, peak / 1024);
 	}
 	return true;
 }
 
+/* A subdirectory waiting to be traversed */
+struct subdir {
+	struct stat st;
+	char        path[];
+};
+
+/*
+ * Whether the album's dir doesn't take the name of one of the dirs of the index
+ * pages, which are in the output dir along with the albums.
+ */
+static bool
+album_slug_check(const struct site *site, const struct album *album)
+{
+	if (strcmp(album->slug, PAGES_DIR)
+	    && (!site->config->index.years || strcmp(album->slug, YEARS_DIR))) {
+		return true;
+	}
+	log_printl(LOG_FATAL, "The album %s would be mixed up with the pages of "
+	           "the index", album->source);
+	return false;
+}
+
 /*
  * Recursively traverse the content directory. If there are images in the
  * directory, "create" an album. If an album.ini was found, then the title and
@@ -292,6 +1121,12 @@ albums_walk(struct site *site)
  * as its title. If the images are in the root of the content directory, then a
  * special "unorganized" album will be created. The title and description will
  * be used, but the slug will always be "unorganized".
+ *
+ * Subdirectories are traversed only after the current directory is done, so
+ * that the images of each album are laid out contiguously in the arena.
+ *
+ * In streaming builds the images are only counted here; they are loaded by
+ * album_load_images() right before building each album.
  */
 static bool
 traverse(struct site *site, const char *path, struct stat *dstat)
@@ -302,11 +1137,15 @@ traverse(struct site *site, const char *path, struct stat *dstat)
 		log_printl_errno(LOG_FATAL, "Can't open directory %s", path);
 		return false;
 	}
+	size_t               i, nimages = 0;
 	struct dirent       *ent;
+	struct subdir       *sub;
+	struct vector       *subdirs    = vector_new();
 	struct album_config *album_conf = calloc(1, sizeof *album_conf);
 	struct album        *album =
 		album_new(album_conf, site, path, path + site->rel_content_dir, dstat);
 	if (album == NULL) {
+		vector_free(subdirs);
 		closedir(dir);
 		return false;
 	}
@@ -316,7 +1155,8 @@ traverse(struct site *site, const char *path, struct stat *dstat)
 		}
 
 		struct stat fstats;
-		char       *subpath = joinpath(path, ent->d_name);
+		char        subpath[PATH_MAX];
+		joinpathb(subpath, path, ent->d_name);
 		if (stat(subpath, &fstats)) {
 			log_printl_errno(LOG_FATAL, "Can't read %s", subpath);
 			ok = false;
@@ -324,39 +1164,198 @@ traverse(struct site *site, const char *path, struct stat *dstat)
 		}
 
 		if (S_ISDIR(fstats.st_mode)) {
-			ok = traverse(site, subpath, &fstats);
-			if (!ok) goto fail;
+			sub = malloc(sizeof *sub + strlen(subpath) + 1);
+			if (sub == NULL) {
+				log_printl_errno(LOG_FATAL, "Memory allocation error");
+				ok = false;
+				goto fail;
+			}
+			sub->st = fstats;
+			strcpy(sub->path, subpath);
+			vector_push(subdirs, sub);
 		} else if (!strcmp(ent->d_name, ALBUM_CONF)) {
 			ok = album_config_read_ini(subpath, album_conf);
 			if (!ok) goto fail;
 			album->modtime = fstats.st_mtim;
 		} else if (isimage(subpath)) {
+			nimages++;
+			if (site->streaming) continue;
 			struct image *image = image_new(subpath, &fstats, album);
 			if (image == NULL) {
-				free(subpath);
 				goto fail;
 			}
 			album_add_image(album, image);
-			continue;
 		}
-		free(subpath);
 	}
+	closedir(dir);
 
-	if (album->images->len != 0) {
-		album_set_year(album);
-		qsort(album->images->values, album->images->len, sizeof(void *),
-		      image_cmp);
+	if (nimages != 0 && !album_slug_check(site, album)) {
+		ok = false;
+		album_destroy(album);
+	} else if (nimages != 0) {
+		if (!site->streaming) album_sort_images(album);
 		vector_push(site->albums, album);
-		closedir(dir);
-		return true;
+	} else {
+		album_destroy(album);
+	}
+
+	vector_foreach (subdirs, i, sub) {
+		if (ok) ok = traverse(site, sub->path, &sub->st);
+		free(sub);
 	}
+	vector_free(subdirs);
+	return ok;
 
 fail:
 	album_destroy(album);
 	closedir(dir);
+	vector_foreach (subdirs, i, sub) {
+		free(sub);
+	}
+	vector_free(subdirs);
 	return ok;
 }
 
+/* Two pictures that look alike, see duplicates_write() */
+struct duplicate {
+	unsigned    distance;
+	const char *a;
+	const char *b;
+};
+
+static int
+duplicate_cmp(const void *va, const void *vb)
+{
+	const struct duplicate *a = va, *b = vb;
+	if (a->distance != b->distance) return a->distance < b->distance ? -1 : 1;
+	int cmp = strcmp(a->a, b->a);
+	return cmp ? cmp : strcmp(a->b, b->b);
+}
+
+/* The bits of a hash in one band, and the index of the picture it is from */
+struct band_key {
+	uint64_t bits;
+	size_t   index;
+};
+
+static int
+band_key_cmp(const void *va, const void *vb)
+{
+	const struct band_key *a = va, *b = vb;
+	if (a->bits != b->bits) return a->bits < b->bits ? -1 : 1;
+	return (a->index > b->index) - (a->index < b->index);
+}
+
+/* Whether the hashes of a and b have one of the bands before last in common */
+static bool
+band_shared(const struct site_phash *a, const struct site_phash *b,
+            unsigned last)
+{
+	for (unsigned band = 0; band < last; band++) {
+		if (phash_band(a->phash, band) == phash_band(b->phash, band)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+duplicate_add(struct duplicate **dups, size_t *n, size_t *cap,
+              const struct site_phash *a, const struct site_phash *b,
+              unsigned distance)
+{
+	if (*n == *cap) {
+		size_t            ncap = *cap ? *cap * 2 : 64;
+		struct duplicate *tmp  = realloc(*dups, ncap * sizeof **dups);
+		if (tmp == NULL) {
+			log_printl_errno(LOG_FATAL, "Memory allocation error");
+			return false;
+		}
+		*dups = tmp;
+		*cap  = ncap;
+	}
+	/* In the same order regardless of the order of the albums */
+	bool swap       = strcmp(a->path, b->path) > 0;
+	(*dups)[(*n)++] = (struct duplicate){
+		.distance = distance,
+		.a        = swap ? b->path : a->path,
+		.b        = swap ? a->path : b->path,
+	};
+	return true;
+}
+
+/*
+ * Writes every pair of pictures whose hashes are at most PHASH_NEAR bits apart
+ * to the report of duplicates, closest first. Such hashes have at least one of
+ * their PHASH_BANDS bands in common, so only the pictures that share a band
+ * are compared, after sorting them by each band in turn: O(n log n) for n
+ * pictures, plus the pairs that share a band, which are few unless most of
+ * the pictures look alike.
+ */
+static bool
+duplicates_write(struct site *site)
+{
+	struct vector    *hashes = site->phashes;
+	struct duplicate *dups   = NULL;
+	struct band_key  *keys   = NULL;
+	size_t            n = 0, cap = 0, len = hashes->len;
+
+	if (len > 1 && (keys = malloc(len * sizeof *keys)) == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return false;
+	}
+	for (unsigned band = 0; len > 1 && band < PHASH_BANDS; band++) {
+		for (size_t i = 0; i < len; i++) {
+			const struct site_phash *h = hashes->values[i];
+			keys[i] = (struct band_key){phash_band(h->phash, band), i};
+		}
+		qsort(keys, len, sizeof *keys, band_key_cmp);
+
+		size_t start, end;
+		for (start = 0; start < len; start = end) {
+			for (end = start + 1;
+			     end < len && keys[end].bits == keys[start].bits; end++)
+				;
+			for (size_t i = start; i < end; i++) {
+				const struct site_phash *a = hashes->values[keys[i].index];
+				for (size_t j = i + 1; j < end; j++) {
+					const struct site_phash *b = hashes->values[keys[j].index];
+					unsigned d = phash_distance(a->phash, b->phash);
+					/* Pairs that share an earlier band were found already */
+					if (d > PHASH_NEAR || band_shared(a, b, band)) continue;
+					if (!duplicate_add(&dups, &n, &cap, a, b, d)) {
+						free(keys);
+						free(dups);
+						return false;
+					}
+				}
+			}
+		}
+	}
+	free(keys);
+	qsort(dups, n, sizeof *dups, duplicate_cmp);
+
+	log_printl(LOG_INFO, "Writing %s", site->duplicates);
+	FILE *f = fopen(site->duplicates, "w");
+	if (f == NULL) {
+		log_printl_errno(LOG_ERROR, "Couldn't open %s", site->duplicates);
+		free(dups);
+		return false;
+	}
+	fprintf(f, "# Pictures that look alike: bits of their hashes that differ, "
+	           "out of 64, and their paths in the input dir\n");
+	for (size_t i = 0; i < n; i++) {
+		fprintf(f, "%u\t%s\t%s\n", dups[i].distance, dups[i].a, dups[i].b);
+	}
+	free(dups);
+	if (fclose(f)) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", site->duplicates);
+		return false;
+	}
+	log_printl(LOG_DETAIL, "Found %zu pairs of pictures that look alike", n);
+	return true;
+}
+
 bool
 site_build(struct site *site)
 {
@@ -373,12 +1372,34 @@ site_build(struct site *site)
 		return false;
 	}
 
+	if (!(site->streaming ? relocate_init(site) : relocate(site))) {
+		return false;
+	}
+
 	if (!albums_walk(site)) {
 		return false;
 	}
+	cache_trim(&site->cache);
+	if (!site->dry_run && !meta_write(&site->meta, META_FILE)) {
+		log_printl(LOG_ERROR, "Warning: couldn't update %s", META_FILE);
+	}
+	hmap_set(site->album_dirs, META_FILE, META_FILE);
+	hmap_set(site->album_dirs, TEMPLATES_STAMP, TEMPLATES_STAMP);
 
-	if (!render_make_index(&site->render, index_html)) return false;
+	if (!render_make_index(&site->render, ".", site->albums)) {
+		return false;
+	}
 	hmap_set(site->album_dirs, index_html, (char *)index_html);
+	hmap_set(site->album_dirs, PAGES_DIR, PAGES_DIR);
+	hmap_set(site->album_dirs, PAGES_FILE, PAGES_FILE);
+	if (site->config->index.years) {
+		hmap_set(site->album_dirs, YEARS_DIR, YEARS_DIR);
+	}
+
+	if (site->config->output.hash_names) {
+		if (!assets_conf_write(".", site->dry_run)) return false;
+		hmap_set(site->album_dirs, ASSETS_CONF, ASSETS_CONF);
+	}
 
 	joinpathb(staticp, site->root_dir, STATICDIR);
 	if (stat(staticp, &dstat)) {
@@ -393,13 +1414,35 @@ site_build(struct site *site)
 				LOG_ERROR,
 				"Something happened while deleting extraneous files");
 		}
-	} else if (!filesync(staticp, site->output_dir, site->album_dirs,
-	                     site->dry_run)) {
+	} else if (!(site->config->output.hash_names
+	               ? assets_sync(&site->render.assets, staticp,
+	                             site->album_dirs, site->dry_run)
+	               : filesync(staticp, site->output_dir, site->album_dirs,
+	                          site->dry_run))) {
 		log_printl(LOG_FATAL, "Can't copy static files");
 		return false;
+	} else if (!compress_tree(staticp, site->output_dir, site->render.nworkers,
+	                          site->dry_run)) {
+		log_printl(LOG_ERROR, "Warning: couldn't compress static files");
+	}
+
+	if (site->quality.images > 0) {
+		log_printl(LOG_DETAIL,
+		           "Chose the quality of %zu images by their ssim, saving "
+		           "%zu KiB",
+		           site->quality.images, site->quality.saved / 1024);
+	}
+	struct rusage usage;
+	if (!getrusage(RUSAGE_SELF, &usage)) {
+		log_printl(LOG_DETAIL, "Built the site using at most %ld KiB of memory",
+		           usage.ru_maxrss);
 	}
 
 	chdir(startwd);
+	if (site->duplicates != NULL && !site->dry_run
+	    && !duplicates_write(site)) {
+		log_printl(LOG_ERROR, "Warning: couldn't write %s", site->duplicates);
+	}
 	return true;
 }
 
@@ -412,19 +1455,50 @@ site_load(struct site *site)
 		return false;
 	}
 
+	char metapath[PATH_MAX];
+	joinpathb(metapath, site->output_dir, META_FILE);
+	meta_open(&site->meta, metapath);
+
+	/* What the load adds to the arenas is what it would have malloc'd */
+	size_t nallocs = site->arena.nallocs + site->scratch.nallocs;
+	size_t nblocks = site->arena.nblocks + site->scratch.nblocks;
 	if (!traverse(site, site->content_dir, &cstat)) return false;
-	qsort(site->albums->values, site->albums->len, sizeof(void *), album_cmp);
+	/* In streaming builds the dates are only known once the albums are built */
+	if (!site->streaming) {
+		qsort(site->albums->values, site->albums->len, sizeof(void *),
+		      album_cmp);
+	}
 
-	return render_init(&site->render, site->root_dir, site->config,
-	                   site->albums);
+	size_t        i, nimages = 0;
+	struct album *album;
+	vector_foreach (site->albums, i, album) {
+		nimages += album->images->len;
+	}
+	nallocs = site->arena.nallocs + site->scratch.nallocs - nallocs;
+	nblocks = site->arena.nblocks + site->scratch.nblocks - nblocks;
+	log_printl(LOG_DETAIL, "Loaded %zu albums with %zu images",
+	           site->albums->len, nimages);
+	log_printl(LOG_DETAIL,
+	           "Allocations: %zu arena blocks instead of %zu mallocs, "
+	           "%zu per image (%zu KiB used)",
+	           nblocks, nallocs, nimages ? nallocs / nimages : 0,
+	           site->arena.used / 1024);
+	log_printl(LOG_DETAIL, "Metadata of %zu of %zu images was up to date",
+	           site->meta.hits, site->meta.len);
+
+	return render_init(&site->render, site->root_dir, site->output_dir,
+	                   site->config);
 }
 
 bool
 site_init(struct site *site)
 {
+	arena_init(&site->arena, ARENA_BLOCK_SIZE);
+	arena_init(&site->scratch, ARENA_BLOCK_SIZE);
 	site->config = site_config_init();
 	if (!site_config_read_ini(site->root_dir, site->config)) return false;
 	site->albums = vector_new();
+	site->manifests = vector_new();
 
 	if (site->root_dir == NULL) {
 		site->root_dir = malloc(PATH_MAX);
@@ -437,9 +1511,20 @@ site_init(struct site *site)
 	site->content_dir     = joinpath(site->root_dir, CONTENTDIR);
 	site->rel_content_dir = strlen(site->root_dir) + 1;
 	InitializeMagick(NULL);
+	if (site->config->decode.max_memory > 0) {
+		unsigned long max = site->config->decode.max_memory * 1024 * 1024;
+		MagickSetResourceLimit(MemoryResource, max);
+		MagickSetResourceLimit(MapResource, max);
+	}
 	site->wand           = NewMagickWand();
+	if (!cache_init(&site->cache, &site->config->cache)) return false;
+	if (!compress_init(&site->config->compress)) return false;
 	site->album_dirs     = hmap_new();
-	site->render.dry_run = site->dry_run;
+	site->twins          = hmap_new();
+	if (site->duplicates != NULL) site->phashes = vector_new();
+	site->render.dry_run  = site->dry_run;
+	site->render.nworkers = site->jobs;
+	site->render.compile  = site->compile;
 
 	roscha_init();
 
@@ -457,6 +1542,21 @@ site_deinit(struct site *site)
 		}
 		vector_free(site->albums);
 	}
+	arena_free(&site->arena);
+	arena_free(&site->scratch);
+	meta_close(&site->meta);
+	if (site->orphans) hmap_free(site->orphans);
+	if (site->twins) hmap_free(site->twins);
+	if (site->phashes) vector_free(site->phashes);
+	free(site->duplicates);
+	if (site->manifests) {
+		size_t           i;
+		struct manifest *m;
+		vector_foreach (site->manifests, i, m) {
+			manifest_destroy(m);
+		}
+		vector_free(site->manifests);
+	}
 	site_config_destroy(site->config);
 	free(site->content_dir);
 	free(site->root_dir);
@@ -465,9 +1565,9 @@ site_deinit(struct site *site)
 		DestroyMagickWand(site->wand);
 		DestroyMagick();
 	}
+	render_deinit(&site->render);
 	if (!site->dry_run) {
 		hmap_free(site->album_dirs);
-		render_deinit(&site->render);
 	}
 
 	roscha_deinit();
@@ -0,0 +1,30 @@
+#include "sprite.h"
+
+void
+sprite_layout(struct sprite_cell *cells, size_t n, unsigned long *w,
+              unsigned long *h)
+{
+	unsigned long widest = 0, width, x = 0, y = 0, row = 0;
+	size_t        i, cols = 0;
+
+	for (i = 0; i < n; i++) {
+		if (cells[i].w > widest) widest = cells[i].w;
+	}
+	while (cols * cols < n) cols++;
+	width = cols * widest;
+
+	*w = 0;
+	for (i = 0; i < n; i++) {
+		if (x > 0 && x + cells[i].w > width) {
+			x = 0;
+			y += row;
+			row = 0;
+		}
+		cells[i].x = x;
+		cells[i].y = y;
+		x += cells[i].w;
+		if (x > *w) *w = x;
+		if (cells[i].h > row) row = cells[i].h;
+	}
+	*h = y + row;
+}
@@ -0,0 +1,99 @@
+#include "ssim.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define C1 (0.01 * 255 * 0.01 * 255)
+#define C2 (0.03 * 255 * 0.03 * 255)
+
+/* Sums of each column of a strip of rows, see ssim() */
+struct columns {
+	uint32_t *a;
+	uint32_t *b;
+	uint32_t *aa;
+	uint32_t *bb;
+	uint32_t *ab;
+};
+
+/*
+ * Adds a row of pixels to the sums of the columns. Every column is independent
+ * of the others, so that compilers can turn the loop into vector instructions.
+ */
+static void
+columns_add(struct columns *c, const unsigned char *restrict a,
+            const unsigned char *restrict b, size_t width)
+{
+	uint32_t *restrict sa = c->a, *restrict sb = c->b;
+	uint32_t *restrict saa = c->aa, *restrict sbb = c->bb, *restrict sab = c->ab;
+	for (size_t x = 0; x < width; x++) {
+		uint32_t pa = a[x], pb = b[x];
+		sa[x] += pa;
+		sb[x] += pb;
+		saa[x] += pa * pa;
+		sbb[x] += pb * pb;
+		sab[x] += pa * pb;
+	}
+}
+
+/* The SSIM of a window out of the sums of its n pixels */
+static double
+window_ssim(uint64_t a, uint64_t b, uint64_t aa, uint64_t bb, uint64_t ab,
+            size_t n)
+{
+	double ma = (double)a / n, mb = (double)b / n;
+	double va  = (double)aa / n - ma * ma;
+	double vb  = (double)bb / n - mb * mb;
+	double cov = (double)ab / n - ma * mb;
+	return ((2 * ma * mb + C1) * (2 * cov + C2))
+	     / ((ma * ma + mb * mb + C1) * (va + vb + C2));
+}
+
+/*
+ * The rows are taken a strip of SSIM_WINDOW at a time; the sums of the columns
+ * of the strip are then added up SSIM_WINDOW columns at a time into the sums
+ * of each window.
+ */
+bool
+ssim(const unsigned char *a, const unsigned char *b, size_t width,
+     size_t height, double *score)
+{
+	if (width == 0 || height == 0) return false;
+	size_t wx = width < SSIM_WINDOW ? width : SSIM_WINDOW;
+	size_t wy = height < SSIM_WINDOW ? height : SSIM_WINDOW;
+	size_t nx = width / wx, ny = height / wy;
+
+	uint32_t *mem = calloc(width * 5, sizeof *mem);
+	if (mem == NULL) return false;
+	struct columns c = {
+		.a  = mem,
+		.b  = mem + width,
+		.aa = mem + width * 2,
+		.bb = mem + width * 3,
+		.ab = mem + width * 4,
+	};
+
+	double total = 0;
+	for (size_t sy = 0; sy < ny; sy++) {
+		for (size_t i = 0; i < width * 5; i++) {
+			mem[i] = 0;
+		}
+		for (size_t y = sy * wy; y < (sy + 1) * wy; y++) {
+			columns_add(&c, a + y * width, b + y * width, width);
+		}
+		for (size_t sx = 0; sx < nx; sx++) {
+			uint64_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+			for (size_t x = sx * wx; x < (sx + 1) * wx; x++) {
+				sa += c.a[x];
+				sb += c.b[x];
+				saa += c.aa[x];
+				sbb += c.bb[x];
+				sab += c.ab[x];
+			}
+			total += window_ssim(sa, sb, saa, sbb, sab, wx * wy);
+		}
+	}
+	free(mem);
+
+	*score = total / (nx * ny);
+	return true;
+}
@@ -0,0 +1,83 @@
+#include "tests/tests.h"
+#include "arena.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdalign.h>
+
+#define TEST_BLOCK_SIZE 256
+
+static void
+test_arena_alloc(void)
+{
+	struct arena arena;
+	arena_init(&arena, TEST_BLOCK_SIZE);
+	for (size_t i = 1; i < 100; i++) {
+		char     *p        = arena_alloc(&arena, i);
+		uintptr_t misalign = (uintptr_t)p & (alignof(max_align_t) - 1);
+		assertneq(p, NULL);
+		asserteq(misalign, 0);
+		memset(p, 'x', i);
+	}
+	asserteq(arena.nallocs, 99);
+	asserteq(arena.used <= arena.reserved, true);
+	arena_free(&arena);
+	asserteq(arena.nblocks, 0);
+}
+
+static void
+test_arena_big_alloc(void)
+{
+	struct arena arena;
+	arena_init(&arena, TEST_BLOCK_SIZE);
+	char *small = arena_alloc(&arena, 8);
+	char *big   = arena_alloc(&arena, TEST_BLOCK_SIZE * 4);
+	char *next  = arena_alloc(&arena, 8);
+	assertneq(big, NULL);
+	/* The big allocation shouldn't make the arena skip the rest of the block */
+	asserteq(next - small, (ptrdiff_t)alignof(max_align_t));
+	asserteq(arena.nblocks, 2);
+	arena_free(&arena);
+}
+
+static void
+test_arena_strings(void)
+{
+	struct arena arena;
+	arena_init(&arena, TEST_BLOCK_SIZE);
+	char *dup    = arena_strdup(&arena, "hello");
+	char *joined = arena_joinpath(&arena, "hello", "world.jpeg");
+	asserteq(strcmp(dup, "hello"), 0);
+	asserteq(strcmp(joined, "hello/world.jpeg"), 0);
+	arena_free(&arena);
+}
+
+static void
+test_arena_reset(void)
+{
+	struct arena arena;
+	arena_init(&arena, TEST_BLOCK_SIZE);
+	for (size_t i = 0; i < 64; i++) {
+		arena_alloc(&arena, 32);
+	}
+	arena_reset(&arena);
+	asserteq(arena.nblocks, 1);
+	asserteq(arena.used, 0);
+	/* Served from the block that was kept, already aligned as it is */
+	char *again = arena_alloc(&arena, alignof(max_align_t));
+	assertneq(again, NULL);
+	asserteq(arena.nblocks, 1);
+	asserteq(arena.used, alignof(max_align_t));
+	arena_free(&arena);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_arena_alloc);
+	RUN_TEST(test_arena_big_alloc);
+	RUN_TEST(test_arena_strings);
+	RUN_TEST(test_arena_reset);
+}
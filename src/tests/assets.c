@@ -0,0 +1,100 @@
+#include "tests/tests.h"
+#include "log.h"
+#include "assets.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define TEST_DIR "/tmp/revela-test-assets"
+#define SRC_DIR  TEST_DIR "/static"
+#define OUT_DIR  TEST_DIR "/out"
+
+static void
+test_assets_tagged_name(void)
+{
+	char buf[PATH_MAX];
+	asserteq(assets_tagged_name("css/gallery.css", "rv-1a2b3c4d", buf,
+	                            sizeof buf),
+	         true);
+	asserteq(strcmp(buf, "css/gallery.rv-1a2b3c4d.css"), 0);
+	asserteq(assets_tagged_name("js.d/LICENSE", "rv-1a2b3c4d", buf, sizeof buf),
+	         true);
+	asserteq(strcmp(buf, "js.d/LICENSE.rv-1a2b3c4d"), 0);
+	asserteq(assets_tagged_name(".htaccess", "rv-1a2b3c4d", buf, sizeof buf),
+	         true);
+	asserteq(strcmp(buf, ".htaccess.rv-1a2b3c4d"), 0);
+	asserteq(assets_tagged_name("a.css", "rv-1a2b3c4d", buf, 8), false);
+}
+
+static void
+test_assets_tag(void)
+{
+	char tag[ASSETS_TAG_LEN + 1];
+	assets_tag(0x1a2b3c4d5e6f7081, tag);
+	asserteq(strcmp(tag, "rv-1a2b3c4d"), 0);
+}
+
+static void
+write_file(const char *path, const char *contents)
+{
+	FILE *f = fopen(path, "w");
+	fputs(contents, f);
+	fclose(f);
+}
+
+static void
+test_assets_sync(void)
+{
+	struct assets       assets;
+	const struct asset *asset;
+	char                startwd[PATH_MAX], path[PATH_MAX];
+	struct stat         st;
+
+	mkdir(TEST_DIR, 0755);
+	mkdir(SRC_DIR, 0755);
+	mkdir(SRC_DIR "/css", 0755);
+	mkdir(OUT_DIR, 0755);
+	mkdir(OUT_DIR "/css", 0755);
+	write_file(SRC_DIR "/css/gallery.css", "body { margin: 0; }\n");
+	write_file(OUT_DIR "/css/gallery.00000000.css", "old\n");
+
+	asserteq(assets_load(&assets, SRC_DIR, "https://x.org", true), true);
+	asserteq(assets.list->len, 1);
+	asset = hmap_get(assets.paths, "css/gallery.css");
+	asserteq(asset != NULL, true);
+	asserteq(strncmp(asset->name, "css/gallery.", 12), 0);
+	asserteq(strlen(asset->name), strlen("css/gallery..css") + ASSETS_TAG_LEN);
+	asserteq(strncmp(asset->url, "https://x.org/css/gallery.", 26), 0);
+
+	getcwd(startwd, sizeof startwd);
+	chdir(OUT_DIR);
+	asserteq(assets_sync(&assets, SRC_DIR, NULL, false), true);
+	asserteq(stat("css/gallery.css", &st), 0);
+	asserteq(stat(asset->name, &st), 0);
+	asserteq(stat("css/gallery.00000000.css", &st), -1);
+	chdir(startwd);
+
+	snprintf(path, sizeof path, OUT_DIR "/%s", asset->name);
+	unlink(path);
+	assets_free(&assets);
+	unlink(OUT_DIR "/css/gallery.css");
+	unlink(SRC_DIR "/css/gallery.css");
+	rmdir(OUT_DIR "/css");
+	rmdir(OUT_DIR);
+	rmdir(SRC_DIR "/css");
+	rmdir(SRC_DIR);
+	rmdir(TEST_DIR);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	log_set_verbosity(LOG_SILENT);
+	RUN_TEST(test_assets_tagged_name);
+	RUN_TEST(test_assets_tag);
+	RUN_TEST(test_assets_sync);
+}
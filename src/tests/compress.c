@@ -0,0 +1,73 @@
+#include "tests/tests.h"
+#include "log.h"
+#include "compress.h"
+
+#include <zlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define TEST_DIR  "/tmp/revela-test-compress"
+#define TEST_FILE TEST_DIR "/index.html"
+
+static void
+test_compress_stem(void)
+{
+	char                   stem[NAME_MAX + 1];
+	struct compress_config conf = {.gzip = false};
+
+	asserteq(compress_init(&conf), true);
+	asserteq(compress_enabled(), false);
+	asserteq(compress_stem("index.html.gz", stem, sizeof stem), false);
+
+	conf.gzip = true;
+	asserteq(compress_init(&conf), true);
+	asserteq(compress_enabled(), true);
+	asserteq(compress_stem("index.html.gz", stem, sizeof stem), true);
+	asserteq(strcmp(stem, "index.html"), 0);
+	asserteq(compress_stem("index.html", stem, sizeof stem), false);
+	asserteq(compress_stem(".gz", stem, sizeof stem), false);
+}
+
+static void
+test_compress_iov(void)
+{
+	struct compress_config conf  = {.gzip = true};
+	struct timespec        mtim  = {.tv_sec = 1600000000, .tv_nsec = 0};
+	struct timespec        other = {.tv_sec = 1500000000, .tv_nsec = 0};
+	char                   buf[64];
+	struct iovec           iov[] = {
+		{.iov_base = "<p>hello ", .iov_len = 9},
+		{.iov_base = "world</p>", .iov_len = 9},
+	};
+
+	asserteq(compress_init(&conf), true);
+	mkdir(TEST_DIR, 0755);
+	unlink(TEST_FILE ".gz");
+	asserteq(compress_uptodate(TEST_FILE, NULL), 0);
+	asserteq(compress_iov(TEST_FILE, iov, 2, &mtim), true);
+	asserteq(compress_uptodate(TEST_FILE, NULL), 1);
+	asserteq(compress_uptodate(TEST_FILE, &mtim), 1);
+	asserteq(compress_uptodate(TEST_FILE, &other), 0);
+
+	gzFile gz = gzopen(TEST_FILE ".gz", "rb");
+	asserteq(gz != NULL, true);
+	int n = gzread(gz, buf, sizeof buf);
+	gzclose(gz);
+	asserteq(n, 18);
+	asserteq(memcmp(buf, "<p>hello world</p>", 18), 0);
+
+	unlink(TEST_FILE ".gz");
+	rmdir(TEST_DIR);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	log_set_verbosity(LOG_SILENT);
+	RUN_TEST(test_compress_stem);
+	RUN_TEST(test_compress_iov);
+}
@@ -21,12 +21,34 @@ test_site_config_read_ini(void)
 	asserteq(config->images.max_height, 2000);
 	asserteq(config->images.smart_resize, true);
 	asserteq(fabs(config->images.blur - 0.0) < 0.0001, true);
+	asserteq(fabs(config->images.ssim - 0.985) < 0.0001, true);
 	asserteq(config->thumbnails.strip, true);
 	asserteq(config->thumbnails.quality, 75);
 	asserteq(config->thumbnails.max_width, 400);
 	asserteq(config->thumbnails.max_height, 270);
 	asserteq(config->thumbnails.smart_resize, true);
 	asserteq(fabs(config->thumbnails.blur - 0.1) < 0.0001, true);
+	asserteq(config->thumbnails.ssim, 0);
+	asserteq(strcmp(config->cache.dir, "/tmp/revela-cache"), 0);
+	asserteq(config->cache.max_size, 512);
+	asserteq(config->index.previews, 6);
+	asserteq(config->index.per_page, 20);
+	asserteq(config->index.years, true);
+	asserteq(config->albums.per_page, 48);
+	asserteq(config->albums.viewer, true);
+	asserteq(config->albums.layout, LAYOUT_SHARDED);
+	asserteq(config->albums.sprite, 64);
+	asserteq(config->compress.gzip, true);
+	asserteq(config->compress.brotli, false);
+	asserteq(config->output.minify, true);
+	asserteq(config->output.hash_names, true);
+	asserteq(config->output.format, POLICY_AUTO);
+	asserteq(config->output.webp, true);
+	asserteq(config->zoom.min_megapixels, 50);
+	asserteq(config->zoom.tile_size, 510);
+	asserteq(config->zoom.overlap, 1);
+	asserteq(config->decode.scaled, false);
+	asserteq(config->decode.max_memory, 256);
 	site_config_destroy(config);
 }
 
@@ -0,0 +1,60 @@
+#include "tests/tests.h"
+#include "exif.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+static void
+test_exif_parse_datetime(void)
+{
+	char      datestr[EXIF_DATELEN + 1];
+	time_t    tstamp;
+	struct tm tm = {
+		.tm_year  = 2021 - 1900,
+		.tm_mon   = 2,
+		.tm_mday  = 4,
+		.tm_hour  = 5,
+		.tm_min   = 6,
+		.tm_sec   = 7,
+		.tm_isdst = -1,
+	};
+	asserteq(exif_parse_datetime("2021:03:04 05:06:07", &tstamp, datestr),
+	         true);
+	asserteq(strcmp(datestr, "2021-03-04 05:06:07"), 0);
+	asserteq(tstamp, mktime(&tm));
+
+	/* Same hour, so the start of the hour is reused */
+	asserteq(exif_parse_datetime("2021:03:04 05:59:58", &tstamp, datestr),
+	         true);
+	tm.tm_min   = 59;
+	tm.tm_sec   = 58;
+	tm.tm_isdst = -1;
+	asserteq(tstamp, mktime(&tm));
+}
+
+static void
+test_exif_parse_datetime_invalid(void)
+{
+	char   datestr[EXIF_DATELEN + 1];
+	time_t tstamp;
+	asserteq(exif_parse_datetime("0000:00:00 00:00:00", &tstamp, datestr),
+	         false);
+	asserteq(exif_parse_datetime("    :  :     :  :  ", &tstamp, datestr),
+	         false);
+	asserteq(exif_parse_datetime("2021:13:04 05:06:07", &tstamp, datestr),
+	         false);
+	asserteq(exif_parse_datetime("2021-03-04T05:06:07", &tstamp, datestr),
+	         false);
+	asserteq(exif_parse_datetime("2021:03:04", &tstamp, datestr), false);
+}
+
+int
+main(void)
+{
+	/* Make the results independent of the local timezone */
+	setenv("TZ", "UTC", 1);
+	tzset();
+	INIT_TESTS();
+	RUN_TEST(test_exif_parse_datetime);
+	RUN_TEST(test_exif_parse_datetime_invalid);
+}
@@ -0,0 +1,73 @@
+#include "tests/tests.h"
+#include "format.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define W 40
+#define H 30
+
+static unsigned char rgba[W * H * 4];
+
+static void
+test_format_analyze(void)
+{
+	struct format_stats stats;
+	uint32_t            seed = 1;
+
+	/* Two flat halves */
+	for (size_t i = 0; i < W * H; i++) {
+		unsigned char v = i % W < W / 2 ? 0x10 : 0xf0;
+		memset(rgba + i * 4, v, 3);
+		rgba[i * 4 + 3] = 0xff;
+	}
+	format_analyze(rgba, W, H, &stats);
+	asserteq(stats.colors, 2);
+	asserteq(stats.alpha, false);
+	asserteq(stats.flat > 0.95, true);
+	asserteq(stats.edges > 0 && stats.edges < 0.05, true);
+	asserteq(format_kind(&stats), KIND_PALETTE);
+
+	rgba[3] = 0x80;
+	format_analyze(rgba, W, H, &stats);
+	asserteq(format_kind(&stats), KIND_ALPHA);
+
+	/* Noise, with far more colors than a palette */
+	for (size_t i = 0; i < W * H * 4; i++) {
+		seed    = seed * 1103515245 + 12345;
+		rgba[i] = i % 4 == 3 ? 0xff : seed >> 24;
+	}
+	format_analyze(rgba, W, H, &stats);
+	asserteq(stats.colors, FORMAT_PALETTE_COLORS + 1);
+	asserteq(stats.flat < 0.01, true);
+	asserteq(format_kind(&stats), KIND_PHOTO);
+
+	/* Text-like strokes over a flat background, with many colors */
+	for (size_t i = 0; i < W * H; i++) {
+		if (i % 3 == 0) continue;
+		memset(rgba + i * 4, 0xfe, 3);
+	}
+	format_analyze(rgba, W, H, &stats);
+	asserteq(format_kind(&stats), KIND_GRAPHIC);
+}
+
+static void
+test_format_choose(void)
+{
+	asserteq(format_choose(KIND_PHOTO, false), FORMAT_JPEG);
+	asserteq(format_choose(KIND_PHOTO, true), FORMAT_WEBP);
+	asserteq(format_choose(KIND_ALPHA, false), FORMAT_PNG);
+	asserteq(format_choose(KIND_ALPHA, true), FORMAT_WEBP);
+	asserteq(format_choose(KIND_GRAPHIC, true), FORMAT_PNG);
+	asserteq(format_choose(KIND_PALETTE, true), FORMAT_PNG);
+	asserteq(strcmp(format_ext(FORMAT_WEBP), ".webp"), 0);
+	asserteq(strcmp(format_name(FORMAT_JPEG), "jpeg"), 0);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_format_analyze);
+	RUN_TEST(test_format_choose);
+}
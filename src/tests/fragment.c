@@ -0,0 +1,139 @@
+#include "tests/tests.h"
+#include "fragment.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void
+test_fragments_split(void)
+{
+	struct fragments frags;
+	const char      *src = "{% extends \"base.html\" %}\n"
+	                       "{% block content %}\n"
+	                       "<img src=\"{{ image.source }}\">\n"
+	                       "<h3>{% if album.title %}{{ album.title }}"
+	                       "{% else %}Untitled{% endif %} in {{ title }}</h3>\n"
+	                       "<p>{{ image.date }}</p>\n"
+	                       "{% endblock %}\n";
+
+	const char *frag = "\">\n<h3>{% if album.title %}{{ album.title }}"
+	                   "{% else %}Untitled{% endif %} in {{ title }}</h3>\n<p>";
+	const char *tmpl = "{% extends \"base.html\" %}\n"
+	                   "{% block content %}\n"
+	                   "<img src=\"{{ image.source }}{{ frags.f0 }}"
+	                   "{{ image.date }}</p>\n"
+	                   "{% endblock %}\n";
+
+	asserteq(fragments_split(&frags, src, "image", "frags"), true);
+	asserteq(frags.len, 1);
+	asserteq(strcmp(frags.srcs[0], frag), 0);
+	asserteq(strcmp(frags.keys[0], "f0"), 0);
+	asserteq(strcmp(frags.tmpl, tmpl), 0);
+	fragments_free(&frags);
+}
+
+static void
+test_fragments_split_statements(void)
+{
+	struct fragments frags;
+	/* Statements that refer to the dep can't be folded, even nested ones */
+	const char *src = "{{ title }}{% for t in album.thumbs %}"
+	                  "{% if t.link == image.next %}x{% endif %}{% endfor %}"
+	                  "{% include \"footer.html\" %}{{ album.year }}";
+
+	asserteq(fragments_split(&frags, src, "image", "frags"), true);
+	asserteq(frags.len, 2);
+	asserteq(strcmp(frags.srcs[0], "{{ title }}"), 0);
+	asserteq(strcmp(frags.srcs[1], "{{ album.year }}"), 0);
+	fragments_free(&frags);
+
+	/* Only whole identifiers count */
+	src = "{{ album.images }}{{ imagery }}";
+	asserteq(fragments_split(&frags, src, "image", "frags"), true);
+	asserteq(frags.len, 1);
+	asserteq(strcmp(frags.tmpl, "{{ frags.f0 }}"), 0);
+	fragments_free(&frags);
+}
+
+static void
+test_fragments_split_none(void)
+{
+	struct fragments frags;
+	/* Plain text is not worth a fragment */
+	asserteq(fragments_split(&frags, "<p>{{ image.date }}</p>", "image",
+	                         "frags"),
+	         true);
+	asserteq(frags.len, 0);
+	asserteq(frags.tmpl == NULL, true);
+
+	/* Neither is anything after an unterminated tag */
+	const char *src = "{{ image.date }}{% if title ";
+	asserteq(fragments_split(&frags, src, "image", "frags"), true);
+	asserteq(frags.len, 0);
+}
+
+static const char *
+lookup(const char *name, void *data)
+{
+	const char *const *tmpls = data;
+	for (; *tmpls != NULL; tmpls += 2) {
+		if (!strcmp(tmpls[0], name)) return tmpls[1];
+	}
+	return NULL;
+}
+
+static void
+test_fragments_flatten(void)
+{
+	const char *tmpls[] = {
+		"base.html",
+		"<head><title>{% block title %}{{ title }}{% endblock %}</title>"
+		"</head>{% block content %}{% block inner %}x{% endblock %}"
+		"{% endblock %}</html>",
+		"page.html",
+		"{% extends \"base.html\" %}ignored{% block title %}P{% endblock %}",
+		NULL,
+	};
+	const char *src = "{% extends \"page.html\" %}\n"
+	                  "{% block content %}<p>{{ image.date }}</p>"
+	                  "{% endblock %}";
+
+	char *flat = fragments_flatten(src, lookup, tmpls);
+	asserteq(flat == NULL, false);
+	asserteq(strcmp(flat, "<head><title>P</title></head>"
+	                      "<p>{{ image.date }}</p></html>"),
+	         0);
+	free(flat);
+
+	/* Blocks that aren't overridden keep their contents, nested ones too */
+	src  = "{% extends \"base.html\" %}{% block inner %}y{% endblock %}";
+	flat = fragments_flatten(src, lookup, tmpls);
+	asserteq(strcmp(flat, "<head><title>{{ title }}</title></head>y</html>"),
+	         0);
+
+	/* The head is now a fragment of its own */
+	struct fragments frags;
+	asserteq(fragments_split(&frags, flat, "image", "frags"), true);
+	asserteq(frags.len, 1);
+	free(flat);
+	fragments_free(&frags);
+
+	/* Nothing to inline, and what can't be inlined */
+	asserteq(fragments_flatten("<p>{{ title }}</p>", lookup, tmpls) == NULL,
+	         true);
+	src = "{% extends \"missing.html\" %}";
+	asserteq(fragments_flatten(src, lookup, tmpls) == NULL, true);
+	src = "{% extends \"base.html\" %}{% block title %}{{ super() }}"
+	      "{% endblock %}";
+	asserteq(fragments_flatten(src, lookup, tmpls) == NULL, true);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_fragments_split);
+	RUN_TEST(test_fragments_split_statements);
+	RUN_TEST(test_fragments_split_none);
+	RUN_TEST(test_fragments_flatten);
+}
@@ -0,0 +1,49 @@
+#include "tests/tests.h"
+#include "hash.h"
+
+#include <string.h>
+
+static void
+test_hash_incremental(void)
+{
+	const char *data  = "The quick brown fox jumps over the lazy dog";
+	size_t      len   = strlen(data);
+	uint64_t    whole = hash_bytes(data, len, 0);
+
+	for (size_t split = 0; split <= len; split++) {
+		struct hash_state s;
+		hash_init(&s, 0);
+		hash_update(&s, data, split);
+		hash_update(&s, data + split, len - split);
+		asserteq(hash_final(&s), whole);
+	}
+}
+
+static void
+test_hash_differs(void)
+{
+	uint64_t a = hash_bytes("hello.jpg", 9, 0);
+	uint64_t b = hash_bytes("hello.jpe", 9, 0);
+	uint64_t c = hash_bytes("hello.jpg", 9, 1);
+	uint64_t d = hash_bytes("hello.jpg\0", 10, 0);
+	assertneq(a, b);
+	assertneq(a, c);
+	assertneq(a, d);
+}
+
+static void
+test_hash_hex(void)
+{
+	char buf[HASH_HEXLEN + 1];
+	hash_hex(0xdeadbeefULL, buf);
+	asserteq(strcmp(buf, "00000000deadbeef"), 0);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_hash_incremental);
+	RUN_TEST(test_hash_differs);
+	RUN_TEST(test_hash_hex);
+}
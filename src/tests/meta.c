@@ -0,0 +1,103 @@
+#include "tests/tests.h"
+#include "meta.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_META "/tmp/revela-test-meta"
+
+static void
+test_meta_roundtrip(void)
+{
+	struct meta          meta;
+	struct image_exif    exif = {0}, found;
+	struct stat          st   = {0};
+	struct meta_thumb    thumb = {"#102030", 400, 267}, none = {0}, ft;
+	struct meta_encoding enc   = {0}, fe;
+	size_t               index;
+
+	unlink(TEST_META);
+	meta_open(&meta, TEST_META);
+	asserteq(meta.nold, 0);
+
+	st.st_size         = 1234;
+	st.st_mtim.tv_sec  = 1600000000;
+	st.st_mtim.tv_nsec = 42;
+	exif.present       = true;
+	exif.iso           = 200;
+	strcpy(exif.camera, "Test camera");
+	meta_add(&meta, "content/a/1.jpg", &st, &exif, &thumb, &enc);
+	exif.iso = 400;
+	index    = meta_add(&meta, "content/b/2.jpg", &st, &exif, &none, &enc);
+	asserteq(index, 1);
+	asserteq(meta.changed, false);
+	thumb = (struct meta_thumb){"#405060", 180, 270};
+	meta_set_thumb(&meta, index, &thumb);
+	asserteq(meta.changed, true);
+	enc = (struct meta_encoding){0xabc, 0x1234567890abcdef, 72, 64, 3, 1};
+	meta_set_encoding(&meta, index, &enc);
+	asserteq(meta_write(&meta, TEST_META), true);
+	meta_close(&meta);
+
+	meta_open(&meta, TEST_META);
+	asserteq(meta.nold, 2);
+	asserteq(meta_lookup(&meta, "content/a/1.jpg", &st, &found, &ft, &fe),
+	         true);
+	asserteq(found.iso, 200);
+	asserteq(strcmp(found.camera, "Test camera"), 0);
+	asserteq(strcmp(ft.placeholder, "#102030"), 0);
+	asserteq(ft.width, 400);
+	asserteq(ft.height, 267);
+	asserteq(fe.key, 0);
+	asserteq(fe.image_quality, 0);
+	asserteq(meta_lookup(&meta, "content/b/2.jpg", &st, &found, &ft, &fe),
+	         true);
+	asserteq(found.iso, 400);
+	asserteq(strcmp(ft.placeholder, "#405060"), 0);
+	asserteq(ft.width, 180);
+	asserteq(fe.key, 0xabc);
+	asserteq(fe.image_quality, 72);
+	asserteq(fe.thumb_quality, 64);
+	asserteq(fe.kind, 3);
+	asserteq(fe.phash, 0x1234567890abcdef);
+	asserteq(fe.phashed, 1);
+	asserteq(meta_lookup(&meta, "content/c/3.jpg", &st, &found, &ft, &fe),
+	         false);
+	/* A source that changed since the last build */
+	st.st_mtim.tv_nsec = 43;
+	asserteq(meta_lookup(&meta, "content/a/1.jpg", &st, &found, &ft, &fe),
+	         false);
+	asserteq(meta.hits, 2);
+	meta_close(&meta);
+
+	unlink(TEST_META);
+}
+
+static void
+test_meta_corrupt(void)
+{
+	struct meta          meta;
+	struct image_exif    found;
+	struct meta_thumb    ft;
+	struct meta_encoding fe;
+	struct stat          st = {0};
+	FILE             *f  = fopen(TEST_META, "w");
+	fputs("definitely not metadata", f);
+	fclose(f);
+
+	meta_open(&meta, TEST_META);
+	asserteq(meta.nold, 0);
+	asserteq(meta_lookup(&meta, "content/a/1.jpg", &st, &found, &ft, &fe),
+	         false);
+	meta_close(&meta);
+
+	unlink(TEST_META);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_meta_roundtrip);
+	RUN_TEST(test_meta_corrupt);
+}
@@ -0,0 +1,76 @@
+#include "tests/tests.h"
+#include "minify.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static char buf[1024];
+
+/* Minifies html in buf and compares the result with expected */
+static int
+minified(const char *html, const char *expected)
+{
+	size_t len = strlen(html);
+	memcpy(buf, html, len);
+	len      = minify_html(buf, len);
+	buf[len] = '\0';
+	if (strcmp(buf, expected)) {
+		fprintf(stderr, "\n got: \"%s\"\nwant: \"%s\"\n", buf, expected);
+		return 1;
+	}
+	return 0;
+}
+
+static void
+test_minify_whitespace(void)
+{
+	asserteq(minified("\n\n  <html>", "<html>"), 0);
+	asserteq(minified("<div>\n\t\t<a href=\"x\">  y  </a>\n\t</div>\n",
+	                  "<div>\n<a href=\"x\"> y </a>\n</div>\n"),
+	         0);
+	asserteq(minified("<img alt=\"a   b\"   src=x  >",
+	                  "<img alt=\"a   b\" src=x>"),
+	         0);
+	asserteq(minified("a < b and c<d", "a < b and c<d"), 0);
+}
+
+static void
+test_minify_comments(void)
+{
+	asserteq(minified("<p>a <!-- c --> b</p>", "<p>a b</p>"), 0);
+	asserteq(minified("<p>a\n<!-- c -->\n\tb</p>", "<p>a\nb</p>"), 0);
+	asserteq(minified("<!--[if IE]><p>x</p><![endif]-->",
+	                  "<!--[if IE]><p>x</p><![endif]-->"),
+	         0);
+	asserteq(minified("<p>a <!-- unterminated", "<p>a <!-- unterminated"), 0);
+}
+
+static void
+test_minify_raw(void)
+{
+	asserteq(minified("<pre>  a\n   b </pre>  <p>",
+	                  "<pre>  a\n   b </pre> <p>"),
+	         0);
+	asserteq(minified("<PRE class=\"x\">  a  </Pre>",
+	                  "<PRE class=\"x\">  a  </Pre>"),
+	         0);
+	asserteq(minified("<script>\n  if (a < b) {\n  }\n</script>",
+	                  "<script>\n  if (a < b) {\n  }\n</script>"),
+	         0);
+	asserteq(minified("<textarea>  <!-- x -->  </textarea>",
+	                  "<textarea>  <!-- x -->  </textarea>"),
+	         0);
+	asserteq(minified("<script src=\"a.js\" defer></script>\n  <p>",
+	                  "<script src=\"a.js\" defer></script>\n<p>"),
+	         0);
+	asserteq(minified("<prefix>  a", "<prefix> a"), 0);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_minify_whitespace);
+	RUN_TEST(test_minify_comments);
+	RUN_TEST(test_minify_raw);
+}
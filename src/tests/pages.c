@@ -0,0 +1,102 @@
+#include "tests/tests.h"
+#include "log.h"
+#include "pages.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define TEST_DIR "/tmp/revela-test-pages"
+
+static void
+test_pages_count(void)
+{
+	asserteq(pages_count(0, 0), 1);
+	asserteq(pages_count(5000, 0), 1);
+	asserteq(pages_count(0, 10), 1);
+	asserteq(pages_count(10, 10), 1);
+	asserteq(pages_count(11, 10), 2);
+	asserteq(pages_count(5000, 48), 105);
+}
+
+static void
+test_pages_range(void)
+{
+	size_t start, end;
+	pages_range(25, 0, 1, &start, &end);
+	asserteq(start, 0);
+	asserteq(end, 25);
+	pages_range(25, 10, 2, &start, &end);
+	asserteq(start, 10);
+	asserteq(end, 20);
+	pages_range(25, 10, 3, &start, &end);
+	asserteq(start, 20);
+	asserteq(end, 25);
+}
+
+static void
+test_pages_path(void)
+{
+	char buf[PATH_MAX];
+	pages_path(buf, "album", 1);
+	asserteq(strcmp(buf, "album/index.html"), 0);
+	pages_path(buf, "album", 12);
+	asserteq(strcmp(buf, "album/page/12/index.html"), 0);
+	pages_url(buf, sizeof buf, "/photos/album", 1);
+	asserteq(strcmp(buf, "/photos/album/"), 0);
+	pages_url(buf, sizeof buf, "", 3);
+	asserteq(strcmp(buf, "/page/3/"), 0);
+}
+
+static void
+test_pages_hashes(void)
+{
+	uint64_t  hashes[] = {0, 0xdeadbeefcafe, UINT64_MAX};
+	uint64_t *read;
+	size_t    n;
+
+	mkdir(TEST_DIR, 0755);
+	asserteq(pages_hashes_write(TEST_DIR, hashes, 3), true);
+	pages_hashes_read(TEST_DIR, &read, &n);
+	asserteq(n, 3);
+	asserteq(memcmp(read, hashes, sizeof hashes), 0);
+	free(read);
+
+	unlink(TEST_DIR "/" PAGES_FILE);
+	pages_hashes_read(TEST_DIR, &read, &n);
+	asserteq(n, 0);
+	asserteq(read == NULL, true);
+}
+
+static void
+test_pages_prune(void)
+{
+	struct stat st;
+	mkdir(TEST_DIR, 0755);
+	asserteq(pages_mkdir(TEST_DIR, 2, false), true);
+	asserteq(pages_mkdir(TEST_DIR, 3, false), true);
+	fclose(fopen(TEST_DIR "/page/3/index.html", "w"));
+
+	pages_prune(TEST_DIR, 2, false);
+	asserteq(stat(TEST_DIR "/page/2", &st), 0);
+	asserteq(stat(TEST_DIR "/page/3", &st), -1);
+	pages_prune(TEST_DIR, 1, false);
+	asserteq(stat(TEST_DIR "/page", &st), -1);
+
+	rmdir(TEST_DIR);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	log_set_verbosity(LOG_SILENT);
+	RUN_TEST(test_pages_count);
+	RUN_TEST(test_pages_range);
+	RUN_TEST(test_pages_path);
+	RUN_TEST(test_pages_hashes);
+	RUN_TEST(test_pages_prune);
+}
@@ -0,0 +1,73 @@
+#include "tests/tests.h"
+#include "phash.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+static unsigned char pic[PHASH_SIZE * PHASH_SIZE];
+static unsigned char other[PHASH_SIZE * PHASH_SIZE];
+
+static void
+test_phash(void)
+{
+	uint32_t seed = 1;
+
+	/* A smooth picture with a bright blob in a corner */
+	for (unsigned y = 0; y < PHASH_SIZE; y++) {
+		for (unsigned x = 0; x < PHASH_SIZE; x++) {
+			unsigned v = x * 4 + y * 2;
+			if (x < 10 && y < 12) v += 100;
+			pic[y * PHASH_SIZE + x] = v > 255 ? 255 : v;
+		}
+	}
+	asserteq(phash(pic), phash(pic));
+
+	/* The same with a little noise and brighter, as if saved again */
+	for (unsigned i = 0; i < sizeof pic; i++) {
+		seed       = seed * 1103515245 + 12345;
+		unsigned v = pic[i] + 10 + (seed >> 29);
+		other[i]   = v > 255 ? 255 : v;
+	}
+	asserteq(phash_distance(phash(pic), phash(other)) <= PHASH_NEAR, true);
+
+	/* Mirrored, which doesn't look the same at all */
+	for (unsigned y = 0; y < PHASH_SIZE; y++) {
+		for (unsigned x = 0; x < PHASH_SIZE; x++) {
+			other[y * PHASH_SIZE + x] =
+				pic[(PHASH_SIZE - 1 - y) * PHASH_SIZE + PHASH_SIZE - 1 - x];
+		}
+	}
+	asserteq(phash_distance(phash(pic), phash(other)) > PHASH_NEAR, true);
+}
+
+static void
+test_phash_distance(void)
+{
+	asserteq(phash_distance(0, 0), 0);
+	asserteq(phash_distance(0, UINT64_MAX), 64);
+	asserteq(phash_distance(0xf0, 0x0f), 8);
+}
+
+static void
+test_phash_band(void)
+{
+	/* Every bit is in exactly one band */
+	for (unsigned bit = 0; bit < 64; bit++) {
+		unsigned in = 0;
+		for (unsigned i = 0; i < PHASH_BANDS; i++) {
+			in += phash_band(UINT64_C(1) << bit, i) != 0;
+		}
+		asserteq(in, 1);
+	}
+	asserteq(phash_band(UINT64_MAX, 0), 0x1f);
+	asserteq(phash_band(UINT64_MAX, PHASH_BANDS - 1), 0x3f);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_phash);
+	RUN_TEST(test_phash_distance);
+	RUN_TEST(test_phash_band);
+}
@@ -0,0 +1,59 @@
+#include "tests/tests.h"
+#include "placeholder.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static void
+test_placeholder_color(void)
+{
+	unsigned char rgb[7 * 3];
+	char          placeholder[PLACEHOLDER_SIZE];
+
+	placeholder_color(rgb, 0, placeholder);
+	asserteq(placeholder[0], '\0');
+
+	for (size_t i = 0; i < 7; i++) {
+		rgb[i * 3]     = 0x10;
+		rgb[i * 3 + 1] = i < 4 ? 0x00 : 0xff;
+		rgb[i * 3 + 2] = 0xfe;
+	}
+	placeholder_color(rgb, 7, placeholder);
+	/* The green is 3 * 0xff / 7, rounded */
+	asserteq(strcmp(placeholder, "#106dfe"), 0);
+
+	placeholder_color(rgb, 1, placeholder);
+	asserteq(strcmp(placeholder, "#1000fe"), 0);
+}
+
+/* More pixels than the lanes can take at once, and not a whole group */
+static void
+test_placeholder_color_large(void)
+{
+	static unsigned char rgb[3001 * 3];
+	uint64_t             sums[3] = {0};
+	uint32_t             seed    = 1;
+	char                 placeholder[PLACEHOLDER_SIZE], want[PLACEHOLDER_SIZE];
+
+	for (size_t i = 0; i < sizeof rgb; i++) {
+		seed   = seed * 1103515245 + 12345;
+		rgb[i] = i % 3 == 0 ? 0xff : seed >> 24;
+		sums[i % 3] += rgb[i];
+	}
+	snprintf(want, sizeof want, "#%02x%02x%02x",
+	         (unsigned)((sums[0] + 1500) / 3001),
+	         (unsigned)((sums[1] + 1500) / 3001),
+	         (unsigned)((sums[2] + 1500) / 3001));
+	placeholder_color(rgb, 3001, placeholder);
+	asserteq(strcmp(placeholder, want), 0);
+	asserteq(strncmp(placeholder, "#ff", 3), 0);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_placeholder_color);
+	RUN_TEST(test_placeholder_color_large);
+}
@@ -0,0 +1,197 @@
+#include "tests/tests.h"
+#include "plan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+static void
+values_set(struct plan_values *v, enum plan_slot slot, const char *str)
+{
+	v->str[slot] = str;
+	v->shape |= 1u << slot;
+}
+
+static void
+values_set_num(struct plan_values *v, enum plan_slot slot, int64_t num)
+{
+	v->num[slot] = num;
+	snprintf(v->numstr[slot], sizeof v->numstr[slot], "%lld", (long long)num);
+	v->shape |= 1u << slot;
+}
+
+static void
+test_plan_render(void)
+{
+	struct plan_values values = {0}, sentinels;
+	char               output[256];
+	char              *buf    = NULL;
+	size_t             bufcap = 0;
+
+	values_set(&values, PLAN_SOURCE, "/album/pic.jpg");
+	values_set(&values, PLAN_NEXT, "/album/pic2/");
+	values_set_num(&values, PLAN_EXIF_ISO, 400);
+	plan_values_sentinels(&sentinels, &values, 0);
+	asserteq(sentinels.shape, values.shape);
+
+	/* What the template would output with the sentinels */
+	snprintf(output, sizeof output,
+	         "<img src=\"%s\"><a href=\"%s\">next</a><p>ISO %s</p>%s",
+	         sentinels.str[PLAN_SOURCE], sentinels.str[PLAN_NEXT],
+	         sentinels.numstr[PLAN_EXIF_ISO], sentinels.str[PLAN_SOURCE]);
+	struct plan *plan = plan_compile(output, strlen(output), &sentinels);
+	asserteq(plan == NULL, false);
+	asserteq(plan_shape(plan), values.shape);
+
+	const char *expected = "<img src=\"/album/pic.jpg\"><a href=\"/album/pic2/\">"
+	                       "next</a><p>ISO 400</p>/album/pic.jpg";
+	size_t len = plan_render(plan, &values, &buf, &bufcap);
+	asserteq(len, strlen(expected));
+	asserteq(strcmp(buf, expected), 0);
+
+	/* Another page of the same shape */
+	values.str[PLAN_NEXT] = "/album/a-much-longer-name/";
+	expected = "<img src=\"/album/pic.jpg\"><a href=\"/album/a-much-longer-name/\">"
+	           "next</a><p>ISO 400</p>/album/pic.jpg";
+	len = plan_render(plan, &values, &buf, &bufcap);
+	asserteq(len, strlen(expected));
+	asserteq(strcmp(buf, expected), 0);
+
+	/* The same page in pieces; empty static runs are left out */
+	struct iovec iov[8];
+	size_t       n = plan_iov(plan, &values, iov, 2);
+	asserteq(n, 8);
+	asserteq(plan_iov(plan, &values, iov, 8), n);
+	size_t off = 0;
+	for (size_t i = 0; i < n; i++) {
+		asserteq(memcmp(buf + off, iov[i].iov_base, iov[i].iov_len), 0);
+		off += iov[i].iov_len;
+	}
+	asserteq(off, len);
+
+	plan_free(plan);
+	free(buf);
+}
+
+static void
+test_plan_render_static(void)
+{
+	struct plan_values values = {0};
+	const char        *output = "<p>no vars</p>";
+	char              *buf    = NULL;
+	size_t             bufcap = 0;
+
+	struct plan *plan = plan_compile(output, strlen(output), &values);
+	asserteq(plan_render(plan, &values, &buf, &bufcap), strlen(output));
+	asserteq(strcmp(buf, output), 0);
+	plan_free(plan);
+	free(buf);
+}
+
+/* What "{% if image.exif.iso > 800 %}high{% else %}low{% endif %}" outputs */
+static void
+render_branch(const struct plan_values *v, char *out, size_t size)
+{
+	snprintf(out, size, "<p>%s ISO %s</p>",
+	         v->num[PLAN_EXIF_ISO] > 800 ? "high" : "low",
+	         v->numstr[PLAN_EXIF_ISO]);
+}
+
+static void
+test_plan_branches(void)
+{
+	struct plan_values dark = {0}, bright = {0}, sentinels;
+	char               output[256];
+	char              *buf    = NULL;
+	size_t             bufcap = 0;
+
+	/* Two pages of the same shape that take different branches */
+	values_set_num(&dark, PLAN_EXIF_ISO, 1600);
+	values_set_num(&bright, PLAN_EXIF_ISO, 100);
+	asserteq(dark.shape, bright.shape);
+
+	plan_values_sentinels(&sentinels, &dark, 0);
+	render_branch(&sentinels, output, sizeof output);
+	struct plan *plan = plan_compile(output, strlen(output), &sentinels);
+	plan_values_sentinels(&sentinels, &dark, 1);
+	render_branch(&sentinels, output, sizeof output);
+	struct plan *alt = plan_compile(output, strlen(output), &sentinels);
+
+	/* A single probe bakes one branch into the plan, which is only right for
+	 * the first page... */
+	plan_render(plan, &dark, &buf, &bufcap);
+	asserteq(strcmp(buf, "<p>high ISO 1600</p>"), 0);
+	plan_render(plan, &bright, &buf, &bufcap);
+	asserteq(!strcmp(buf, "<p>low ISO 100</p>"), false);
+	/* ...but the two sets of sentinels take different branches */
+	asserteq(plan_equal(plan, alt), false);
+	plan_free(alt);
+
+	/* Plans of templates that just output the values are the same */
+	snprintf(output, sizeof output, "<p>ISO %s</p>",
+	         sentinels.numstr[PLAN_EXIF_ISO]);
+	alt = plan_compile(output, strlen(output), &sentinels);
+	plan_values_sentinels(&sentinels, &dark, 0);
+	plan_free(plan);
+	snprintf(output, sizeof output, "<p>ISO %s</p>",
+	         sentinels.numstr[PLAN_EXIF_ISO]);
+	plan = plan_compile(output, strlen(output), &sentinels);
+	asserteq(plan_equal(plan, alt), true);
+
+	plan_free(plan);
+	plan_free(alt);
+	free(buf);
+}
+
+static void
+test_plan_template_safe(void)
+{
+	static const struct {
+		const char *src;
+		bool        safe;
+	} cases[] = {
+		{"{% extends \"base.html\" %}{% block content %}"
+		 "<img src=\"{{ image.source }}\">"
+		 "{% if image.prev %}<a href=\"{{image.prev}}\">"
+		 "{% elif not image.exif.iso %}-{% endif %}"
+		 "{{ album.title }}{% if title %}x{% endif %}{% endblock %}",
+		 true},
+		/* Whole identifiers only */
+		{"{% if images > 1 %}{{ imagery | upper }}{% endif %}", true},
+		{"{% if image.exif.iso > 800 %}high{% endif %}", false},
+		{"{% if image.format == \"png\" %}{% endif %}", false},
+		{"{{ image.date | upper }}", false},
+		{"{% for x in image.exif %}{% endfor %}", false},
+		{"{% set iso = image.exif.iso %}", false},
+		{"{{ image }}", false},
+		{"{{ image.source ", false},
+	};
+	for (size_t i = 0; i < sizeof cases / sizeof *cases; i++) {
+		bool safe = plan_template_safe(cases[i].src);
+		asserteq(safe, cases[i].safe);
+	}
+}
+
+static void
+test_plan_values_safe(void)
+{
+	struct plan_values values = {0};
+	values_set(&values, PLAN_SOURCE, "/album/pic.jpg");
+	values_set_num(&values, PLAN_EXIF_ORIENTATION, 6);
+	asserteq(plan_values_safe(&values), true);
+	values_set(&values, PLAN_EXIF_CAMERA, "Canon <EOS>");
+	asserteq(plan_values_safe(&values), false);
+	values.str[PLAN_EXIF_CAMERA] = "Bob's camera";
+	asserteq(plan_values_safe(&values), false);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_plan_render);
+	RUN_TEST(test_plan_render_static);
+	RUN_TEST(test_plan_branches);
+	RUN_TEST(test_plan_template_safe);
+	RUN_TEST(test_plan_values_safe);
+}
@@ -0,0 +1,46 @@
+#include "tests/tests.h"
+#include "sprite.h"
+
+static void
+test_sprite_layout(void)
+{
+	struct sprite_cell cells[5] = {
+		{.w = 400, .h = 270},
+		{.w = 180, .h = 270},
+		{.w = 400, .h = 200},
+		{.w = 400, .h = 270},
+		{.w = 300, .h = 100},
+	};
+	unsigned long w, h;
+
+	/* Rows of up to 3 * 400 pixels */
+	sprite_layout(cells, 5, &w, &h);
+	asserteq(cells[0].x, 0);
+	asserteq(cells[0].y, 0);
+	asserteq(cells[1].x, 400);
+	asserteq(cells[2].x, 580);
+	asserteq(cells[2].y, 0);
+	asserteq(cells[3].x, 0);
+	asserteq(cells[3].y, 270);
+	asserteq(cells[4].x, 400);
+	asserteq(cells[4].y, 270);
+	asserteq(w, 980);
+	asserteq(h, 540);
+
+	sprite_layout(cells, 1, &w, &h);
+	asserteq(cells[0].x, 0);
+	asserteq(cells[0].y, 0);
+	asserteq(w, 400);
+	asserteq(h, 270);
+
+	sprite_layout(cells, 0, &w, &h);
+	asserteq(w, 0);
+	asserteq(h, 0);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_sprite_layout);
+}
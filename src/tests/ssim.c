@@ -0,0 +1,45 @@
+#include "tests/tests.h"
+#include "ssim.h"
+
+#include <stdint.h>
+
+static void
+test_ssim(void)
+{
+	static unsigned char a[37 * 21], b[37 * 21];
+	uint32_t             seed = 1;
+	double               score;
+
+	asserteq(ssim(a, b, 0, 21, &score), false);
+
+	for (size_t i = 0; i < sizeof a; i++) {
+		seed = seed * 1103515245 + 12345;
+		a[i] = seed >> 24;
+		b[i] = a[i];
+	}
+	asserteq(ssim(a, b, 37, 21, &score), true);
+	asserteq(score > 0.9999, true);
+
+	/* A little noise is still very similar, a flat image isn't at all */
+	for (size_t i = 0; i < sizeof b; i++) {
+		b[i] = a[i] < 4 ? a[i] + 4 : a[i] - 4 + (i % 3) * 4;
+	}
+	asserteq(ssim(a, b, 37, 21, &score), true);
+	asserteq(score > 0.9 && score < 0.9999, true);
+	for (size_t i = 0; i < sizeof b; i++) {
+		b[i] = 128;
+	}
+	asserteq(ssim(a, b, 37, 21, &score), true);
+	asserteq(score < 0.1, true);
+
+	/* Smaller than a window */
+	asserteq(ssim(a, a, 5, 3, &score), true);
+	asserteq(score > 0.9999, true);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_ssim);
+}
@@ -0,0 +1,105 @@
+#include "tests/tests.h"
+#include "log.h"
+#include "viewer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_DIR "/tmp/revela-test-viewer"
+
+static struct image images[2] = {
+	{
+		.basename  = "first.jpg",
+		.url_image = "/album/first/first.jpg",
+		.url_thumb = "/album/first/first_thumb.jpg",
+		.datestr   = "2020-01-02 03:04",
+		.exif      = {.present     = true,
+		              .iso         = 100,
+		              .width       = 4000,
+		              .height      = 2000,
+		              .orientation = 1,
+		              .camera      = "Camera \"X\""},
+	},
+	{
+		.basename  = "second.jpg",
+		.url_image = "/album/second/second.jpg",
+		.url_thumb = "/album/second/second_thumb.jpg",
+	},
+};
+
+static struct image_config conf = {
+	.max_width    = 2000,
+	.max_height   = 2000,
+	.smart_resize = true,
+};
+
+static void
+album_init(struct album *album)
+{
+	memset(album, 0, sizeof *album);
+	album->slug   = TEST_DIR;
+	album->images = vector_new_with_cap(2);
+	vector_push(album->images, &images[0]);
+	vector_push(album->images, &images[1]);
+}
+
+static void
+test_viewer_json(void)
+{
+	struct album album;
+	size_t       len;
+	const char  *expected =
+		"{\"images\":[{\"name\":\"first\","
+		"\"source\":\"/album/first/first.jpg\","
+		"\"thumb\":\"/album/first/first_thumb.jpg\","
+		"\"date\":\"2020-01-02 03:04\",\"width\":2000,\"height\":1000,"
+		"\"exif\":{\"orientation\":1,\"camera\":\"Camera \\\"X\\\"\","
+		"\"iso\":100}},"
+		"{\"name\":\"second\",\"source\":\"/album/second/second.jpg\","
+		"\"thumb\":\"/album/second/second_thumb.jpg\"}]}\n";
+
+	album_init(&album);
+	char *json = viewer_json(&album, &conf, &len);
+	asserteq(len, strlen(expected));
+	asserteq(strcmp(json, expected), 0);
+	free(json);
+	vector_free(album.images);
+}
+
+static void
+test_viewer_write(void)
+{
+	struct album album;
+	struct stat  st;
+
+	album_init(&album);
+	mkdir(TEST_DIR, 0755);
+	unlink(TEST_DIR "/" VIEWER_FILE);
+	asserteq(viewer_write(&album, &conf, true), true);
+	asserteq(stat(TEST_DIR "/" VIEWER_FILE, &st), -1);
+	asserteq(viewer_write(&album, &conf, false), true);
+	asserteq(stat(TEST_DIR "/" VIEWER_FILE, &st), 0);
+
+	/* Unchanged contents leave the file alone */
+	struct timespec mtime = st.st_mtim;
+	sleep(1);
+	asserteq(viewer_write(&album, &conf, false), true);
+	asserteq(stat(TEST_DIR "/" VIEWER_FILE, &st), 0);
+	asserteq(st.st_mtim.tv_sec, mtime.tv_sec);
+
+	unlink(TEST_DIR "/" VIEWER_FILE);
+	rmdir(TEST_DIR);
+	vector_free(album.images);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	log_set_verbosity(LOG_SILENT);
+	RUN_TEST(test_viewer_json);
+	RUN_TEST(test_viewer_write);
+}
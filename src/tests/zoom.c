@@ -0,0 +1,90 @@
+#include "tests/tests.h"
+#include "zoom.h"
+
+#include <string.h>
+
+static const struct zoom_config conf = {
+	.min_megapixels = 50,
+	.tile_size      = 254,
+	.overlap        = 1,
+	.quality        = 85,
+};
+
+static void
+test_zoom_levels(void)
+{
+	struct zoom_level level;
+
+	asserteq(zoom_levels(1, 1), 1);
+	asserteq(zoom_levels(2, 1), 2);
+	asserteq(zoom_levels(1000, 500), 11);
+	asserteq(zoom_levels(500, 1024), 11);
+	asserteq(zoom_levels(500, 1025), 12);
+
+	zoom_level(&conf, 1000, 500, 10, &level);
+	asserteq(level.w, 1000);
+	asserteq(level.h, 500);
+	asserteq(level.cols, 4);
+	asserteq(level.rows, 2);
+	zoom_level(&conf, 1000, 500, 9, &level);
+	asserteq(level.w, 500);
+	asserteq(level.h, 250);
+	asserteq(level.cols, 2);
+	asserteq(level.rows, 1);
+	zoom_level(&conf, 1000, 500, 0, &level);
+	asserteq(level.w, 1);
+	asserteq(level.h, 1);
+	asserteq(level.cols, 1);
+}
+
+static void
+test_zoom_tile(void)
+{
+	struct zoom_level level;
+	unsigned long     x, y, w, h;
+
+	zoom_level(&conf, 1000, 500, 10, &level);
+	zoom_tile(&conf, &level, 0, 0, &x, &y, &w, &h);
+	asserteq(x, 0);
+	asserteq(y, 0);
+	asserteq(w, 255);
+	asserteq(h, 255);
+	zoom_tile(&conf, &level, 1, 1, &x, &y, &w, &h);
+	asserteq(x, 253);
+	asserteq(y, 253);
+	asserteq(w, 256);
+	asserteq(h, 247);
+	zoom_tile(&conf, &level, 3, 0, &x, &y, &w, &h);
+	asserteq(x, 761);
+	asserteq(w, 239);
+}
+
+static void
+test_zoom_descriptor(void)
+{
+	char buf[512];
+
+	asserteq(zoom_wanted(&conf, 8000, 6000), false);
+	asserteq(zoom_wanted(&conf, 10000, 6000), true);
+	asserteq(zoom_wanted(&(struct zoom_config){0}, 100000, 100000), false);
+
+	asserteq(zoom_descriptor(&conf, 1000, 500, buf, sizeof buf), true);
+	asserteq(strcmp(buf,
+	                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	                "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\""
+	                " Format=\"jpg\" Overlap=\"1\" TileSize=\"254\">\n"
+	                "<!-- quality 85 -->\n"
+	                "<Size Width=\"1000\" Height=\"500\"/>\n"
+	                "</Image>\n"),
+	         0);
+	asserteq(zoom_descriptor(&conf, 1000, 500, buf, 64), false);
+}
+
+int
+main(void)
+{
+	INIT_TESTS();
+	RUN_TEST(test_zoom_levels);
+	RUN_TEST(test_zoom_tile);
+	RUN_TEST(test_zoom_descriptor);
+}
@@ -0,0 +1,156 @@
+#include "viewer.h"
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+#include "log.h"
+#include "hash.h"
+#include "compress.h"
+
+static void
+json_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+		switch (*c) {
+		case '"':
+			fputs("\\\"", f);
+			break;
+		case '\\':
+			fputs("\\\\", f);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		default:
+			if (*c < 0x20) {
+				fprintf(f, "\\u%04x", *c);
+			} else {
+				fputc(*c, f);
+			}
+		}
+	}
+	fputc('"', f);
+}
+
+/* Writes ,"key":"value" unless the value is empty */
+static void
+json_member(FILE *f, const char *key, const char *value)
+{
+	if (value == NULL || value[0] == '\0') return;
+	fprintf(f, ",\"%s\":", key);
+	json_string(f, value);
+}
+
+static void
+json_exif(FILE *f, const struct image_exif *exif)
+{
+	if (!exif->present) return;
+	/* The first member of the object is always there */
+	fprintf(f, ",\"exif\":{\"orientation\":%u", exif->orientation);
+	json_member(f, "date", exif->datetime);
+	json_member(f, "camera", exif->camera);
+	json_member(f, "lens", exif->lens);
+	json_member(f, "exposure", exif->exposure);
+	json_member(f, "fnumber", exif->fnumber);
+	json_member(f, "focal_length", exif->focal_length);
+	json_member(f, "latitude", exif->latitude);
+	json_member(f, "longitude", exif->longitude);
+	if (exif->iso > 0) fprintf(f, ",\"iso\":%u", exif->iso);
+	fputc('}', f);
+}
+
+char *
+viewer_json(const struct album *album, const struct image_config *conf,
+            size_t *len)
+{
+	char         *buf = NULL;
+	size_t        i;
+	struct image *image;
+	FILE         *f = open_memstream(&buf, len);
+	if (f == NULL) return NULL;
+
+	fputs("{\"images\":[", f);
+	vector_foreach (album->images, i, image) {
+		/* The name in the anchors of the links to the image */
+		char noext[NAME_MAX + 1];
+		delext(image->basename, noext, NAME_MAX + 1);
+		if (i > 0) fputc(',', f);
+		fputs("{\"name\":", f);
+		json_string(f, noext);
+		json_member(f, "source", image->url_image);
+		json_member(f, "thumb", image->url_thumb);
+		json_member(f, "placeholder", image->thumb.placeholder);
+		json_member(f, "zoom", image->url_zoom);
+		json_member(f, "format", image->format);
+		json_member(f, "date", image->datestr);
+		if (image->exif.width > 0 && image->exif.height > 0) {
+			unsigned long x = image->exif.width, y = image->exif.height;
+			image_fit(conf, &x, &y);
+			/* Browsers rotate the image unless the EXIF data was stripped */
+			if (image->exif.orientation >= 5 && !conf->strip) {
+				unsigned long t = x;
+				x = y;
+				y = t;
+			}
+			fprintf(f, ",\"width\":%lu,\"height\":%lu", x, y);
+		}
+		json_exif(f, &image->exif);
+		fputc('}', f);
+	}
+	fputs("]}\n", f);
+
+	if (fclose(f)) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+bool
+viewer_write(const struct album *album, const struct image_config *conf,
+             bool dry)
+{
+	char        path[PATH_MAX];
+	struct stat st;
+	size_t      len;
+	uint64_t    old;
+	bool        ok   = true;
+	char       *json = viewer_json(album, conf, &len);
+	if (json == NULL) {
+		log_printl_errno(LOG_FATAL, "Memory allocation error");
+		return false;
+	}
+
+	joinpathb(path, album->slug, VIEWER_FILE);
+	if (stat(path, &st) == 0 && (size_t)st.st_size == len
+	    && hash_file(path, &old) && old == hash_bytes(json, len, 0)
+	    && compress_uptodate(path, NULL) == 1) {
+		goto out;
+	}
+
+	log_printl(LOG_INFO, "Writing %s", path);
+	if (dry) goto out;
+	/*
+	 * The siblings go first, since only their presence is checked above: if
+	 * the build stops in between, the file itself is still stale next time.
+	 */
+	struct iovec iov = {.iov_base = json, .iov_len = len};
+	if (!(ok = compress_iov(path, &iov, 1, NULL))) goto out;
+	FILE *f = fopen(path, "w");
+	if (f == NULL || fwrite(json, 1, len, f) != len) ok = false;
+	if (f != NULL && fclose(f)) ok = false;
+	if (!ok) {
+		log_printl_errno(LOG_FATAL, "Can't write %s", path);
+		unlink(path);
+	}
+
+out:
+	free(json);
+	return ok;
+}
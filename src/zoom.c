@@ -0,0 +1,292 @@
+#include "zoom.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+#include "log.h"
+
+/* The tiles of a level, which the threads take a row at a time */
+struct zoom_jobs {
+	pthread_mutex_t           lock;
+	const struct zoom_config *conf;
+	const struct zoom_level  *level;
+	/* The pixels of the level */
+	MagickWand            *wand;
+	const char            *dir;
+	const struct timespec *mtim;
+	unsigned long          next;
+	bool                   failed;
+};
+
+bool
+zoom_wanted(const struct zoom_config *conf, uint32_t w, uint32_t h)
+{
+	return conf->min_megapixels > 0
+	    && (uint64_t)w * h > (uint64_t)conf->min_megapixels * 1000000;
+}
+
+size_t
+zoom_levels(unsigned long w, unsigned long h)
+{
+	unsigned long max = w > h ? w : h;
+	size_t        n   = 0;
+	while (n < sizeof max * CHAR_BIT - 1 && (1UL << n) < max) n++;
+	return n + 1;
+}
+
+void
+zoom_level(const struct zoom_config *conf, unsigned long w, unsigned long h,
+           size_t n, struct zoom_level *level)
+{
+	size_t shift = zoom_levels(w, h) - 1 - n;
+	level->w     = ((w - 1) >> shift) + 1;
+	level->h     = ((h - 1) >> shift) + 1;
+	level->cols  = (level->w + conf->tile_size - 1) / conf->tile_size;
+	level->rows  = (level->h + conf->tile_size - 1) / conf->tile_size;
+}
+
+/* One dimension of zoom_tile() */
+static void
+zoom_span(const struct zoom_config *conf, unsigned long i, unsigned long max,
+          unsigned long *start, unsigned long *len)
+{
+	*start = i * conf->tile_size - (i > 0 ? conf->overlap : 0);
+	*len   = conf->tile_size + (i > 0 ? 2 : 1) * conf->overlap;
+	if (*start + *len > max) *len = max - *start;
+}
+
+void
+zoom_tile(const struct zoom_config *conf, const struct zoom_level *level,
+          unsigned long col, unsigned long row, unsigned long *x,
+          unsigned long *y, unsigned long *w, unsigned long *h)
+{
+	zoom_span(conf, col, level->w, x, w);
+	zoom_span(conf, row, level->h, y, h);
+}
+
+/* What the descriptor has before the size, i.e. the settings */
+static int
+zoom_head(const struct zoom_config *conf, char *buf, size_t size)
+{
+	return snprintf(buf, size,
+	                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	                "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\""
+	                " Format=\"" ZOOM_FORMAT "\" Overlap=\"%zu\""
+	                " TileSize=\"%zu\">\n"
+	                "<!-- quality %u -->\n",
+	                conf->overlap, conf->tile_size, (unsigned)conf->quality);
+}
+
+bool
+zoom_descriptor(const struct zoom_config *conf, unsigned long w,
+                unsigned long h, char *buf, size_t size)
+{
+	int n = zoom_head(conf, buf, size);
+	if (n < 0 || (size_t)n >= size) return false;
+	int m = snprintf(buf + n, size - n,
+	                 "<Size Width=\"%lu\" Height=\"%lu\"/>\n</Image>\n", w, h);
+	return m >= 0 && (size_t)m < size - n;
+}
+
+/* Reads up to size - 1 bytes of the file at path into buf */
+static bool
+zoom_read(const char *path, char *buf, size_t size)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			log_printl_errno(LOG_ERROR, "Couldn't read %s", path);
+		}
+		return false;
+	}
+	size_t n = fread(buf, 1, size - 1, f);
+	buf[n]   = '\0';
+	fclose(f);
+	return true;
+}
+
+int
+zoom_uptodate(const struct zoom_config *conf, const char *path,
+              const struct timespec *mtim)
+{
+	char want[512], have[512];
+	int  n = file_is_uptodate(path, mtim);
+	if (n != 1) return n;
+	n = zoom_head(conf, want, sizeof want);
+	if (!zoom_read(path, have, sizeof have)) return -1;
+	return !strncmp(want, have, n);
+}
+
+static bool
+zoom_passfail(MagickWand *wand, MagickPassFail status, const char *path)
+{
+	if (status != MagickPass) {
+		ExceptionType severity;
+		char         *desc = MagickGetException(wand, &severity);
+		log_printl(LOG_ERROR, "Couldn't make %s: %.1024s", path, desc);
+		MagickRelinquishMemory(desc);
+		return false;
+	}
+	return true;
+}
+
+/* Writes the tiles of the row that aren't up to date */
+static bool
+zoom_row(struct zoom_jobs *jobs, unsigned long row)
+{
+	const struct zoom_level *level = jobs->level;
+	MagickWand              *strip = NULL, *tile;
+	unsigned long            col, x, y, w, h;
+	char                     path[PATH_MAX];
+	bool                     ok = true;
+
+	for (col = 0; ok && col < level->cols; col++) {
+		snprintf(path, PATH_MAX, "%s/%lu_%lu." ZOOM_FORMAT, jobs->dir, col,
+		         row);
+		int isupdate = file_is_uptodate(path, jobs->mtim);
+		if (isupdate == -1) {
+			ok = false;
+			break;
+		}
+		if (isupdate) continue;
+
+		zoom_tile(jobs->conf, level, col, row, &x, &y, &w, &h);
+		/* The strip is only cut once some tile of the row is needed */
+		if (strip == NULL) {
+			strip = CloneMagickWand(jobs->wand);
+			if (!zoom_passfail(strip, MagickCropImage(strip, level->w, h, 0, y),
+			                   path)) {
+				ok = false;
+				break;
+			}
+		}
+		tile = CloneMagickWand(strip);
+		ok   = zoom_passfail(tile, MagickCropImage(tile, w, h, x, 0), path)
+		    && zoom_passfail(tile,
+		                     MagickSetCompressionQuality(tile, jobs->conf->quality),
+		                     path)
+		    && zoom_passfail(tile, MagickWriteImage(tile, path), path);
+		DestroyMagickWand(tile);
+		if (ok) setdatetime(path, jobs->mtim);
+	}
+
+	if (strip != NULL) DestroyMagickWand(strip);
+	return ok;
+}
+
+static void *
+zoom_worker(void *data)
+{
+	struct zoom_jobs *jobs = data;
+	for (;;) {
+		pthread_mutex_lock(&jobs->lock);
+		unsigned long row = jobs->next++;
+		bool          stop = jobs->failed;
+		pthread_mutex_unlock(&jobs->lock);
+		if (stop || row >= jobs->level->rows) break;
+		if (!zoom_row(jobs, row)) {
+			pthread_mutex_lock(&jobs->lock);
+			jobs->failed = true;
+			pthread_mutex_unlock(&jobs->lock);
+		}
+	}
+	return NULL;
+}
+
+/* Writes the tiles of a level with up to nthreads threads */
+static bool
+zoom_rows(struct zoom_jobs *jobs, size_t nthreads)
+{
+	pthread_t *threads;
+	size_t     i, n = 0;
+
+	jobs->next   = 0;
+	jobs->failed = false;
+	if (nthreads > jobs->level->rows) nthreads = jobs->level->rows;
+	if (nthreads > 1 && (threads = calloc(nthreads, sizeof *threads))) {
+		for (; n < nthreads; n++) {
+			if (pthread_create(&threads[n], NULL, zoom_worker, jobs)) break;
+		}
+		/* Whatever the threads didn't get to is done by this one */
+		zoom_worker(jobs);
+		for (i = 0; i < n; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		free(threads);
+	} else {
+		zoom_worker(jobs);
+	}
+	return !jobs->failed;
+}
+
+bool
+zoom_make(MagickWand *wand, const struct zoom_config *conf, const char *path,
+          const char *tiles, const struct timespec *mtim, size_t nthreads,
+          bool dry)
+{
+	struct zoom_jobs  jobs = {.lock = PTHREAD_MUTEX_INITIALIZER, .conf = conf};
+	struct zoom_level level;
+	struct stat       st;
+	unsigned long     w, h;
+	size_t            n;
+	char              desc[512], old[512], dir[PATH_MAX];
+	FILE             *f;
+	bool              ok = false;
+
+	log_printl(LOG_DETAIL, "Making the tiles of %s", path);
+	if (dry) return true;
+	w = MagickGetImageWidth(wand);
+	h = MagickGetImageHeight(wand);
+	n = zoom_levels(w, h);
+
+	/* Tiles of another size or of another layout are of no use */
+	if (!zoom_descriptor(conf, w, h, desc, sizeof desc)) return false;
+	if ((!zoom_read(path, old, sizeof old) || strcmp(old, desc))
+	    && access(tiles, F_OK) == 0 && !rmentry(tiles, false)) {
+		return false;
+	}
+	/* Written first, so it's only up to date once every tile is */
+	if ((f = fopen(path, "w")) == NULL || fputs(desc, f) == EOF) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", path);
+		if (f != NULL) fclose(f);
+		return false;
+	}
+	if (fclose(f)) {
+		log_printl_errno(LOG_ERROR, "Couldn't write %s", path);
+		return false;
+	}
+	if (nmkdir(tiles, &st, false) == NMKDIR_ERROR) return false;
+
+	jobs.wand  = CloneMagickWand(wand);
+	jobs.level = &level;
+	jobs.dir   = dir;
+	jobs.mtim  = mtim;
+	while (n-- > 0) {
+		zoom_level(conf, w, h, n, &level);
+		if ((MagickGetImageWidth(jobs.wand) != level.w
+		     || MagickGetImageHeight(jobs.wand) != level.h)
+		    && !zoom_passfail(jobs.wand,
+		                      MagickResizeImage(jobs.wand, level.w, level.h,
+		                                        BoxFilter, 1.0),
+		                      path)) {
+			goto out;
+		}
+		snprintf(dir, PATH_MAX, "%s/%zu", tiles, n);
+		if (nmkdir(dir, &st, false) == NMKDIR_ERROR) goto out;
+		if (!zoom_rows(&jobs, nthreads)) goto out;
+	}
+	setdatetime(path, mtim);
+	ok = true;
+
+out:
+	DestroyMagickWand(jobs.wand);
+	pthread_mutex_destroy(&jobs.lock);
+	return ok;
+}